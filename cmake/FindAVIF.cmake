@@ -0,0 +1,20 @@
+FIND_PACKAGE(PkgConfig)
+PKG_CHECK_MODULES(PC_AVIF libavif)
+
+FIND_PATH(AVIF_INCLUDE_DIR
+    NAMES avif/avif.h
+    HINTS ${PC_AVIF_INCLUDEDIR}
+          ${PC_AVIF_INCLUDE_DIRS}
+)
+
+FIND_LIBRARY(AVIF_LIBRARY
+    NAMES avif libavif
+    HINTS ${PC_AVIF_LIBDIR}
+          ${PC_AVIF_LIBRARY_DIRS}
+)
+
+set(AVIF_INCLUDE_DIRS ${AVIF_INCLUDE_DIR})
+set(AVIF_LIBRARIES ${AVIF_LIBRARY})
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(AVIF DEFAULT_MSG AVIF_LIBRARY AVIF_INCLUDE_DIR)
+mark_as_advanced(AVIF_LIBRARY AVIF_INCLUDE_DIR)
@@ -4,12 +4,18 @@
 # and following variables are set:
 #    PROJ_INCLUDE_DIR
 #    PROJ_LIBRARY
+#    PROJ_VERSION_MAJOR (when proj.h, PROJ 5 and later, is available)
 
 
 FIND_PATH(PROJ_INCLUDE_DIR proj_api.h)
 
 FIND_LIBRARY(PROJ_LIBRARY NAMES proj proj_i)
 
+if(PROJ_INCLUDE_DIR AND EXISTS "${PROJ_INCLUDE_DIR}/proj.h")
+  file(STRINGS "${PROJ_INCLUDE_DIR}/proj.h" PROJ_VERSION_MAJOR_LINE REGEX "^#define[ \t]+PROJ_VERSION_MAJOR[ \t]+[0-9]+")
+  string(REGEX REPLACE "^#define[ \t]+PROJ_VERSION_MAJOR[ \t]+([0-9]+).*" "\\1" PROJ_VERSION_MAJOR "${PROJ_VERSION_MAJOR_LINE}")
+endif()
+
 set(PROJ_INCLUDE_DIRS ${PROJ_INCLUDE_DIR})
 set(PROJ_LIBRARIES ${PROJ_LIBRARY})
 include(FindPackageHandleStandardArgs)
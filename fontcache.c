@@ -188,6 +188,47 @@ void msFontCacheCleanup() {
 #endif
 }
 
+#ifdef USE_THREAD
+/*
+** Removes the font cache of the calling thread from the per thread list and
+** returns it, so that glyphs laid out by a thread about to exit can still be
+** rendered by another one until msFontCacheRelease() is called. Returns NULL
+** if the thread has no cache of its own.
+*/
+void* msFontCacheDetach() {
+  ft_thread_cache *prev = NULL, *cur;
+  void* nThreadId;
+
+  if (use_global_ft_cache)
+    return NULL;
+
+  nThreadId = msGetThreadId();
+  msAcquireLock( TLOCK_TTF );
+  cur = ft_caches;
+  while( cur != NULL && cur->thread_id != nThreadId ) {
+    prev = cur;
+    cur = cur->next;
+  }
+  if( cur != NULL ) {
+    if( prev != NULL )
+      prev->next = cur->next;
+    else
+      ft_caches = cur->next;
+    cur->next = NULL;
+  }
+  msReleaseLock( TLOCK_TTF );
+
+  return cur;
+}
+
+void msFontCacheRelease(void *cache) {
+  if(cache) {
+    msFreeFontCache(&((ft_thread_cache*)cache)->cache);
+    free(cache);
+  }
+}
+#endif
+
 unsigned int msGetGlyphIndex(face_element *face, unsigned int unicode) {
   index_element *ic;
   if(face->face->charmap && face->face->charmap->encoding == FT_ENCODING_MS_SYMBOL) {
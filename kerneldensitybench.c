@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  Benchmark of the kernel density blur, comparing the gaussian and
+ *           box blurs of msKernelDensityBlur() with the original per column
+ *           gaussian convolution.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2019 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Not part of the default build. From a build directory:
+**
+**   cc -O2 -I.. -I. ../kerneldensitybench.c -o kerneldensitybench \
+**      -L. -lmapserver -lm
+**   ./kerneldensitybench [-size width height] [-samples n] [-threads n]
+**
+** For each radius the grid is filled with the same random samples and blurred
+** with the original implementation (old), the current gaussian (gaussian) and
+** the box blur cascade (box). The times are the best of a few runs; the diff
+** columns give the largest difference with the old result away from the
+** borders, relative to its largest value. Build MapServer with optimizations
+** (e.g. CMAKE_BUILD_TYPE=Release) for meaningful numbers.
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+#define BENCH_RUNS 3
+
+static const int radii[] = { 5, 10, 20, 35, 50, 75, 100, 150, 200 };
+
+/*
+** The gaussian blur of kerneldensity.c before the row by row rewrite, kept
+** as the reference.
+*/
+static void old_gaussian_blur(float *values, int width, int height, int radius)
+{
+  float *tmp = (float*)msSmallMalloc(width*height*sizeof(float));
+  int length = radius*2+1;
+  float *kernel = (float*)msSmallMalloc(length*sizeof(float));
+  float sigma=radius/3.0;
+  float a=1.0/ sqrt(2.0*M_PI*sigma*sigma);
+  float den=2.0*sigma*sigma;
+  int i,x,y;
+
+  for (i=0; i<length; i++) {
+    float x=i - radius;
+    float v=a * exp(-(x*x) / den);
+    kernel[i]=v;
+  }
+  memset(tmp,0,width*height*sizeof(float));
+
+  for(y=0; y<height; y++) {
+    float* src_row=values + width*y;
+    float* dst_row=tmp + width*y;
+
+    for(x=radius; x<width-radius; x++) {
+      float accum=0;
+      for(i=0; i<length; i++) {
+        accum+=src_row[x+i-radius] * kernel[i];
+      }
+      dst_row[x]=accum;
+    }
+  }
+
+  for(x=0; x<width; x++) {
+    float* src_col=tmp+x;
+    float* dst_col=values+x;
+
+    for(y=radius; y<height-radius; y++) {
+      float accum=0;
+      for (i=0; i<length; i++) {
+        accum+=src_col[width*(y+i-radius)] * kernel[i];
+      }
+      dst_col[y*width]=accum;
+    }
+  }
+  free(tmp);
+  free(kernel);
+}
+
+static void fill_samples(float *values, int width, int height, int nsamples)
+{
+  int i;
+  srand(1);
+  memset(values, 0, width*height*sizeof(float));
+  for(i=0; i<nsamples; i++)
+    values[(rand() % height) * width + rand() % width] += 1 + rand() % 10;
+}
+
+static double elapsed(struct mstimeval *start, struct mstimeval *end)
+{
+  return (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+** Blurs a fresh copy of samples into result, method being -1 for the old
+** blur, 0 for the gaussian and 1 for the box blur. Returns the best time.
+*/
+static double time_blur(const float *samples, float *result, int width, int height,
+                        int radius, int method, int nthreads)
+{
+  struct mstimeval start, end;
+  double t, best = -1;
+  int run;
+
+  for(run=0; run<BENCH_RUNS; run++) {
+    memcpy(result, samples, width*height*sizeof(float));
+    msGettimeofday(&start, NULL);
+    if(method < 0)
+      old_gaussian_blur(result, width, height, radius);
+    else
+      msKernelDensityBlur(result, width, height, radius, method, nthreads);
+    msGettimeofday(&end, NULL);
+    t = elapsed(&start, &end);
+    if(best < 0 || t < best)
+      best = t;
+  }
+  return best;
+}
+
+/*
+** The old blur leaves the border of the grid unfiltered, so only the pixels
+** at least radius away from the edges are compared.
+*/
+static double max_rel_diff(const float *ref, const float *values, int width, int height, int radius)
+{
+  double maxref = 0, maxdiff = 0;
+  int x, y;
+  for(y=radius; y<height-radius; y++) {
+    for(x=radius; x<width-radius; x++) {
+      maxref = MS_MAX(maxref, fabs(ref[y*width+x]));
+      maxdiff = MS_MAX(maxdiff, fabs(ref[y*width+x] - values[y*width+x]));
+    }
+  }
+  return maxref > 0 ? maxdiff / maxref : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int width = 1024, height = 1024, nsamples = 2000, nthreads = 1;
+  int i, r;
+  float *samples, *ref, *result;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-size") == 0 && i+2 < argc) {
+      width = atoi(argv[i+1]);
+      height = atoi(argv[i+2]);
+      i += 2;
+    } else if(strcmp(argv[i], "-samples") == 0 && i+1 < argc) {
+      nsamples = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-threads") == 0 && i+1 < argc) {
+      nthreads = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Syntax: kerneldensitybench [-size width height] [-samples n] [-threads n]\n");
+      exit(1);
+    }
+  }
+
+  if(width <= 2*radii[sizeof(radii)/sizeof(radii[0])-1] || height <= 2*radii[sizeof(radii)/sizeof(radii[0])-1]) {
+    fprintf(stderr, "The grid must be larger than twice the largest radius (%d).\n",
+            radii[sizeof(radii)/sizeof(radii[0])-1]);
+    exit(1);
+  }
+
+  samples = (float*)msSmallMalloc(width*height*sizeof(float));
+  ref = (float*)msSmallMalloc(width*height*sizeof(float));
+  result = (float*)msSmallMalloc(width*height*sizeof(float));
+  fill_samples(samples, width, height, nsamples);
+
+  printf("%dx%d grid, %d samples, %d thread(s)\n", width, height, nsamples, nthreads);
+  printf("radius     old(s) gaussian(s)   speedup   diff        box(s)   speedup   diff\n");
+
+  for(r=0; r<(int)(sizeof(radii)/sizeof(radii[0])); r++) {
+    int radius = radii[r];
+    double t_old, t_gauss, t_box, d_gauss, d_box;
+
+    t_old = time_blur(samples, ref, width, height, radius, -1, nthreads);
+    t_gauss = time_blur(samples, result, width, height, radius, 0, nthreads);
+    d_gauss = max_rel_diff(ref, result, width, height, radius);
+    t_box = time_blur(samples, result, width, height, radius, 1, nthreads);
+    d_box = max_rel_diff(ref, result, width, height, radius);
+
+    printf("%6d %10.4f %11.4f %8.1fx %6.0e %13.4f %8.1fx %6.0e\n", radius,
+           t_old, t_gauss, t_old / t_gauss, d_gauss, t_box, t_old / t_box, d_box);
+  }
+
+  free(samples);
+  free(ref);
+  free(result);
+  return 0;
+}
@@ -1146,6 +1146,26 @@ int msCopyLayer(layerObj *dst, layerObj *src)
     msCopyCompositer(&dst->compositer, src->compositer);
   }
 
+  MS_COPYSTELEM(minfeaturesize);
+
+  if (msCopyHashTable(&(dst->bindvals), &(src->bindvals)) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  MS_COPYSTRING(dst->_geomtransform.string, src->_geomtransform.string);
+  MS_COPYSTELEM(_geomtransform.type);
+
+  MS_COPYSTRING(dst->utfitem, src->utfitem);
+  MS_COPYSTELEM(utfitemindex);
+
+  return_value = msCopyExpression(&(dst->utfdata), &(src->utfdata));
+  if (return_value != MS_SUCCESS) {
+    msSetError(MS_MEMERR, "Failed to copy utfdata.", "msCopyLayer()");
+    return MS_FAILURE;
+  }
+
+  if (src->sortBy.nProperties > 0)
+    msLayerSetSort(dst, &(src->sortBy));
+
   return MS_SUCCESS;
 }
 
@@ -1200,6 +1220,8 @@ int msCopyMap(mapObj *dst, mapObj *src)
   MS_COPYSTELEM(imagequality);
 
   MS_COPYRECT(&(dst->extent), &(src->extent));
+  MS_COPYSTELEM(gt);
+  MS_COPYRECT(&(dst->saved_extent), &(src->saved_extent));
 
   MS_COPYSTELEM(cellsize);
   MS_COPYSTELEM(units);
@@ -34,6 +34,7 @@
 #include "mapcopy.h"
 #include "mapfile.h"
 #include "mapows.h"
+#include "mapthread.h"
 
 
 /* msPrepareImage()
@@ -210,6 +211,278 @@ static int msCompositeRasterBuffer(mapObj *map, imageObj *img, rasterBufferObj *
   return ret;
 }
 
+#ifdef USE_THREAD
+/*
+** Parallel layer drawing, enabled with CONFIG "MS_DRAW_THREADS" "n". Runs
+** of consecutive layers that only read shared map state are drawn by a pool
+** of threads, each layer in its own transparent image and label cache. The
+** images are composited and the labels merged in layer order afterwards, so
+** the result is the same as if the layers had been drawn one by one.
+** Only for AGG output: the other renderers (e.g. Cairo) create their symbol
+** surfaces lazily in symbol->renderer_cache while drawing, without a lock.
+*/
+typedef struct {
+  layerObj *layer;
+  imageObj *image;
+  labelCacheObj labelcache;
+  int status;
+  double elapsed;
+  errorObj error; /* copy of the error raised by a worker thread */
+} layerDrawJobObj;
+
+typedef struct {
+  mapObj *map;
+  layerDrawJobObj *jobs;
+  int numjobs;
+  int nextjob;
+} layerDrawQueueObj;
+
+typedef struct {
+  layerDrawQueueObj *queue;
+  void *thread;
+  void *fontcache;
+} layerDrawThreadObj;
+
+static int styleCanBeDrawnInThread(mapObj *map, styleObj *style, rendererVTableObj *renderer)
+{
+  symbolObj *symbol;
+
+  /* symbols bound to an attribute may be loaded into the symbolset while drawing */
+  if(style->bindings[MS_STYLE_BINDING_SYMBOL].item)
+    return MS_FALSE;
+  if(style->symbol <= 0 || style->symbol >= map->symbolset.numsymbols)
+    return MS_TRUE;
+
+  symbol = map->symbolset.symbol[style->symbol];
+  if(symbol->type == MS_SYMBOL_SVG) /* rasterized per scale into the shared symbol */
+    return MS_FALSE;
+  if(symbol->type == MS_SYMBOL_PIXMAP && !symbol->pixmap_buffer) {
+    errorObj *ms_error = msGetErrorObj();
+    errorObj saved = *ms_error;
+    if(msPreloadImageSymbol(renderer, symbol) != MS_SUCCESS) {
+      /* let the sequential path report it: drop the errors set by the preload
+         (always inserted right after the head) and restore the head */
+      while(ms_error->next != saved.next) {
+        errorObj *added = ms_error->next;
+        ms_error->next = added->next;
+        msFree(added);
+      }
+      *ms_error = saved;
+      return MS_FALSE;
+    }
+  }
+  return MS_TRUE;
+}
+
+/*
+** Can layer be drawn concurrently with other layers? Pixmap symbols are
+** loaded here, as this is called before any thread is started.
+*/
+static int layerCanBeDrawnInThread(mapObj *map, layerObj *layer, rendererVTableObj *renderer)
+{
+  int i, j, k;
+
+  if(layer->type == MS_LAYER_RASTER || layer->type == MS_LAYER_CHART)
+    return MS_FALSE;
+
+  switch(layer->connectiontype) {
+    case MS_SHAPEFILE:
+    case MS_INLINE:
+    case MS_OGR:
+    case MS_POSTGIS:
+      break;
+    case MS_TILED_SHAPEFILE:
+      if(msGetLayerIndex(map, layer->tileindex) != -1) /* the tileindex layer would be shared */
+        return MS_FALSE;
+      break;
+    default:
+      return MS_FALSE;
+  }
+
+  if(layer->mask)
+    return MS_FALSE;
+  for(i=0; i<map->numlayers; i++) {
+    if(GET_LAYER(map, i)->mask && layer->name && strcmp(GET_LAYER(map, i)->mask, layer->name) == 0)
+      return MS_FALSE;
+  }
+
+  if(layer->compositer && !layer->compositer->next && layer->compositer->opacity == 0)
+    return MS_FALSE;
+  if(layer->compositer && !renderer->compositeRasterBuffer)
+    return MS_FALSE;
+
+  /* these alter the map's label cache or the renderer vtable shared by all images */
+  if(msLayerGetProcessingKey(layer, "FORCE_DRAW_LABEL_CACHE") ||
+      msLayerGetProcessingKey(layer, "RENDERER") ||
+      msLayerGetProcessingKey(layer, "APPROXIMATION_SCALE"))
+    return MS_FALSE;
+
+  /* the PROJ handle of the map projection cannot be used by several threads at once */
+  if(layer->projection.numargs > 0 && map->projection.numargs > 0 &&
+      !(layer->projection.numargs == 1 && map->projection.numargs == 1 &&
+        strcmp(layer->projection.args[0], map->projection.args[0]) == 0))
+    return MS_FALSE;
+
+  for(i=0; i<layer->numclasses; i++) {
+    classObj *c = layer->class[i];
+    for(j=0; j<c->numstyles; j++) {
+      if(!styleCanBeDrawnInThread(map, c->styles[j], renderer))
+        return MS_FALSE;
+    }
+    for(j=0; j<c->numlabels; j++) {
+      for(k=0; k<c->labels[j]->numstyles; k++) {
+        if(!styleCanBeDrawnInThread(map, c->labels[j]->styles[k], renderer))
+          return MS_FALSE;
+      }
+    }
+  }
+
+  return MS_TRUE;
+}
+
+static layerDrawJobObj *nextLayerDrawJob(layerDrawQueueObj *queue)
+{
+  layerDrawJobObj *job = NULL;
+
+  msAcquireLock(TLOCK_DRAW);
+  if(queue->nextjob < queue->numjobs)
+    job = &(queue->jobs[queue->nextjob++]);
+  msReleaseLock(TLOCK_DRAW);
+
+  return job;
+}
+
+static void runLayerDrawJobs(layerDrawQueueObj *queue, int worker)
+{
+  layerDrawJobObj *job;
+  struct mstimeval starttime, endtime;
+
+  while((job = nextLayerDrawJob(queue)) != NULL) {
+    LayerCompositer *compositer = job->layer->compositer;
+
+    msGettimeofday(&starttime, NULL);
+
+    /* compositing is done when the job's image is merged into the map image */
+    job->layer->compositer = NULL;
+    job->layer->drawlabelcache = &(job->labelcache);
+    job->status = msDrawLayer(queue->map, job->layer, job->image);
+    job->layer->drawlabelcache = NULL;
+    job->layer->compositer = compositer;
+
+    msGettimeofday(&endtime, NULL);
+    job->elapsed = (endtime.tv_sec+endtime.tv_usec/1.0e6) - (starttime.tv_sec+starttime.tv_usec/1.0e6);
+
+    if(job->status != MS_SUCCESS && worker) {
+      job->error = *msGetErrorObj();
+      job->error.next = NULL;
+    }
+  }
+}
+
+static void layerDrawThread(void *arg)
+{
+  layerDrawThreadObj *thread = (layerDrawThreadObj *) arg;
+
+  runLayerDrawJobs(thread->queue, MS_TRUE);
+
+  /* the cached labels may point to glyphs of this thread's font cache */
+  thread->fontcache = msFontCacheDetach();
+  msResetErrorList();
+  msDebugCleanup();
+}
+
+/*
+** Draws layers[0..numlayers) into image with up to numthreads threads.
+*/
+static int msDrawLayersInThreads(mapObj *map, imageObj *image, layerObj **layers, int numlayers, int numthreads)
+{
+  rendererVTableObj *renderer = MS_IMAGE_RENDERER(image);
+  layerDrawQueueObj queue;
+  layerDrawThreadObj *threads;
+  int i, status = MS_SUCCESS;
+
+  queue.map = map;
+  queue.numjobs = numlayers;
+  queue.nextjob = 0;
+  queue.jobs = (layerDrawJobObj *) msSmallCalloc(numlayers, sizeof(layerDrawJobObj));
+
+  /* images are created here, an outputformat's refcount is not protected by a lock */
+  for(i=0; i<numlayers; i++) {
+    layerDrawJobObj *job = &(queue.jobs[i]);
+    job->layer = layers[i];
+    job->error.code = MS_NOERR;
+    msInitLabelCache(&(job->labelcache));
+    job->image = msImageCreate(image->width, image->height, image->format, image->imagepath, image->imageurl,
+                               map->resolution, map->defresolution, NULL);
+    if(!job->image) {
+      msSetError(MS_MISCERR, "Unable to initialize temporary transparent image.", "msDrawLayersInThreads()");
+      status = MS_FAILURE;
+      break;
+    }
+    job->image->map = map;
+  }
+
+  if(status == MS_SUCCESS) {
+    if(numthreads > numlayers)
+      numthreads = numlayers;
+    threads = (layerDrawThreadObj *) msSmallCalloc(numthreads, sizeof(layerDrawThreadObj));
+
+    /* the calling thread takes its share of the jobs too */
+    for(i=1; i<numthreads; i++) {
+      threads[i].queue = &queue;
+      threads[i].thread = msThreadCreate(layerDrawThread, &threads[i]);
+    }
+    runLayerDrawJobs(&queue, MS_FALSE);
+    for(i=1; i<numthreads; i++) {
+      if(threads[i].thread)
+        msThreadJoin(threads[i].thread);
+      if(threads[i].fontcache) {
+        map->labelcache.fontcaches = (void **) msSmallRealloc(map->labelcache.fontcaches, (map->labelcache.numfontcaches+1) * sizeof(void *));
+        map->labelcache.fontcaches[map->labelcache.numfontcaches++] = threads[i].fontcache;
+      }
+    }
+    free(threads);
+
+    for(i=0; i<numlayers && status == MS_SUCCESS; i++) {
+      layerDrawJobObj *job = &(queue.jobs[i]);
+      rasterBufferObj rb;
+
+      if(job->status != MS_SUCCESS) {
+        if(job->error.code != MS_NOERR)
+          msSetError(job->error.code, "%s", job->error.routine, job->error.message);
+        msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", job->layer->name);
+        status = MS_FAILURE;
+        break;
+      }
+
+      if(map->debug >= MS_DEBUGLEVEL_TUNING || job->layer->debug >= MS_DEBUGLEVEL_TUNING)
+        msDebug("msDrawMap(): Layer %d (%s), %.3fs (threaded)\n",
+                job->layer->index, job->layer->name?job->layer->name:"(null)", job->elapsed);
+
+      memset(&rb,0,sizeof(rasterBufferObj));
+      status = renderer->getRasterBufferHandle(job->image,&rb);
+      if(status == MS_SUCCESS) {
+        if(job->layer->compositer)
+          status = msCompositeRasterBuffer(map,image,&rb,job->layer->compositer);
+        else
+          status = renderer->mergeRasterBuffer(image,&rb,1.0,0,0,0,0,rb.width,rb.height);
+      }
+      if(status == MS_SUCCESS)
+        status = msMergeLabelCache(&(map->labelcache), &(job->labelcache));
+    }
+  }
+
+  for(i=0; i<numlayers; i++) {
+    if(queue.jobs[i].image)
+      msFreeImage(queue.jobs[i].image);
+    msFreeLabelCache(&(queue.jobs[i].labelcache));
+  }
+  free(queue.jobs);
+
+  return status;
+}
+#endif /* USE_THREAD */
+
 /*
  * Generic function to render the map file.
  * The type of the image created is based on the imagetype parameter in the map file.
@@ -233,6 +506,10 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   int numOWSRequests=0;
   wmsParamsObj sLastWMSParams;
 #endif
+#ifdef USE_THREAD
+  int numdrawthreads = 0;
+  int runscanned = 0;
+#endif
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&mapstarttime, NULL);
 
@@ -348,8 +625,51 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
 
   /* OK, now we can start drawing */
+#ifdef USE_THREAD
+  if(!querymap && msGetConfigOption(map, "MS_DRAW_THREADS") &&
+      image->format->renderer == MS_RENDER_WITH_AGG)
+    numdrawthreads = MS_MIN(atoi(msGetConfigOption(map, "MS_DRAW_THREADS")), MS_MAX_THREADS);
+#endif
+
   for(i=0; i<map->numlayers; i++) {
 
+#ifdef USE_THREAD
+    /* draw the run of thread safe layers starting here, if any, concurrently */
+    if(numdrawthreads > 1 && i >= runscanned) {
+      layerObj **runlayers = (layerObj **) msSmallMalloc((map->numlayers-i) * sizeof(layerObj *));
+      int numrunlayers = 0;
+
+      for(runscanned=i; runscanned<map->numlayers; runscanned++) {
+        if(map->layerorder[runscanned] == -1)
+          continue;
+        lp = GET_LAYER(map, map->layerorder[runscanned]);
+        if(lp->postlabelcache || !msLayerIsVisible(map, lp))
+          continue;
+        if(!layerCanBeDrawnInThread(map, lp, MS_IMAGE_RENDERER(image)))
+          break;
+        runlayers[numrunlayers++] = lp;
+      }
+
+      if(numrunlayers > 1) {
+        status = msDrawLayersInThreads(map, image, runlayers, numrunlayers, numdrawthreads);
+        free(runlayers);
+        if(status == MS_FAILURE) {
+          msFreeImage(image);
+#if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
+          if (pasOWSReqInfo) {
+            msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
+            msFree(pasOWSReqInfo);
+          }
+#endif /* USE_WMS_LYR || USE_WFS_LYR */
+          return(NULL);
+        }
+        i = runscanned - 1; /* resume with the layer that ended the run */
+        continue;
+      }
+      free(runlayers);
+    }
+#endif /* USE_THREAD */
+
     if(map->layerorder[i] != -1) {
       char *force_draw_label_cache = NULL;
 
@@ -1093,6 +1413,28 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     return MS_FAILURE;
   }
 
+#ifdef USE_PROJ
+  /* PROCESSING "APPROXIMATE_REPROJECTION=<max error in pixels>|ON" */
+  /* interpolates projected vertices over a grid of the searchrect */
+  if(layer->project && layer->transform == MS_TRUE && map->cellsize > 0) {
+    const char *approx = msLayerGetProcessingKey(layer, "APPROXIMATE_REPROJECTION");
+    if(approx) {
+      double max_error = atof(approx);
+      if(strcasecmp(approx, "ON") == 0 || strcasecmp(approx, "TRUE") == 0 || strcasecmp(approx, "YES") == 0)
+        max_error = 0.25;
+      layer->approxgrid = msProjectCreateApproxGrid(&layer->projection, &map->projection,
+                          &searchrect, max_error * map->cellsize);
+      if(layer->debug >= MS_DEBUGLEVEL_V) {
+        if(layer->approxgrid)
+          msDebug("msDrawVectorLayer(): approximate reprojection for layer %s, %d of %d grid cells projected exactly\n",
+                  layer->name, layer->approxgrid->numexact, layer->approxgrid->nx * layer->approxgrid->ny);
+        else
+          msDebug("msDrawVectorLayer(): approximate reprojection not applicable to layer %s\n", layer->name);
+      }
+    }
+  }
+#endif
+
   /* step through the target shapes */
   msInitShape(&shape);
 
@@ -1225,6 +1567,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if (classgroup)
     msFree(classgroup);
 
+  msFreeApproxGrid(layer->approxgrid);
+  layer->approxgrid = NULL;
+
   if(status != MS_DONE || retcode == MS_FAILURE) {
     msLayerClose(layer);
     if(shpcache) {
@@ -1687,7 +2032,7 @@ int pointLayerDrawShape(mapObj *map, imageObj *image, layerObj *layer, shapeObj
 
 #ifdef USE_PROJ
   if (layer->project && layer->transform == MS_TRUE)
-    msProjectShape(&layer->projection, &map->projection, shape);
+    msProjectShapeApprox(layer->approxgrid, &layer->projection, &map->projection, shape);
 #endif
 
   // Only take into account map rotation if the label and style angles are
@@ -2015,7 +2360,7 @@ int msDrawShape(mapObj *map, layerObj *layer, shapeObj *shape, imageObj *image,
 
 #ifdef USE_PROJ
   if (layer->project && layer->transform == MS_TRUE)
-    msProjectShape(&layer->projection, &map->projection, shape);
+    msProjectShapeApprox(layer->approxgrid, &layer->projection, &map->projection, shape);
 #endif
 
   /* check if we'll need the unclipped shape */
@@ -2846,10 +3191,11 @@ int computeMarkerBounds(mapObj *map, pointObj *annopoint, textSymbolObj *ts, lab
 
 int msCheckLabelMinDistance(mapObj *map, labelCacheMemberObj *lc)
 {
-  int i;
   textSymbolObj *s; /* shortcut */
   textSymbolObj *ts;
   rectObj buffered;
+  labelCacheGridSearchObj search;
+  labelCacheGridEntryObj *entry;
   if (lc->numtextsymbols == 0)
     return MS_FALSE; /* no label with text */
   s = lc->textsymbols[0];
@@ -2868,8 +3214,9 @@ int msCheckLabelMinDistance(mapObj *map, labelCacheMemberObj *lc)
   buffered.maxx += s->label->mindistance * s->resolutionfactor;
   buffered.maxy += s->label->mindistance * s->resolutionfactor;
 
-  for (i = 0; i < map->labelcache.num_rendered_members; i++) {
-    labelCacheMemberObj *ilc = map->labelcache.rendered_text_symbols[i];
+  msLabelCacheGridSearchInit(&search, &map->labelcache.rendered_grid, &buffered);
+  while ((entry = msLabelCacheGridSearchNext(&search)) != NULL) {
+    labelCacheMemberObj *ilc = map->labelcache.rendered_text_symbols[entry->index];
     if (ilc->numtextsymbols == 0 || !ilc->textsymbols[0]->annotext)
        continue;
 
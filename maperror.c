@@ -533,6 +533,12 @@ char *msGetVersion()
 #ifdef USE_KML
   strcat(version, " OUTPUT=KML");
 #endif
+#ifdef USE_WEBP
+  strcat(version, " OUTPUT=WEBP");
+#endif
+#ifdef USE_AVIF
+  strcat(version, " OUTPUT=AVIF");
+#endif
 #ifdef USE_PROJ
   strcat(version, " SUPPORTS=PROJ");
 #endif
@@ -41,6 +41,9 @@
 #include "mapthread.h"
 #include "maptime.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #ifdef USE_GDAL
 #  include "cpl_conv.h"
 #  include "gdal.h"
@@ -3821,6 +3824,9 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->layerinfo = NULL;
   layer->wfslayerinfo = NULL;
+  layer->classlookup = NULL;
+  layer->drawlabelcache = NULL;
+  layer->approxgrid = NULL;
 
   layer->items = NULL;
   layer->iteminfo = NULL;
@@ -3911,6 +3917,7 @@ int freeLayer(layerObj *layer)
 
   if(msLayerIsOpen(layer))
     msLayerClose(layer);
+  msFreeClassLookup(layer);
 
   msFree(layer->name);
   msFree(layer->encoding);
@@ -6261,6 +6268,18 @@ int msFreeLabelCache(labelCacheObj *cache)
 
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   msFree(cache->rendered_text_symbols);
+  msFreeLabelCacheGrid(&cache->rendered_grid);
+  msFreeLabelCacheGrid(&cache->marker_grid);
+  memset(cache->num_indexed_markers, 0, sizeof(cache->num_indexed_markers));
+
+#ifdef USE_THREAD
+  /* font caches of the threads that laid out some of the labels, see msDrawMap() */
+  for(p=0; p<cache->numfontcaches; p++)
+    msFontCacheRelease(cache->fontcaches[p]);
+#endif
+  msFree(cache->fontcaches);
+  cache->fontcaches = NULL;
+  cache->numfontcaches = 0;
 
   return MS_SUCCESS;
 }
@@ -6297,6 +6316,11 @@ int msInitLabelCache(labelCacheObj *cache)
   cache->gutter = 0;
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   cache->rendered_text_symbols = NULL;
+  memset(&cache->rendered_grid, 0, sizeof(labelCacheGridObj));
+  memset(&cache->marker_grid, 0, sizeof(labelCacheGridObj));
+  memset(cache->num_indexed_markers, 0, sizeof(cache->num_indexed_markers));
+  cache->fontcaches = NULL;
+  cache->numfontcaches = 0;
 
   return MS_SUCCESS;
 }
@@ -6807,6 +6831,137 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   return map;
 }
 
+/*
+** Cache of parsed mapfiles for long running processes (e.g. FastCGI). Entries are keyed
+** by filename and invalidated when the modification time of the mapfile changes. The
+** cached mapObj is only used as a template, callers always get a private copy made with
+** msCopyMap() that they must release with msFreeMap(). Note that only the main mapfile
+** is checked, changes to INCLUDEd files are not detected.
+*/
+#define MS_MAPCACHE_MAX_ENTRIES 16
+
+typedef struct {
+  char *filename;
+  time_t mtime;
+  off_t size;
+  unsigned long lastused;
+  mapObj *map;
+} mapCacheEntryObj;
+
+static mapCacheEntryObj mapCache[MS_MAPCACHE_MAX_ENTRIES];
+static int mapCacheSize = 0;
+static unsigned long mapCacheClock = 0;
+static unsigned long mapCacheHits = 0, mapCacheMisses = 0;
+
+static mapObj *msCloneCachedMap(mapObj *src)
+{
+  mapObj *map;
+
+  map = msNewMapObj();
+  if(!map) return NULL;
+
+  if(msCopyMap(map, src) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+
+  /* config options may have been changed by a previous request */
+  msApplyMapConfigOptions(map);
+
+  return map;
+}
+
+static void msMapCacheDebug(mapObj *map, const char *filename, const char *status)
+{
+  if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING || (map && map->debug >= MS_DEBUGLEVEL_TUNING))
+    msDebug("msLoadMapCached(): %s for %s (hits=%lu, misses=%lu)\n", status, filename, mapCacheHits, mapCacheMisses);
+}
+
+mapObj *msLoadMapCached(char *filename, char *new_mappath)
+{
+  struct stat stat_buf;
+  mapObj *map, *template_map;
+  int i, slot;
+
+  /* an alternate mappath changes how the file is parsed, don't bother caching */
+  if(!filename || new_mappath || stat(filename, &stat_buf) != 0)
+    return msLoadMap(filename, new_mappath);
+
+  msAcquireLock(TLOCK_MAPCACHE);
+  for(i=0; i<mapCacheSize; i++) {
+    if(strcmp(mapCache[i].filename, filename) == 0) break;
+  }
+  if(i < mapCacheSize && mapCache[i].mtime == stat_buf.st_mtime && mapCache[i].size == stat_buf.st_size) {
+    mapCache[i].lastused = ++mapCacheClock;
+    map = msCloneCachedMap(mapCache[i].map);
+    if(map) {
+      mapCacheHits++;
+      msReleaseLock(TLOCK_MAPCACHE);
+      msMapCacheDebug(map, filename, "cache hit");
+      return map;
+    }
+  }
+  mapCacheMisses++;
+  msReleaseLock(TLOCK_MAPCACHE);
+
+  template_map = msLoadMap(filename, NULL);
+  if(!template_map) return NULL;
+
+  map = msCloneCachedMap(template_map);
+  if(!map) /* can't be cached, hand back the freshly parsed map */
+    return template_map;
+
+  msAcquireLock(TLOCK_MAPCACHE);
+  for(slot=0; slot<mapCacheSize; slot++) { /* another thread may have loaded it already */
+    if(strcmp(mapCache[slot].filename, filename) == 0) break;
+  }
+  if(slot == mapCacheSize) {
+    if(mapCacheSize < MS_MAPCACHE_MAX_ENTRIES) {
+      mapCacheSize++;
+    } else { /* evict the least recently used entry */
+      slot = 0;
+      for(i=1; i<mapCacheSize; i++) {
+        if(mapCache[i].lastused < mapCache[slot].lastused) slot = i;
+      }
+      msFree(mapCache[slot].filename);
+      msFreeMap(mapCache[slot].map);
+    }
+    mapCache[slot].filename = msStrdup(filename);
+  } else {
+    msFreeMap(mapCache[slot].map);
+  }
+  mapCache[slot].map = template_map;
+  mapCache[slot].mtime = stat_buf.st_mtime;
+  mapCache[slot].size = stat_buf.st_size;
+  mapCache[slot].lastused = ++mapCacheClock;
+  msReleaseLock(TLOCK_MAPCACHE);
+
+  msMapCacheDebug(map, filename, "cache miss");
+
+  return map;
+}
+
+/*
+** Releases all cached mapfiles, called from msCleanup().
+*/
+void msMapCacheCleanup()
+{
+  int i;
+
+  msAcquireLock(TLOCK_MAPCACHE);
+  if(mapCacheSize > 0)
+    msMapCacheDebug(NULL, "all mapfiles", "releasing cache");
+  for(i=0; i<mapCacheSize; i++) {
+    msFree(mapCache[i].filename);
+    msFreeMap(mapCache[i].map);
+    mapCache[i].filename = NULL;
+    mapCache[i].map = NULL;
+  }
+  mapCacheSize = 0;
+  mapCacheHits = mapCacheMisses = 0;
+  msReleaseLock(TLOCK_MAPCACHE);
+}
+
 /*
 ** Loads mapfile snippets via a URL (only via the CGI so don't worry about thread locks)
 */
@@ -718,6 +718,11 @@ void msGEOSFreeGeometry(shapeObj *shape)
   if(!shape || !shape->geometry)
     return;
 
+  if(shape->prepared_geometry) {
+    GEOSPreparedGeom_destroy_r(handle, (const GEOSPreparedGeometry *) shape->prepared_geometry);
+    shape->prepared_geometry = NULL;
+  }
+
   g = (GEOSGeom) shape->geometry;
   GEOSGeom_destroy_r(handle,g);
   shape->geometry = NULL;
@@ -1072,31 +1077,90 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
 ** Binary predicates exposed to MapServer/MapScript
 */
 
+#ifdef USE_GEOS
 /*
-** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+** A shape that already has a GEOS geometry when a predicate is evaluated is
+** being compared over and over (the literal of a filter expression or a
+** selection shape), so it gets prepared: GEOS then indexes it once instead
+** of walking all of its edges for every comparison. The prepared geometry
+** is freed along with the geometry by msGEOSFreeGeometry().
 */
-int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+static const GEOSPreparedGeometry *msGEOSGetPreparedGeometry(GEOSContextHandle_t handle, shapeObj *shape)
+{
+  if(!shape->prepared_geometry)
+    shape->prepared_geometry = (void *) GEOSPrepare_r(handle, (GEOSGeom) shape->geometry);
+  return (const GEOSPreparedGeometry *) shape->prepared_geometry;
+}
+
+/*
+** Evaluates an intersects, disjoint, contains or within MS_GEOS_OPERATOR
+** through a prepared geometry when one of the shapes is reused, preferring
+** shape2 since filters put the literal last. Returns MS_TRUE/MS_FALSE or -1
+** for an error.
+*/
+static int msGEOSPredicate(int predicate, shapeObj *shape1, shapeObj *shape2)
 {
-#ifdef USE_GEOS
   GEOSGeom g1, g2;
-  int result;
+  const GEOSPreparedGeometry *prepared = NULL;
+  int reused1, reused2, result;
   GEOSContextHandle_t handle = msGetGeosContextHandle();
 
   if(!shape1 || !shape2)
     return -1;
 
+  reused1 = (shape1->geometry != NULL);
+  reused2 = (shape2->geometry != NULL);
+
   if(!shape1->geometry) /* if no geometry for shape1 then build one */
     shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
+  g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return -1;
 
   if(!shape2->geometry) /* if no geometry for shape2 then build one */
     shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
+  g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
-  result = GEOSContains_r(handle,g1, g2);
+  switch(predicate) {
+    case MS_GEOS_INTERSECTS:
+    case MS_GEOS_DISJOINT:
+      if(reused2 && (prepared = msGEOSGetPreparedGeometry(handle, shape2)) != NULL)
+        result = GEOSPreparedIntersects_r(handle, prepared, g1);
+      else if(reused1 && (prepared = msGEOSGetPreparedGeometry(handle, shape1)) != NULL)
+        result = GEOSPreparedIntersects_r(handle, prepared, g2);
+      else
+        result = GEOSIntersects_r(handle, g1, g2);
+      if(predicate == MS_GEOS_DISJOINT && result != 2)
+        result = !result;
+      break;
+    case MS_GEOS_CONTAINS: /* only shape1 can be prepared */
+      if(reused1 && (prepared = msGEOSGetPreparedGeometry(handle, shape1)) != NULL)
+        result = GEOSPreparedContains_r(handle, prepared, g2);
+      else
+        result = GEOSContains_r(handle, g1, g2);
+      break;
+    case MS_GEOS_WITHIN: /* shape1 is within shape2 if shape2 contains it */
+      if(reused2 && (prepared = msGEOSGetPreparedGeometry(handle, shape2)) != NULL)
+        result = GEOSPreparedContains_r(handle, prepared, g1);
+      else
+        result = GEOSWithin_r(handle, g1, g2);
+      break;
+    default:
+      result = 2;
+      break;
+  }
+
   return ((result==2) ? -1 : result);
+}
+#endif
+
+/*
+** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+*/
+int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+{
+#ifdef USE_GEOS
+  return msGEOSPredicate(MS_GEOS_CONTAINS, shape1, shape2);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSContains()");
   return -1;
@@ -1140,25 +1204,7 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSWithin_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(MS_GEOS_WITHIN, shape1, shape2);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSWithin()");
   return -1;
@@ -1202,25 +1248,7 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSIntersects_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(MS_GEOS_INTERSECTS, shape1, shape2);
 #else
   if(!shape1 || !shape2)
     return -1;
@@ -1316,25 +1344,7 @@ int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSDisjoint_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(MS_GEOS_DISJOINT, shape1, shape2);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSDisjoint()");
   return -1;
@@ -0,0 +1,455 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Packed Hilbert R-tree (.hix) shapefile spatial index.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The .hix file is a static R-tree packed bottom-up from the shape bounds
+** sorted along a Hilbert curve. All values are stored LSB first.
+**
+**   header (128 bytes):
+**     char     signature[4]      "SHRT"
+**     int32    version           MS_HRTREE_VERSION
+**     int32    nodesize          MS_HRTREE_NODE_SIZE
+**     int32    numshapes         number of records in the shapefile
+**     int32    numentries        number of indexed (non null) shapes
+**     int32    numlevels         number of tree levels, 0 for an empty tree
+**     int32    numpages          total number of node pages
+**     int32    reserved
+**     double   bounds[4]         minx, miny, maxx, maxy of all entries
+**     int32    levelstart[16]    first page of each level, leaves first,
+**                                levelstart[numlevels] == numpages
+**
+**   numpages node pages (hrtreePageObj, 576 bytes), the root page last.
+**
+** Every page holds up to MS_HRTREE_NODE_SIZE entries stored as separate
+** coordinate arrays so the overlap test of a page walks contiguous memory.
+** Unused entries have an id of -1 and only appear at the end of a page. On
+** leaf pages the ids are shape ids, otherwise they are child page numbers.
+*/
+
+#include "mapserver.h"
+#include "maptree.h"
+
+#include <float.h>
+
+#define MS_HRTREE_SIGNATURE "SHRT"
+#define MS_HRTREE_VERSION 1
+#define MS_HRTREE_HEADER_SIZE 128
+#define MS_HRTREE_MAX_LEVELS 15
+
+#define MS_HRTREE_HILBERT_ORDER 65536
+
+typedef struct {
+  double minx[MS_HRTREE_NODE_SIZE];
+  double miny[MS_HRTREE_NODE_SIZE];
+  double maxx[MS_HRTREE_NODE_SIZE];
+  double maxy[MS_HRTREE_NODE_SIZE];
+  ms_int32 ids[MS_HRTREE_NODE_SIZE];
+} hrtreePageObj;
+
+typedef struct {
+  ms_uint32 hilbert;
+  int id;
+  rectObj rect;
+} hrtreeEntryObj;
+
+static int hrtreeIsBigEndian()
+{
+  int i = 1;
+  return *((uchar *) &i) != 1;
+}
+
+static void hrtreeSwapWord(int length, void *wordP)
+{
+  int i;
+  uchar temp;
+
+  for(i=0; i < length/2; i++) {
+    temp = ((uchar *) wordP)[i];
+    ((uchar *)wordP)[i] = ((uchar *) wordP)[length-i-1];
+    ((uchar *) wordP)[length-i-1] = temp;
+  }
+}
+
+/*
+** Swaps a header or a run of pages between file (LSB) and host order.
+*/
+static void hrtreeSwapHeader(uchar *header)
+{
+  int i;
+
+  for(i=4; i<32; i+=4) hrtreeSwapWord(4, header+i);
+  for(i=32; i<64; i+=8) hrtreeSwapWord(8, header+i);
+  for(i=64; i<MS_HRTREE_HEADER_SIZE; i+=4) hrtreeSwapWord(4, header+i);
+}
+
+static void hrtreeSwapPages(hrtreePageObj *pages, int numpages)
+{
+  int i, j;
+
+  for(i=0; i<numpages; i++) {
+    for(j=0; j<MS_HRTREE_NODE_SIZE; j++) {
+      hrtreeSwapWord(8, &(pages[i].minx[j]));
+      hrtreeSwapWord(8, &(pages[i].miny[j]));
+      hrtreeSwapWord(8, &(pages[i].maxx[j]));
+      hrtreeSwapWord(8, &(pages[i].maxy[j]));
+      hrtreeSwapWord(4, &(pages[i].ids[j]));
+    }
+  }
+}
+
+/*
+** Position of (x,y) along a Hilbert curve filling a n by n grid, n being a
+** power of two.
+*/
+ms_uint32 msHilbertIndex(ms_uint32 n, ms_uint32 x, ms_uint32 y)
+{
+  ms_uint32 rx, ry, s, t, d = 0;
+
+  for(s=n/2; s>0; s/=2) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if(ry == 0) {
+      if(rx == 1) {
+        x = n-1 - x;
+        y = n-1 - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+
+  return d;
+}
+
+/*
+** Scales a coordinate into the [0,n-1] grid spanning [min,max].
+*/
+static ms_uint32 hrtreeScale(double v, double min, double max, ms_uint32 n)
+{
+  double f;
+
+  if(max <= min) return 0;
+  f = (v - min) / (max - min) * (n - 1);
+  if(f <= 0) return 0;
+  if(f >= n - 1) return n - 1;
+  return (ms_uint32) f;
+}
+
+static int hrtreeCompareEntries(const void *a, const void *b)
+{
+  const hrtreeEntryObj *ea = (const hrtreeEntryObj *) a;
+  const hrtreeEntryObj *eb = (const hrtreeEntryObj *) b;
+
+  if(ea->hilbert < eb->hilbert) return -1;
+  if(ea->hilbert > eb->hilbert) return 1;
+  return ea->id - eb->id;
+}
+
+static void hrtreeInitPage(hrtreePageObj *page)
+{
+  int i;
+
+  for(i=0; i<MS_HRTREE_NODE_SIZE; i++) {
+    page->minx[i] = page->miny[i] = DBL_MAX;
+    page->maxx[i] = page->maxy[i] = -DBL_MAX;
+    page->ids[i] = -1;
+  }
+}
+
+/*
+** Builds a packed Hilbert R-tree over the shapes of an open shapefile and
+** writes it to filename. Null shapes (no bounds) are left out of the index.
+*/
+int msWriteHilbertTree(shapefileObj *shapefile, const char *filename)
+{
+  hrtreeEntryObj *entries;
+  hrtreePageObj *pages = NULL;
+  uchar header[MS_HRTREE_HEADER_SIZE];
+  ms_int32 levelstart[MS_HRTREE_MAX_LEVELS+1];
+  ms_int32 value;
+  int i, j, numentries = 0, numlevels = 0, numpages = 0, count, page;
+  rectObj bounds;
+  FILE *fp;
+
+  if(!shapefile || shapefile->numshapes < 0) {
+    msSetError(MS_SHPERR, "Invalid shapefile.", "msWriteHilbertTree()");
+    return MS_FAILURE;
+  }
+
+  entries = (hrtreeEntryObj *) msSmallMalloc(sizeof(hrtreeEntryObj) * (shapefile->numshapes > 0 ? shapefile->numshapes : 1));
+
+  /* collect the bounds of the non null shapes */
+  bounds.minx = bounds.miny = DBL_MAX;
+  bounds.maxx = bounds.maxy = -DBL_MAX;
+  for(i=0; i<shapefile->numshapes; i++) {
+    if(msSHPReadBounds(shapefile->hSHP, i, &(entries[numentries].rect)) != MS_SUCCESS)
+      continue;
+    entries[numentries].id = i;
+    if(entries[numentries].rect.minx < bounds.minx) bounds.minx = entries[numentries].rect.minx;
+    if(entries[numentries].rect.miny < bounds.miny) bounds.miny = entries[numentries].rect.miny;
+    if(entries[numentries].rect.maxx > bounds.maxx) bounds.maxx = entries[numentries].rect.maxx;
+    if(entries[numentries].rect.maxy > bounds.maxy) bounds.maxy = entries[numentries].rect.maxy;
+    numentries++;
+  }
+
+  /* sort them along the Hilbert curve of their centers */
+  for(i=0; i<numentries; i++) {
+    entries[i].hilbert = msHilbertIndex(MS_HRTREE_HILBERT_ORDER,
+                                        hrtreeScale((entries[i].rect.minx + entries[i].rect.maxx) / 2, bounds.minx, bounds.maxx, MS_HRTREE_HILBERT_ORDER),
+                                        hrtreeScale((entries[i].rect.miny + entries[i].rect.maxy) / 2, bounds.miny, bounds.maxy, MS_HRTREE_HILBERT_ORDER));
+  }
+  qsort(entries, numentries, sizeof(hrtreeEntryObj), hrtreeCompareEntries);
+
+  /* compute the level layout, each level packs the one below it */
+  levelstart[0] = 0;
+  count = numentries;
+  while(count > 0) {
+    if(numlevels == MS_HRTREE_MAX_LEVELS) {
+      msSetError(MS_SHPERR, "Too many shapes to index.", "msWriteHilbertTree()");
+      free(entries);
+      return MS_FAILURE;
+    }
+    count = (count + MS_HRTREE_NODE_SIZE - 1) / MS_HRTREE_NODE_SIZE;
+    numpages += count;
+    levelstart[++numlevels] = numpages;
+    if(count == 1) break;
+  }
+
+  if(numpages > 0) {
+    pages = (hrtreePageObj *) malloc(sizeof(hrtreePageObj) * numpages);
+    if(!pages) {
+      msSetError(MS_MEMERR, "Failed to allocate %d index pages.", "msWriteHilbertTree()", numpages);
+      free(entries);
+      return MS_FAILURE;
+    }
+    for(i=0; i<numpages; i++)
+      hrtreeInitPage(&(pages[i]));
+
+    /* leaves */
+    for(i=0; i<numentries; i++) {
+      page = i / MS_HRTREE_NODE_SIZE;
+      j = i % MS_HRTREE_NODE_SIZE;
+      pages[page].minx[j] = entries[i].rect.minx;
+      pages[page].miny[j] = entries[i].rect.miny;
+      pages[page].maxx[j] = entries[i].rect.maxx;
+      pages[page].maxy[j] = entries[i].rect.maxy;
+      pages[page].ids[j] = entries[i].id;
+    }
+
+    /* upper levels, one entry per page of the level below */
+    for(i=1; i<numlevels; i++) {
+      int child;
+      for(child=levelstart[i-1]; child<levelstart[i]; child++) {
+        hrtreePageObj *cp = &(pages[child]);
+        int entry = child - levelstart[i-1];
+        hrtreePageObj *pp = &(pages[levelstart[i] + entry / MS_HRTREE_NODE_SIZE]);
+        j = entry % MS_HRTREE_NODE_SIZE;
+        for(page=0; page<MS_HRTREE_NODE_SIZE && cp->ids[page] >= 0; page++) {
+          if(cp->minx[page] < pp->minx[j]) pp->minx[j] = cp->minx[page];
+          if(cp->miny[page] < pp->miny[j]) pp->miny[j] = cp->miny[page];
+          if(cp->maxx[page] > pp->maxx[j]) pp->maxx[j] = cp->maxx[page];
+          if(cp->maxy[page] > pp->maxy[j]) pp->maxy[j] = cp->maxy[page];
+        }
+        pp->ids[j] = child;
+      }
+    }
+  }
+  free(entries);
+
+  /* header */
+  memset(header, 0, sizeof(header));
+  memcpy(header, MS_HRTREE_SIGNATURE, 4);
+  value = MS_HRTREE_VERSION;
+  memcpy(header+4, &value, 4);
+  value = MS_HRTREE_NODE_SIZE;
+  memcpy(header+8, &value, 4);
+  memcpy(header+12, &(shapefile->numshapes), 4);
+  memcpy(header+16, &numentries, 4);
+  memcpy(header+20, &numlevels, 4);
+  memcpy(header+24, &numpages, 4);
+  if(numentries > 0) {
+    memcpy(header+32, &(bounds.minx), 8);
+    memcpy(header+40, &(bounds.miny), 8);
+    memcpy(header+48, &(bounds.maxx), 8);
+    memcpy(header+56, &(bounds.maxy), 8);
+  }
+  memcpy(header+64, levelstart, sizeof(ms_int32) * (numlevels+1));
+
+  if(hrtreeIsBigEndian()) {
+    hrtreeSwapHeader(header);
+    hrtreeSwapPages(pages, numpages);
+  }
+
+  fp = fopen(filename, "wb");
+  if(!fp) {
+    msSetError(MS_IOERR, "Unable to open %s for writing.", "msWriteHilbertTree()", filename);
+    free(pages);
+    return MS_FAILURE;
+  }
+
+  if(fwrite(header, MS_HRTREE_HEADER_SIZE, 1, fp) != 1 ||
+      (numpages > 0 && fwrite(pages, sizeof(hrtreePageObj), numpages, fp) != (size_t) numpages)) {
+    msSetError(MS_IOERR, "Error writing %s.", "msWriteHilbertTree()", filename);
+    fclose(fp);
+    free(pages);
+    return MS_FAILURE;
+  }
+
+  fclose(fp);
+  free(pages);
+
+  return MS_SUCCESS;
+}
+
+/*
+** Reads the whole index into memory, used when the file can't be mapped or
+** needs swapping.
+*/
+static uchar *hrtreeReadFile(FILE *fp, size_t *size)
+{
+  uchar *data;
+  long length;
+
+  if(fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) != 0)
+    return NULL;
+
+  data = (uchar *) malloc(length);
+  if(!data) return NULL;
+
+  if(fread(data, length, 1, fp) != 1) {
+    free(data);
+    return NULL;
+  }
+
+  *size = length;
+  return data;
+}
+
+/*
+** Returns the shapes whose bounds overlap aoi, or NULL if filename doesn't
+** exist or isn't a usable index for a shapefile of numshapes records. Unlike
+** msSearchDiskTree() the result is exact and needs no msFilterTreeSearch().
+*/
+ms_bitarray msSearchHilbertTree(const char *filename, rectObj aoi, int debug, int numshapes)
+{
+  FILE *fp;
+  const uchar *data;
+  uchar *copy = NULL;
+  size_t size = 0;
+  ms_int32 header[MS_HRTREE_HEADER_SIZE/4];
+  int numlevels, numpages, leafpages, sp = 0, i;
+  int stack[MS_HRTREE_MAX_LEVELS * MS_HRTREE_NODE_SIZE];
+  const hrtreePageObj *pages;
+  ms_bitarray status;
+
+  fp = fopen(filename, "rb");
+  if(!fp) return NULL;
+
+  if(!hrtreeIsBigEndian())
+    data = msSHPMapFile(fp, &size);
+  else
+    data = NULL;
+
+  if(!data) {
+    data = copy = hrtreeReadFile(fp, &size);
+    if(copy && hrtreeIsBigEndian() && size >= MS_HRTREE_HEADER_SIZE)
+      hrtreeSwapHeader(copy);
+  }
+  fclose(fp);
+
+  memset(header, 0, sizeof(header));
+  if(!data) {
+    if(debug) msDebug("msSearchHilbertTree(): unable to read %s.\n", filename);
+    return NULL;
+  }
+
+  if(size >= MS_HRTREE_HEADER_SIZE)
+    memcpy(header, data, MS_HRTREE_HEADER_SIZE);
+
+  numlevels = header[5];
+  numpages = header[6];
+  if(size < MS_HRTREE_HEADER_SIZE || memcmp(data, MS_HRTREE_SIGNATURE, 4) != 0 ||
+      header[1] != MS_HRTREE_VERSION || header[2] != MS_HRTREE_NODE_SIZE ||
+      numlevels < 0 || numlevels > MS_HRTREE_MAX_LEVELS || numpages < 0 ||
+      size != MS_HRTREE_HEADER_SIZE + sizeof(hrtreePageObj) * (size_t) numpages ||
+      header[16 + numlevels] != numpages) {
+    if(debug) msDebug("msSearchHilbertTree(): %s is not a valid index, ignoring it.\n", filename);
+    if(copy) free(copy);
+    else msSHPUnmapFile(data);
+    return NULL;
+  }
+
+  if(header[3] != numshapes) {
+    if(debug) msDebug("msSearchHilbertTree(): %s was built for %d shapes but the shapefile has %d, ignoring it.\n", filename, header[3], numshapes);
+    if(copy) free(copy);
+    else msSHPUnmapFile(data);
+    return NULL;
+  }
+
+  pages = (const hrtreePageObj *) (data + MS_HRTREE_HEADER_SIZE);
+  if(copy && hrtreeIsBigEndian())
+    hrtreeSwapPages((hrtreePageObj *) pages, numpages);
+
+  status = msAllocBitArray(numshapes);
+  if(!status) {
+    msSetError(MS_MEMERR, NULL, "msSearchHilbertTree()");
+    if(copy) free(copy);
+    else msSHPUnmapFile(data);
+    return NULL;
+  }
+
+  leafpages = numlevels > 0 ? header[17] : 0;
+  if(numpages > 0)
+    stack[sp++] = numpages - 1;
+
+  while(sp > 0) {
+    const hrtreePageObj *page = &(pages[stack[--sp]]);
+    int leaf = (page - pages) < leafpages;
+
+    for(i=0; i<MS_HRTREE_NODE_SIZE && page->ids[i] >= 0; i++) {
+      if(page->minx[i] > aoi.maxx || page->maxx[i] < aoi.minx ||
+          page->miny[i] > aoi.maxy || page->maxy[i] < aoi.miny)
+        continue;
+
+      if(leaf) {
+        if(page->ids[i] < numshapes)
+          msSetBit(status, page->ids[i], 1);
+      } else if(page->ids[i] < (page - pages) && sp < (int) (sizeof(stack)/sizeof(int))) {
+        stack[sp++] = page->ids[i];
+      }
+    }
+  }
+
+  if(copy) free(copy);
+  else msSHPUnmapFile(data);
+
+  return status;
+}
@@ -28,7 +28,9 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
 #include <png.h>
+#include <zlib.h>
 #include <setjmp.h>
 #include <assert.h>
 #include <jpeglib.h>
@@ -38,6 +40,14 @@
 #include <gif_lib.h>
 #endif
 
+#ifdef USE_WEBP
+#include <webp/encode.h>
+#endif
+
+#ifdef USE_AVIF
+#include <avif/avif.h>
+#endif
+
 
 
 typedef struct _streamInfo {
@@ -62,69 +72,293 @@ void png_flush_data(png_structp png_ptr)
   /* do nothing */
 }
 
-typedef struct {
-  struct jpeg_destination_mgr pub;
-  unsigned char *data;
-} ms_destination_mgr;
+/*
+** Formats one row of rb the way it is stored in a PNG file: palette indexes
+** packed to depth bits, or un-premultiplied RGB(A) samples.
+*/
+static void formatPNGRow(rasterBufferObj *rb, int row, int depth, unsigned char *out)
+{
+  int col;
+  if(rb->type == MS_BUFFER_BYTE_PALETTE) {
+    unsigned char *in = &(rb->data.palette.pixels[row*rb->width]);
+    if(depth == 8) {
+      memcpy(out, in, rb->width);
+    } else {
+      int perbyte = 8 / depth;
+      memset(out, 0, (rb->width * depth + 7) / 8);
+      for(col=0; col<rb->width; col++)
+        out[col/perbyte] |= in[col] << (8 - depth - (col%perbyte)*depth);
+    }
+  } else {
+    unsigned char *a,*r,*g,*b;
+    r=rb->data.rgba.r+row*rb->data.rgba.row_step;
+    g=rb->data.rgba.g+row*rb->data.rgba.row_step;
+    b=rb->data.rgba.b+row*rb->data.rgba.row_step;
+    if(rb->data.rgba.a) {
+      a=rb->data.rgba.a+row*rb->data.rgba.row_step;
+      for(col=0; col<rb->width; col++) {
+        if(*a) {
+          double da = *a/255.0;
+          out[0] = *r/da;
+          out[1] = *g/da;
+          out[2] = *b/da;
+          out[3] = *a;
+        } else {
+          out[0]=out[1]=out[2]=out[3]=0;
+        }
+        out+=4;
+        a+=rb->data.rgba.pixel_step;
+        r+=rb->data.rgba.pixel_step;
+        g+=rb->data.rgba.pixel_step;
+        b+=rb->data.rgba.pixel_step;
+      }
+    } else {
+      for(col=0; col<rb->width; col++) {
+        out[0] = *r;
+        out[1] = *g;
+        out[2] = *b;
+        out+=3;
+        r+=rb->data.rgba.pixel_step;
+        g+=rb->data.rgba.pixel_step;
+        b+=rb->data.rgba.pixel_step;
+      }
+    }
+  }
+}
 
-typedef struct {
-  ms_destination_mgr mgr;
-  FILE *stream;
-} ms_stream_destination_mgr;
+static size_t getPNGRowBytes(rasterBufferObj *rb, int depth)
+{
+  if(rb->type == MS_BUFFER_BYTE_PALETTE)
+    return (rb->width * depth + 7) / 8;
+  return rb->width * (rb->data.rgba.a ? 4 : 3);
+}
+
+#ifdef USE_THREAD
+/*
+** Multithreaded PNG encoding, enabled with FORMATOPTION
+** "COMPRESSION_THREADS=n": the image is cut in bands of rows, each band is
+** deflated by its own thread into a raw deflate stream ending on a byte
+** boundary, and the streams are concatenated into the single zlib stream
+** of the IDAT chunk. Every band is primed with the 32K of image data
+** preceding it, so the compression ratio stays close to a single stream.
+*/
+#define PNG_BAND_MIN_ROWS 32
 
 typedef struct {
-  ms_destination_mgr mgr;
-  bufferObj *buffer;
-} ms_buffer_destination_mgr;
+  rasterBufferObj *rb;
+  int depth;
+  int startrow, endrow;
+  int level, last;
+  unsigned char *data;
+  size_t size;
+  uLong adler, rawsize;
+  int status;
+  void *thread;
+} pngBandObj;
 
-#define OUTPUT_BUF_SIZE 4096
+static void deflatePNGBand(void *arg)
+{
+  pngBandObj *band = (pngBandObj*)arg;
+  size_t rowbytes = getPNGRowBytes(band->rb, band->depth) + 1; /* with the filter type byte */
+  int dictrows = MS_MIN(band->startrow, (int)((32768 + rowbytes - 1) / rowbytes));
+  unsigned char *raw, *p;
+  uLong bound;
+  z_stream zs;
+  int row, ret;
+
+  raw = (unsigned char*)msSmallMalloc((band->endrow - band->startrow + dictrows) * rowbytes);
+  for(row = band->startrow - dictrows, p = raw; row < band->endrow; row++, p += rowbytes) {
+    p[0] = 0; /* PNG_FILTER_NONE, as set up for libpng */
+    formatPNGRow(band->rb, row, band->depth, p + 1);
+  }
+  p = raw + dictrows * rowbytes;
+  band->rawsize = (band->endrow - band->startrow) * rowbytes;
+  band->adler = adler32(adler32(0L, Z_NULL, 0), p, band->rawsize);
+
+  band->status = MS_FAILURE;
+  memset(&zs, 0, sizeof(zs));
+  if(deflateInit2(&zs, band->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(raw);
+    return;
+  }
+  if(dictrows > 0) {
+    uInt dictsize = MS_MIN(32768, dictrows * rowbytes);
+    deflateSetDictionary(&zs, p - dictsize, dictsize);
+  }
+  bound = deflateBound(&zs, band->rawsize) + 16; /* room for the sync flush marker */
+  band->data = (unsigned char*)msSmallMalloc(bound);
+  zs.next_in = p;
+  zs.avail_in = band->rawsize;
+  zs.next_out = band->data;
+  zs.avail_out = bound;
+  ret = deflate(&zs, band->last ? Z_FINISH : Z_SYNC_FLUSH);
+  if(band->last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0 && zs.avail_out > 0))
+    band->status = MS_SUCCESS;
+  band->size = zs.total_out;
+  deflateEnd(&zs);
+  free(raw);
+}
 
-void
-jpeg_init_destination (j_compress_ptr cinfo)
+static void writePNGBytes(streamInfo *info, const unsigned char *data, size_t length)
 {
-  ms_destination_mgr *dest = (ms_destination_mgr*) cinfo->dest;
+  if(info->fp)
+    msIO_fwrite(data,length,1,info->fp);
+  else
+    msBufferAppend(info->buffer,(void*)data,length);
+}
 
-  /* Allocate the output buffer --- it will be released when done with image */
-  dest->data = (unsigned char *)
-               (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
-                   OUTPUT_BUF_SIZE * sizeof (unsigned char));
+static void putPNGUInt32(unsigned char *buf, uLong value)
+{
+  buf[0] = (value >> 24) & 0xff;
+  buf[1] = (value >> 16) & 0xff;
+  buf[2] = (value >> 8) & 0xff;
+  buf[3] = value & 0xff;
+}
 
-  dest->pub.next_output_byte = dest->data;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+static void writePNGChunk(streamInfo *info, const char *type, const unsigned char *data, size_t length)
+{
+  unsigned char buf[4];
+  uLong crc = crc32(0L, (const Bytef*)type, 4);
+  putPNGUInt32(buf, length);
+  writePNGBytes(info, buf, 4);
+  writePNGBytes(info, (const unsigned char*)type, 4);
+  if(length) {
+    writePNGBytes(info, data, length);
+    crc = crc32(crc, data, length);
+  }
+  putPNGUInt32(buf, crc);
+  writePNGBytes(info, buf, 4);
 }
 
-void jpeg_stream_term_destination (j_compress_ptr cinfo)
+/*
+** Height of the bands rb is deflated in with the given number of threads,
+** the image is written in a single stream if it is not less than its height.
+*/
+static int getPNGBandRows(rasterBufferObj *rb, int threads)
+{
+  if(threads < 2)
+    return rb->height;
+  return MS_MAX(PNG_BAND_MIN_ROWS, (rb->height + threads - 1) / threads);
+}
+
+/*
+** Writes rb as a PNG with its image data deflated in parallel bands of rows.
+*/
+static int savePNGBands(rasterBufferObj *rb, streamInfo *info, int compression, int threads,
+                        int depth, int color_type, rgbPixel *rgb, int num_rgb, unsigned char *a, int num_a)
 {
-  ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer, 1, dest->stream);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  unsigned char ihdr[13], *idat, *p;
+  pngBandObj *bands;
+  int i, nbands, bandrows, level, status = MS_SUCCESS;
+  size_t idatsize;
+  uLong adler;
+
+  bandrows = getPNGBandRows(rb, threads);
+  nbands = (rb->height + bandrows - 1) / bandrows;
+
+  level = (compression == -1) ? Z_DEFAULT_COMPRESSION : compression;
+  bands = (pngBandObj*)msSmallCalloc(nbands, sizeof(pngBandObj));
+  for(i=0; i<nbands; i++) {
+    bands[i].rb = rb;
+    bands[i].depth = depth;
+    bands[i].startrow = i * bandrows;
+    bands[i].endrow = MS_MIN(rb->height, (i+1) * bandrows);
+    bands[i].level = level;
+    bands[i].last = (i == nbands - 1);
+    if(i > 0)
+      bands[i].thread = msThreadCreate(deflatePNGBand, bands + i);
+  }
+  /* the calling thread deflates the first band, and the bands no thread could be started for */
+  for(i=0; i<nbands; i++) {
+    if(i == 0 || bands[i].thread == NULL)
+      deflatePNGBand(bands + i);
+  }
+
+  idatsize = 2 + 4; /* zlib header and adler32 trailer */
+  for(i=0; i<nbands; i++) {
+    if(bands[i].thread)
+      msThreadJoin(bands[i].thread);
+    if(bands[i].status != MS_SUCCESS)
+      status = MS_FAILURE;
+    idatsize += bands[i].size;
+  }
+
+  if(status == MS_SUCCESS) {
+    /* zlib header: 32K window, deflate, FLEVEL hint matching the compression level */
+    idat = p = (unsigned char*)msSmallMalloc(idatsize);
+    *p++ = 0x78;
+    *p++ = (level == 0 || level == 1) ? 0x01 : (level >= 2 && level <= 5) ? 0x5e : (level >= 7) ? 0xda : 0x9c;
+    adler = bands[0].adler;
+    for(i=0; i<nbands; i++) {
+      memcpy(p, bands[i].data, bands[i].size);
+      p += bands[i].size;
+      if(i > 0)
+        adler = adler32_combine(adler, bands[i].adler, bands[i].rawsize);
+    }
+    putPNGUInt32(p, adler);
+
+    putPNGUInt32(ihdr, rb->width);
+    putPNGUInt32(ihdr + 4, rb->height);
+    ihdr[8] = depth;
+    ihdr[9] = color_type;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0; /* deflate, adaptive filtering, no interlacing */
+
+    writePNGBytes(info, signature, 8);
+    writePNGChunk(info, "IHDR", ihdr, 13);
+    if(color_type == PNG_COLOR_TYPE_PALETTE) {
+      writePNGChunk(info, "PLTE", (unsigned char*)rgb, num_rgb * 3);
+      if(num_a)
+        writePNGChunk(info, "tRNS", a, num_a);
+    }
+    writePNGChunk(info, "IDAT", idat, idatsize);
+    writePNGChunk(info, "IEND", NULL, 0);
+    free(idat);
+  } else {
+    msSetError(MS_MISCERR, "Failed to compress PNG image data.", "savePNGBands()");
+  }
+
+  for(i=0; i<nbands; i++)
+    msFree(bands[i].data);
+  free(bands);
+  return status;
 }
+#endif /* USE_THREAD */
+
+/*
+** JPEG destination writing the compressed data straight into a bufferObj,
+** which is grown whenever the compressor runs out of room. Images saved to
+** a stream are compressed to a bufferObj too and written out in one go.
+*/
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  bufferObj *buffer;
+} ms_buffer_destination_mgr;
 
-void jpeg_buffer_term_destination (j_compress_ptr cinfo)
+static void jpeg_buffer_init_destination(j_compress_ptr cinfo)
 {
   ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
-  msBufferAppend(dest->buffer, dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  if(dest->buffer->available <= dest->buffer->size)
+    msBufferResize(dest->buffer, dest->buffer->size);
+  dest->pub.next_output_byte = dest->buffer->data + dest->buffer->size;
+  dest->pub.free_in_buffer = dest->buffer->available - dest->buffer->size;
 }
 
-int jpeg_stream_empty_output_buffer (j_compress_ptr cinfo)
+static boolean jpeg_buffer_empty_output_buffer(j_compress_ptr cinfo)
 {
-  ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE, 1, dest->stream);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
+  /* the whole buffer has been filled, as per the libjpeg contract */
+  dest->buffer->size = dest->buffer->available;
+  msBufferResize(dest->buffer, dest->buffer->size);
+  dest->pub.next_output_byte = dest->buffer->data + dest->buffer->size;
+  dest->pub.free_in_buffer = dest->buffer->available - dest->buffer->size;
   return TRUE;
 }
 
-int jpeg_buffer_empty_output_buffer (j_compress_ptr cinfo)
+static void jpeg_buffer_term_destination(j_compress_ptr cinfo)
 {
   ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
-  msBufferAppend(dest->buffer, dest->mgr.data, OUTPUT_BUF_SIZE);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
-  return TRUE;
+  dest->buffer->size = dest->buffer->available - dest->pub.free_in_buffer;
 }
 
 static void msJPEGErrorExit(j_common_ptr cinfo)
@@ -141,6 +375,41 @@ static void msJPEGErrorExit(j_common_ptr cinfo)
     longjmp(*pJmpBuffer, 1);
 }
 
+#ifdef JCS_EXTENSIONS
+/*
+** libjpeg-turbo reads 3 and 4 byte pixels in any channel order: returns the
+** color space matching the layout of rb, whose rows can then be handed to
+** the compressor as they are, or JCS_UNKNOWN if they have to be copied.
+*/
+static J_COLOR_SPACE getJPEGBufferColorSpace(rasterBufferObj *rb)
+{
+  int r, g, b;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA || !rb->data.rgba.pixels)
+    return JCS_UNKNOWN;
+  r = rb->data.rgba.r - rb->data.rgba.pixels;
+  g = rb->data.rgba.g - rb->data.rgba.pixels;
+  b = rb->data.rgba.b - rb->data.rgba.pixels;
+
+  if(rb->data.rgba.pixel_step == 3) {
+    if(r == 0 && g == 1 && b == 2) return JCS_EXT_RGB;
+    if(b == 0 && g == 1 && r == 2) return JCS_EXT_BGR;
+  } else if(rb->data.rgba.pixel_step == 4) {
+    if(r == 0 && g == 1 && b == 2) return JCS_EXT_RGBX;
+    if(b == 0 && g == 1 && r == 2) return JCS_EXT_BGRX;
+    if(r == 1 && g == 2 && b == 3) return JCS_EXT_XRGB;
+    if(b == 1 && g == 2 && r == 3) return JCS_EXT_XBGR;
+  }
+  return JCS_UNKNOWN;
+}
+#endif
+
+/*
+** JPEG output. Besides QUALITY and OPTIMIZED, FORMATOPTION
+** "CHROMA_SUBSAMPLING" selects 444, 422 or 420 (the default) sampling of
+** the chroma components and "DCT_METHOD" one of the ISLOW (default),
+** IFAST or FLOAT transforms.
+*/
 int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
                outputFormatObj *format)
 {
@@ -148,9 +417,15 @@ int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
   struct jpeg_error_mgr jerr;
   int quality;
   const char* pszOptimized;
+  const char* pszSubsampling;
+  const char* pszDCTMethod;
   int optimized;
   int arithmetic;
-  ms_destination_mgr *dest;
+  int hsamp, vsamp;
+  J_DCT_METHOD dct_method;
+  J_COLOR_SPACE color_space = JCS_UNKNOWN;
+  ms_buffer_destination_mgr *dest;
+  bufferObj streambuffer, *buffer;
   JSAMPLE *rowdata = NULL;
   unsigned int row;
   jmp_buf setjmp_buffer;
@@ -161,10 +436,52 @@ int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
               EQUAL(pszOptimized, "TRUE");
   arithmetic = EQUAL(pszOptimized, "ARITHMETIC");
 
+  pszSubsampling = msGetOutputFormatOption( format, "CHROMA_SUBSAMPLING", "420");
+  if(EQUAL(pszSubsampling, "444")) {
+    hsamp = vsamp = 1;
+  } else if(EQUAL(pszSubsampling, "422")) {
+    hsamp = 2;
+    vsamp = 1;
+  } else if(EQUAL(pszSubsampling, "420")) {
+    hsamp = vsamp = 2;
+  } else {
+    msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"CHROMA_SUBSAMPLING=%s\", expecting 444, 422 or 420.","saveAsJPEG()",pszSubsampling);
+    return MS_FAILURE;
+  }
+
+  pszDCTMethod = msGetOutputFormatOption( format, "DCT_METHOD", "ISLOW");
+  if(EQUAL(pszDCTMethod, "ISLOW"))
+    dct_method = JDCT_ISLOW;
+  else if(EQUAL(pszDCTMethod, "IFAST"))
+    dct_method = JDCT_IFAST;
+  else if(EQUAL(pszDCTMethod, "FLOAT"))
+    dct_method = JDCT_FLOAT;
+  else {
+    msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"DCT_METHOD=%s\", expecting ISLOW, IFAST or FLOAT.","saveAsJPEG()",pszDCTMethod);
+    return MS_FAILURE;
+  }
+
+#ifdef JCS_EXTENSIONS
+  color_space = getJPEGBufferColorSpace(rb);
+#endif
+  if(color_space == JCS_UNKNOWN)
+    rowdata = (JSAMPLE*)msSmallMalloc(rb->width*3*sizeof(JSAMPLE));
+
+  if(info->fp) {
+    msBufferInit(&streambuffer);
+    buffer = &streambuffer;
+  } else {
+    buffer = info->buffer;
+  }
+  /* room for a typical map image at this quality, grown if need be */
+  msBufferResize(buffer, buffer->size + (size_t)rb->width * rb->height * (quality < 90 ? 1 : 2) / 2 + 1024);
+
   if (setjmp(setjmp_buffer)) 
   {
      jpeg_destroy_compress(&cinfo);
      free(rowdata);
+     if(info->fp)
+       msBufferFree(&streambuffer);
      return MS_FAILURE;
   }
 
@@ -173,33 +490,29 @@ int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
   cinfo.client_data = (void *) &(setjmp_buffer);
   jpeg_create_compress(&cinfo);
 
-  if (cinfo.dest == NULL) {
-    if(info->fp) {
-      cinfo.dest = (struct jpeg_destination_mgr *)
-                   (*cinfo.mem->alloc_small) ((j_common_ptr) &cinfo, JPOOL_PERMANENT,
-                                              sizeof (ms_stream_destination_mgr));
-      ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.empty_output_buffer = jpeg_stream_empty_output_buffer;
-      ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.term_destination = jpeg_stream_term_destination;
-      ((ms_stream_destination_mgr*)cinfo.dest)->stream = info->fp;
-    } else {
-
-      cinfo.dest = (struct jpeg_destination_mgr *)
-                   (*cinfo.mem->alloc_small) ((j_common_ptr) &cinfo, JPOOL_PERMANENT,
-                                              sizeof (ms_buffer_destination_mgr));
-      ((ms_buffer_destination_mgr*)cinfo.dest)->mgr.pub.empty_output_buffer = jpeg_buffer_empty_output_buffer;
-      ((ms_buffer_destination_mgr*)cinfo.dest)->mgr.pub.term_destination = jpeg_buffer_term_destination;
-      ((ms_buffer_destination_mgr*)cinfo.dest)->buffer = info->buffer;
-    }
-  }
-  dest = (ms_destination_mgr*) cinfo.dest;
-  dest->pub.init_destination = jpeg_init_destination;
+  cinfo.dest = (struct jpeg_destination_mgr *)
+               (*cinfo.mem->alloc_small) ((j_common_ptr) &cinfo, JPOOL_PERMANENT,
+                                          sizeof (ms_buffer_destination_mgr));
+  dest = (ms_buffer_destination_mgr*) cinfo.dest;
+  dest->pub.init_destination = jpeg_buffer_init_destination;
+  dest->pub.empty_output_buffer = jpeg_buffer_empty_output_buffer;
+  dest->pub.term_destination = jpeg_buffer_term_destination;
+  dest->buffer = buffer;
 
   cinfo.image_width = rb->width;
   cinfo.image_height = rb->height;
-  cinfo.input_components = 3;
-  cinfo.in_color_space = JCS_RGB;
+  if(color_space == JCS_UNKNOWN) {
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+  } else {
+    cinfo.input_components = rb->data.rgba.pixel_step;
+    cinfo.in_color_space = color_space;
+  }
   jpeg_set_defaults(&cinfo);
   jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.comp_info[0].h_samp_factor = hsamp;
+  cinfo.comp_info[0].v_samp_factor = vsamp;
+  cinfo.dct_method = dct_method;
   if( arithmetic )
     cinfo.arith_code = TRUE;
   else if( optimized )
@@ -220,24 +533,30 @@ int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
   }
 
   jpeg_start_compress(&cinfo, TRUE);
-  rowdata = (JSAMPLE*)malloc(rb->width*cinfo.input_components*sizeof(JSAMPLE));
 
   for(row=0; row<rb->height; row++) {
-    JSAMPLE *pixptr = rowdata;
-    int col;
-    unsigned char *r,*g,*b;
-    r=rb->data.rgba.r+row*rb->data.rgba.row_step;
-    g=rb->data.rgba.g+row*rb->data.rgba.row_step;
-    b=rb->data.rgba.b+row*rb->data.rgba.row_step;
-    for(col=0; col<rb->width; col++) {
-      *(pixptr++) = *r;
-      *(pixptr++) = *g;
-      *(pixptr++) = *b;
-      r+=rb->data.rgba.pixel_step;
-      g+=rb->data.rgba.pixel_step;
-      b+=rb->data.rgba.pixel_step;
+    JSAMPROW rowptr;
+    if(!rowdata) {
+      /* the renderer's own pixels, no copy needed */
+      rowptr = rb->data.rgba.pixels + row*rb->data.rgba.row_step;
+    } else {
+      JSAMPLE *pixptr = rowdata;
+      int col;
+      unsigned char *r,*g,*b;
+      r=rb->data.rgba.r+row*rb->data.rgba.row_step;
+      g=rb->data.rgba.g+row*rb->data.rgba.row_step;
+      b=rb->data.rgba.b+row*rb->data.rgba.row_step;
+      for(col=0; col<rb->width; col++) {
+        *(pixptr++) = *r;
+        *(pixptr++) = *g;
+        *(pixptr++) = *b;
+        r+=rb->data.rgba.pixel_step;
+        g+=rb->data.rgba.pixel_step;
+        b+=rb->data.rgba.pixel_step;
+      }
+      rowptr = rowdata;
     }
-    (void) jpeg_write_scanlines(&cinfo, &rowdata, 1);
+    (void) jpeg_write_scanlines(&cinfo, &rowptr, 1);
   }
 
   /* Step 6: Finish compression */
@@ -245,9 +564,184 @@ int saveAsJPEG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
   free(rowdata);
+
+  if(info->fp) {
+    msIO_fwrite(streambuffer.data, streambuffer.size, 1, info->fp);
+    msBufferFree(&streambuffer);
+  }
   return MS_SUCCESS;
 }
 
+#if defined(USE_WEBP) || defined(USE_AVIF)
+/*
+** Copies rb into a contiguous array of un-premultiplied RGB (or RGBA when
+** rb has an alpha channel) samples, the input the WebP and AVIF encoders
+** expect. The row stride is returned in stride.
+*/
+static unsigned char *getUnpremultipliedPixels(rasterBufferObj *rb, int *stride)
+{
+  unsigned char *pixels;
+  int row;
+
+  *stride = (int)getPNGRowBytes(rb, 8);
+  pixels = (unsigned char*)msSmallMalloc((size_t)(*stride) * rb->height);
+  for(row=0; row<rb->height; row++)
+    formatPNGRow(rb, row, 8, pixels + (size_t)row * (*stride));
+  return pixels;
+}
+#endif
+
+#ifdef USE_WEBP
+static int webp_write_data(const uint8_t *data, size_t data_size, const WebPPicture *picture)
+{
+  streamInfo *info = (streamInfo*)picture->custom_ptr;
+  if(data_size == 0)
+    return 1;
+  if(info->fp)
+    return msIO_fwrite(data,data_size,1,info->fp) == 1;
+  msBufferAppend(info->buffer,(void*)data,data_size);
+  return 1;
+}
+
+/*
+** WebP output. FORMATOPTIONs:
+** - QUALITY: 0 to 100 (default 75). For lossless output this is the
+**   compression effort rather than the image quality.
+** - LOSSLESS: ON for lossless compression (default OFF).
+** - SPEED: 0 (slowest, smallest files) to 6 (fastest), default 2.
+** - COMPRESSION_THREADS: use more than one thread when greater than 1.
+*/
+static int saveAsWEBP(mapObj *map, rasterBufferObj *rb, streamInfo *info,
+                      outputFormatObj *format)
+{
+  WebPConfig config;
+  WebPPicture picture;
+  const char *lossless;
+  unsigned char *pixels;
+  int stride, ok;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA) {
+    msSetError(MS_MISCERR,"Unsupported buffer type","saveAsWEBP()");
+    return MS_FAILURE;
+  }
+
+  if(!WebPConfigInit(&config) || !WebPPictureInit(&picture)) {
+    msSetError(MS_MISCERR,"libwebp version mismatch","saveAsWEBP()");
+    return MS_FAILURE;
+  }
+
+  config.quality = atof(msGetOutputFormatOption( format, "QUALITY", "75"));
+  config.quality = MS_MAX(0, MS_MIN(100, config.quality));
+  config.method = 6 - atoi(msGetOutputFormatOption( format, "SPEED", "2"));
+  config.method = MS_MAX(0, MS_MIN(6, config.method));
+  lossless = msGetOutputFormatOption( format, "LOSSLESS", "OFF");
+  config.lossless = EQUAL(lossless, "YES") || EQUAL(lossless, "ON") ||
+                    EQUAL(lossless, "TRUE");
+  config.thread_level = atoi(msGetOutputFormatOption( format, "COMPRESSION_THREADS", "1")) > 1;
+
+  picture.use_argb = config.lossless;
+  picture.width = rb->width;
+  picture.height = rb->height;
+  picture.writer = webp_write_data;
+  picture.custom_ptr = info;
+
+  pixels = getUnpremultipliedPixels(rb, &stride);
+  if(rb->data.rgba.a)
+    ok = WebPPictureImportRGBA(&picture, pixels, stride);
+  else
+    ok = WebPPictureImportRGB(&picture, pixels, stride);
+  free(pixels);
+
+  if(ok)
+    ok = WebPEncode(&config, &picture);
+  if(!ok)
+    msSetError(MS_MISCERR,"libwebp encoding error %d","saveAsWEBP()",(int)picture.error_code);
+
+  WebPPictureFree(&picture);
+  return ok ? MS_SUCCESS : MS_FAILURE;
+}
+#endif /* USE_WEBP */
+
+#ifdef USE_AVIF
+/*
+** AVIF output. FORMATOPTIONs:
+** - QUALITY: 0 to 100 (default 60), 100 being lossless.
+** - SPEED: 0 (slowest, smallest files) to 10 (fastest), default 6.
+** - COMPRESSION_THREADS: number of encoder threads (default 1).
+*/
+static int saveAsAVIF(mapObj *map, rasterBufferObj *rb, streamInfo *info,
+                      outputFormatObj *format)
+{
+  avifImage *image;
+  avifEncoder *encoder = NULL;
+  avifRGBImage rgb;
+  avifRWData output = AVIF_DATA_EMPTY;
+  avifResult result;
+  unsigned char *pixels;
+  int quality, stride;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA) {
+    msSetError(MS_MISCERR,"Unsupported buffer type","saveAsAVIF()");
+    return MS_FAILURE;
+  }
+
+  quality = atoi(msGetOutputFormatOption( format, "QUALITY", "60"));
+  quality = MS_MAX(0, MS_MIN(100, quality));
+
+  image = avifImageCreate(rb->width, rb->height, 8,
+                          quality == 100 ? AVIF_PIXEL_FORMAT_YUV444 : AVIF_PIXEL_FORMAT_YUV420);
+  if(!image) {
+    msSetError(MS_MEMERR,"failed to create the AVIF image","saveAsAVIF()");
+    return MS_FAILURE;
+  }
+  if(quality == 100)
+    image->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_IDENTITY;
+  avifRGBImageSetDefaults(&rgb, image);
+  rgb.format = rb->data.rgba.a ? AVIF_RGB_FORMAT_RGBA : AVIF_RGB_FORMAT_RGB;
+  pixels = getUnpremultipliedPixels(rb, &stride);
+  rgb.pixels = pixels;
+  rgb.rowBytes = stride;
+  result = avifImageRGBToYUV(image, &rgb);
+  free(pixels);
+
+  if(result == AVIF_RESULT_OK) {
+    encoder = avifEncoderCreate();
+    if(!encoder) {
+      msSetError(MS_MEMERR,"failed to create the AVIF encoder","saveAsAVIF()");
+      avifImageDestroy(image);
+      return MS_FAILURE;
+    }
+    encoder->speed = atoi(msGetOutputFormatOption( format, "SPEED", "6"));
+    encoder->speed = MS_MAX(AVIF_SPEED_SLOWEST, MS_MIN(AVIF_SPEED_FASTEST, encoder->speed));
+    encoder->maxThreads = MS_MAX(1, atoi(msGetOutputFormatOption( format, "COMPRESSION_THREADS", "1")));
+#if AVIF_VERSION >= 1000000
+    encoder->quality = quality;
+    encoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
+#else
+    encoder->minQuantizer = encoder->maxQuantizer =
+      (100 - quality) * AVIF_QUANTIZER_WORST_QUALITY / 100;
+    encoder->minQuantizerAlpha = encoder->maxQuantizerAlpha = AVIF_QUANTIZER_LOSSLESS;
+#endif
+    result = avifEncoderWrite(encoder, image, &output);
+  }
+
+  if(result == AVIF_RESULT_OK) {
+    if(info->fp)
+      msIO_fwrite(output.data,output.size,1,info->fp);
+    else
+      msBufferAppend(info->buffer,output.data,output.size);
+  } else {
+    msSetError(MS_MISCERR,"libavif: %s","saveAsAVIF()",avifResultToString(result));
+  }
+
+  avifRWDataFree(&output);
+  if(encoder)
+    avifEncoderDestroy(encoder);
+  avifImageDestroy(image);
+  return result == AVIF_RESULT_OK ? MS_SUCCESS : MS_FAILURE;
+}
+#endif /* USE_AVIF */
+
 /*
  * sort a given list of rgba entries so that all the opaque pixels are at the end
  */
@@ -310,18 +804,35 @@ int remapPaletteForPNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a, int
   return MS_SUCCESS;
 }
 
-int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
+int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression, int threads)
 {
   png_infop info_ptr;
   rgbPixel rgb[256];
   unsigned char a[256];
   int num_a;
   int row,sample_depth;
-  png_structp png_ptr = png_create_write_struct(
-                          PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
+  png_structp png_ptr;
 
   assert(rb->type == MS_BUFFER_BYTE_PALETTE);
 
+  if (rb->data.palette.num_entries <= 2)
+    sample_depth = 1;
+  else if (rb->data.palette.num_entries <= 4)
+    sample_depth = 2;
+  else if (rb->data.palette.num_entries <= 16)
+    sample_depth = 4;
+  else
+    sample_depth = 8;
+
+#ifdef USE_THREAD
+  if(getPNGBandRows(rb, threads) < rb->height) {
+    remapPaletteForPNG(rb,rgb,a,&num_a);
+    return savePNGBands(rb, info, compression, threads, sample_depth, PNG_COLOR_TYPE_PALETTE,
+                        rgb, rb->data.palette.num_entries, a, num_a);
+  }
+#endif
+
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
   if (!png_ptr)
     return (MS_FAILURE);
 
@@ -345,15 +856,6 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
     png_set_write_fn(png_ptr,info, png_write_data_to_buffer, png_flush_data);
 
 
-  if (rb->data.palette.num_entries <= 2)
-    sample_depth = 1;
-  else if (rb->data.palette.num_entries <= 4)
-    sample_depth = 2;
-  else if (rb->data.palette.num_entries <= 16)
-    sample_depth = 4;
-  else
-    sample_depth = 8;
-
   png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height,
                sample_depth, PNG_COLOR_TYPE_PALETTE,
                0, PNG_COMPRESSION_TYPE_DEFAULT,
@@ -425,6 +927,31 @@ int readPalette(const char *palette, rgbaPixel *entries, unsigned int *nEntries,
   return MS_SUCCESS;
 }
 
+/*
+** Key under which the palette of an image of the given format, drawn with
+** the layers currently enabled in map, is cached (FORMATOPTION
+** "QUANTIZE_CACHE=n" reuses it for n images).
+*/
+static char* getPaletteCacheKey(mapObj *map, outputFormatObj *format)
+{
+  char *key = msStringConcatenate(NULL, format->name ? format->name : format->driver);
+  key = msStringConcatenate(key, format->transparent ? "|t|" : "|o|");
+  key = msStringConcatenate(key, msGetOutputFormatOption( format, "QUANTIZE_COLORS", "256"));
+  if(map) {
+    int i;
+    key = msStringConcatenate(key, "|");
+    key = msStringConcatenate(key, map->mappath);
+    key = msStringConcatenate(key, map->name);
+    for(i=0; i<map->numlayers; i++) {
+      layerObj *layer = GET_LAYER(map, map->layerorder[i]);
+      if(layer->status == MS_OFF) continue;
+      key = msStringConcatenate(key, "|");
+      key = msStringConcatenate(key, layer->name);
+    }
+  }
+  return key;
+}
+
 int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj *format)
 {
   int force_pc256 = MS_FALSE;
@@ -434,6 +961,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 
   const char *force_string,*zlib_compression;
   int compression = -1;
+  int threads = atoi(msGetOutputFormatOption( format, "COMPRESSION_THREADS", "1"));
 
   zlib_compression = msGetOutputFormatOption( format, "COMPRESSION", NULL);
   if(zlib_compression && *zlib_compression) {
@@ -458,6 +986,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     rasterBufferObj qrb;
     rgbaPixel palette[256], paletteGiven[256];
     unsigned int numPaletteGivenEntries;
+    int classified = MS_FALSE;
     memset(&qrb,0,sizeof(rasterBufferObj));
     qrb.type = MS_BUFFER_BYTE_PALETTE;
     qrb.width = rb->width;
@@ -465,11 +994,19 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     qrb.data.palette.pixels = (unsigned char*)malloc(qrb.width*qrb.height*sizeof(unsigned char));
     qrb.data.palette.scaling_maxval = 255;
     if(force_pc256) {
+      int cache_uses = atoi(msGetOutputFormatOption( format, "QUANTIZE_CACHE", "0"));
       qrb.data.palette.palette = palette;
       qrb.data.palette.num_entries = atoi(msGetOutputFormatOption( format, "QUANTIZE_COLORS", "256"));
-      ret = msQuantizeRasterBuffer(rb,&(qrb.data.palette.num_entries),qrb.data.palette.palette,
-                                   NULL, 0,
-                                   &qrb.data.palette.scaling_maxval);
+      if(cache_uses > 0) {
+        char *key = getPaletteCacheKey(map, format);
+        ret = msQuantizeRasterBufferCached(rb, &qrb, key, cache_uses);
+        msFree(key);
+        classified = MS_TRUE;
+      } else {
+        ret = msQuantizeRasterBuffer(rb,&(qrb.data.palette.num_entries),qrb.data.palette.palette,
+                                     NULL, 0,
+                                     &qrb.data.palette.scaling_maxval);
+      }
     } else {
       int colorsWanted = atoi(msGetOutputFormatOption( format, "QUANTIZE_COLORS", "0"));
       const char *palettePath = msGetOutputFormatOption( format, "PALETTE", "palette.txt");
@@ -498,8 +1035,9 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
       }
     }
     if(ret != MS_FAILURE) {
-      ret = msClassifyRasterBuffer(rb,&qrb);
-      ret = savePalettePNG(&qrb,info,compression);
+      if(!classified)
+        ret = msClassifyRasterBuffer(rb,&qrb);
+      ret = savePalettePNG(&qrb,info,compression,threads);
     }
     msFree(qrb.data.palette.pixels);
     return ret;
@@ -507,10 +1045,20 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     png_infop info_ptr;
     int color_type;
     int row;
-    unsigned int *rowdata;
-    png_structp png_ptr = png_create_write_struct(
-                            PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
+    unsigned char *rowdata;
+    png_structp png_ptr;
+
+    if(rb->data.rgba.a)
+      color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+    else
+      color_type = PNG_COLOR_TYPE_RGB;
 
+#ifdef USE_THREAD
+    if(getPNGBandRows(rb, threads) < rb->height)
+      return savePNGBands(rb, info, compression, threads, 8, color_type, NULL, 0, NULL, 0);
+#endif
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
     if (!png_ptr)
       return (MS_FAILURE);
 
@@ -533,62 +1081,16 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     else
       png_set_write_fn(png_ptr,info, png_write_data_to_buffer, png_flush_data);
 
-    if(rb->data.rgba.a)
-      color_type = PNG_COLOR_TYPE_RGB_ALPHA;
-    else
-      color_type = PNG_COLOR_TYPE_RGB;
-
     png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height,
                  8, color_type, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
     png_write_info(png_ptr, info_ptr);
 
-    if(!rb->data.rgba.a && rb->data.rgba.pixel_step==4)
-      png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-
-    rowdata = (unsigned int*)malloc(rb->width*sizeof(unsigned int));
+    rowdata = (unsigned char*)malloc(getPNGRowBytes(rb, 8));
     for(row=0; row<rb->height; row++) {
-      unsigned int *pixptr = rowdata;
-      int col;
-      unsigned char *a,*r,*g,*b;
-      r=rb->data.rgba.r+row*rb->data.rgba.row_step;
-      g=rb->data.rgba.g+row*rb->data.rgba.row_step;
-      b=rb->data.rgba.b+row*rb->data.rgba.row_step;
-      if(rb->data.rgba.a) {
-        a=rb->data.rgba.a+row*rb->data.rgba.row_step;
-        for(col=0; col<rb->width; col++) {
-          if(*a) {
-            double da = *a/255.0;
-            unsigned char *pix = (unsigned char*)pixptr;
-            pix[0] = *r/da;
-            pix[1] = *g/da;
-            pix[2] = *b/da;
-            pix[3] = *a;
-          } else {
-            *pixptr=0;
-          }
-          pixptr++;
-          a+=rb->data.rgba.pixel_step;
-          r+=rb->data.rgba.pixel_step;
-          g+=rb->data.rgba.pixel_step;
-          b+=rb->data.rgba.pixel_step;
-        }
-      } else {
-        for(col=0; col<rb->width; col++) {
-          unsigned char *pix = (unsigned char*)pixptr;
-          pix[0] = *r;
-          pix[1] = *g;
-          pix[2] = *b;
-          pixptr++;
-          r+=rb->data.rgba.pixel_step;
-          g+=rb->data.rgba.pixel_step;
-          b+=rb->data.rgba.pixel_step;
-        }
-      }
-
+      formatPNGRow(rb, row, 8, rowdata);
       png_write_row(png_ptr,(png_bytep)rowdata);
-
     }
     png_write_end(png_ptr, info_ptr);
     free(rowdata);
@@ -731,6 +1233,22 @@ int msSaveRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
     info.buffer=NULL;
     
     return saveAsJPEG(map, rb,&info,format);
+#ifdef USE_WEBP
+  } else if(strcasestr(format->driver,"/webp")) {
+    streamInfo info;
+    info.fp = stream;
+    info.buffer = NULL;
+
+    return saveAsWEBP(map, rb,&info,format);
+#endif
+#ifdef USE_AVIF
+  } else if(strcasestr(format->driver,"/avif")) {
+    streamInfo info;
+    info.fp = stream;
+    info.buffer = NULL;
+
+    return saveAsAVIF(map, rb,&info,format);
+#endif
   } else {
     msSetError(MS_MISCERR,"unsupported image format\n", "msSaveRasterBuffer()");
     return MS_FAILURE;
@@ -750,6 +1268,20 @@ int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer,
     info.fp = NULL;
     info.buffer=buffer;
     return saveAsJPEG(NULL, data,&info,format);
+#ifdef USE_WEBP
+  } else if(strcasestr(format->driver,"/webp")) {
+    streamInfo info;
+    info.fp = NULL;
+    info.buffer = buffer;
+    return saveAsWEBP(NULL, data,&info,format);
+#endif
+#ifdef USE_AVIF
+  } else if(strcasestr(format->driver,"/avif")) {
+    streamInfo info;
+    info.fp = NULL;
+    info.buffer = buffer;
+    return saveAsAVIF(NULL, data,&info,format);
+#endif
   } else {
     msSetError(MS_MISCERR,"unsupported image format\n", "msSaveRasterBuffer()");
     return MS_FAILURE;
@@ -177,6 +177,15 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   ts->rotation = l->angle * MS_DEG_TO_RAD;
 }
 
+/*
+** Layers drawn by a worker thread collect their labels in a private cache
+** that is merged into the map's one afterwards, see msDrawMap().
+*/
+static labelCacheObj *layerLabelCache(mapObj *map, layerObj *layer)
+{
+  return layer->drawlabelcache ? layer->drawlabelcache : &(map->labelcache);
+}
+
 int msAddLabelGroup(mapObj *map, imageObj *image, layerObj* layer, int classindex, shapeObj *shape, pointObj *point, double featuresize)
 {
   int l,s, priority;
@@ -276,7 +285,7 @@ int msAddLabelGroup(mapObj *map, imageObj *image, layerObj* layer, int classinde
   else if (priority > MS_MAX_LABEL_PRIORITY)
     priority = MS_MAX_LABEL_PRIORITY;
 
-  cacheslot = &(map->labelcache.slots[priority-1]);
+  cacheslot = &(layerLabelCache(map,layerPtr)->slots[priority-1]);
 
   if(cacheslot->numlabels == cacheslot->cachesize) { /* just add it to the end */
     cacheslot->labels = (labelCacheMemberObj *) realloc(cacheslot->labels, sizeof(labelCacheMemberObj)*(cacheslot->cachesize+MS_LABELCACHEINCREMENT));
@@ -459,7 +468,7 @@ int msAddLabel(mapObj *map, imageObj *image, labelObj *label, int layerindex, in
   else if (label->priority > MS_MAX_LABEL_PRIORITY)
     label->priority = MS_MAX_LABEL_PRIORITY;
 
-  cacheslot = &(map->labelcache.slots[label->priority-1]);
+  cacheslot = &(layerLabelCache(map,layerPtr)->slots[label->priority-1]);
 
   if(cacheslot->numlabels == cacheslot->cachesize) { /* just add it to the end */
     cacheslot->labels = (labelCacheMemberObj *) realloc(cacheslot->labels, sizeof(labelCacheMemberObj)*(cacheslot->cachesize+MS_LABELCACHEINCREMENT));
@@ -532,6 +541,51 @@ int msAddLabel(mapObj *map, imageObj *image, labelObj *label, int layerindex, in
   return(MS_SUCCESS);
 }
 
+/*
+** Appends the labels and markers of src to dst, as if they had been added
+** to dst directly. The members are moved, src is left empty.
+*/
+int msMergeLabelCache(labelCacheObj *dst, labelCacheObj *src)
+{
+  int p, i;
+
+  for(p=0; p<MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *dstslot = &(dst->slots[p]), *srcslot = &(src->slots[p]);
+
+    if(srcslot->numlabels == 0) continue;
+
+    if(dstslot->numlabels + srcslot->numlabels > dstslot->cachesize) {
+      dstslot->labels = (labelCacheMemberObj *) realloc(dstslot->labels, sizeof(labelCacheMemberObj)*(dstslot->numlabels+srcslot->numlabels));
+      MS_CHECK_ALLOC(dstslot->labels, sizeof(labelCacheMemberObj)*(dstslot->numlabels+srcslot->numlabels), MS_FAILURE);
+      dstslot->cachesize = dstslot->numlabels + srcslot->numlabels;
+    }
+    if(dstslot->nummarkers + srcslot->nummarkers > dstslot->markercachesize) {
+      dstslot->markers = (markerCacheMemberObj *) realloc(dstslot->markers, sizeof(markerCacheMemberObj)*(dstslot->nummarkers+srcslot->nummarkers));
+      MS_CHECK_ALLOC(dstslot->markers, sizeof(markerCacheMemberObj)*(dstslot->nummarkers+srcslot->nummarkers), MS_FAILURE);
+      dstslot->markercachesize = dstslot->nummarkers + srcslot->nummarkers;
+    }
+
+    /* marker ids and label markerids are indexes into their slot, shift them */
+    for(i=0; i<srcslot->numlabels; i++) {
+      labelCacheMemberObj *cachePtr = &(dstslot->labels[dstslot->numlabels+i]);
+      *cachePtr = srcslot->labels[i];
+      if(cachePtr->markerid != -1)
+        cachePtr->markerid += dstslot->nummarkers;
+    }
+    for(i=0; i<srcslot->nummarkers; i++) {
+      dstslot->markers[dstslot->nummarkers+i] = srcslot->markers[i];
+      dstslot->markers[dstslot->nummarkers+i].id += dstslot->numlabels;
+    }
+    dstslot->numlabels += srcslot->numlabels;
+    dstslot->nummarkers += srcslot->nummarkers;
+
+    /* the text symbols now belong to dst */
+    srcslot->numlabels = srcslot->nummarkers = 0;
+  }
+
+  return MS_SUCCESS;
+}
+
 /*
 ** Is a label completely in the image, reserving a gutter (in pixels) inside
 ** image for no labels (effectively making image larger. The gutter can be
@@ -564,7 +618,137 @@ static int labelInImage(int width, int height, lineObj *lpoly, rectObj *bounds,
   return(MS_TRUE);
 }
 
+/*
+** Uniform grid index of the label cache. Entries are chained per cell, an
+** entry covering several cells is stored in each of them and remembers the
+** first one so that a search reports it only once.
+*/
+static void labelCacheGridInit(labelCacheGridObj *grid, int width, int height)
+{
+  int i, size = MS_MAX(width, height);
+
+  grid->cellsize = MS_LABELCACHEGRIDCELLSIZE;
+  if(size / grid->cellsize > MS_LABELCACHEGRIDMAXCELLS)
+    grid->cellsize = size / MS_LABELCACHEGRIDMAXCELLS + 1;
+  grid->numcols = MS_MAX(width, 1) / grid->cellsize + 1;
+  grid->numrows = MS_MAX(height, 1) / grid->cellsize + 1;
+  grid->cells = (int*) msSmallMalloc(grid->numcols * grid->numrows * sizeof(int));
+  for(i=0; i<grid->numcols * grid->numrows; i++)
+    grid->cells[i] = -1;
+  grid->entries = NULL;
+  grid->numentries = grid->numallocatedentries = 0;
+}
+
+void msFreeLabelCacheGrid(labelCacheGridObj *grid)
+{
+  msFree(grid->cells);
+  msFree(grid->entries);
+  memset(grid, 0, sizeof(labelCacheGridObj));
+}
+
+/* clamps a pixel coordinate to a cell, anything off the image goes to the border cells */
+static inline int labelCacheGridCell(const labelCacheGridObj *grid, double v, int numcells)
+{
+  if(!(v > 0)) return 0;
+  if(v >= (double)numcells * grid->cellsize) return numcells - 1;
+  return (int)(v / grid->cellsize);
+}
+
+static void labelCacheGridInsert(labelCacheGridObj *grid, const rectObj *rect, int index, int priority)
+{
+  int col, row;
+  int mincol = labelCacheGridCell(grid, rect->minx, grid->numcols);
+  int maxcol = labelCacheGridCell(grid, rect->maxx, grid->numcols);
+  int minrow = labelCacheGridCell(grid, rect->miny, grid->numrows);
+  int maxrow = labelCacheGridCell(grid, rect->maxy, grid->numrows);
+
+  for(row=minrow; row<=maxrow; row++) {
+    for(col=mincol; col<=maxcol; col++) {
+      labelCacheGridEntryObj *entry;
+      int *cell = &grid->cells[row * grid->numcols + col];
+      if(grid->numentries == grid->numallocatedentries) {
+        grid->numallocatedentries = MS_MAX(grid->numallocatedentries * 2, 256);
+        grid->entries = msSmallRealloc(grid->entries, grid->numallocatedentries * sizeof(labelCacheGridEntryObj));
+      }
+      entry = &grid->entries[grid->numentries];
+      entry->index = index;
+      entry->priority = priority;
+      entry->mincol = mincol;
+      entry->minrow = minrow;
+      entry->next = *cell;
+      *cell = grid->numentries++;
+    }
+  }
+}
+
+void msLabelCacheGridSearchInit(labelCacheGridSearchObj *search, labelCacheGridObj *grid, const rectObj *rect)
+{
+  search->grid = grid;
+  search->entry = -1;
+  if(!grid->cells) {
+    /* nothing was indexed yet */
+    search->mincol = search->minrow = 0;
+    search->maxcol = search->maxrow = -1;
+    search->col = search->row = 0;
+    return;
+  }
+  search->mincol = labelCacheGridCell(grid, rect->minx, grid->numcols);
+  search->maxcol = labelCacheGridCell(grid, rect->maxx, grid->numcols);
+  search->minrow = labelCacheGridCell(grid, rect->miny, grid->numrows);
+  search->maxrow = labelCacheGridCell(grid, rect->maxy, grid->numrows);
+  search->col = search->mincol;
+  search->row = search->minrow;
+  if(search->row <= search->maxrow)
+    search->entry = grid->cells[search->row * grid->numcols + search->col];
+}
+
+/*
+** Returns the next entry whose cells intersect the searched rectangle, or
+** NULL when done. Callers still have to test the actual bounds.
+*/
+labelCacheGridEntryObj *msLabelCacheGridSearchNext(labelCacheGridSearchObj *search)
+{
+  labelCacheGridObj *grid = search->grid;
+
+  while(search->row <= search->maxrow) {
+    while(search->entry != -1) {
+      labelCacheGridEntryObj *entry = &grid->entries[search->entry];
+      search->entry = entry->next;
+      /* only report the entry in the first cell it shares with the search */
+      if(MS_MAX(entry->mincol, search->mincol) == search->col &&
+          MS_MAX(entry->minrow, search->minrow) == search->row)
+        return entry;
+    }
+    if(++search->col > search->maxcol) {
+      search->col = search->mincol;
+      if(++search->row > search->maxrow)
+        break;
+    }
+    search->entry = grid->cells[search->row * grid->numcols + search->col];
+  }
+  return NULL;
+}
+
+/* adds the markers cached since the last collision test to the marker grid */
+static void indexLabelCacheMarkers(mapObj *map)
+{
+  labelCacheObj *labelcache = &(map->labelcache);
+  int p, m;
+
+  for(p=0; p<MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *markerslot = &(labelcache->slots[p]);
+    if(labelcache->num_indexed_markers[p] == markerslot->nummarkers)
+      continue;
+    if(!labelcache->marker_grid.cells)
+      labelCacheGridInit(&labelcache->marker_grid, map->width, map->height);
+    for(m=labelcache->num_indexed_markers[p]; m<markerslot->nummarkers; m++)
+      labelCacheGridInsert(&labelcache->marker_grid, &markerslot->markers[m].bounds, m, p);
+    labelcache->num_indexed_markers[p] = markerslot->nummarkers;
+  }
+}
+
 void insertRenderedLabelMember(mapObj *map, labelCacheMemberObj *cachePtr) {
+  rectObj extent;
   if(map->labelcache.num_rendered_members == map->labelcache.num_allocated_rendered_members) {
     if(map->labelcache.num_rendered_members == 0) {
       map->labelcache.num_allocated_rendered_members = 50;
@@ -574,6 +758,19 @@ void insertRenderedLabelMember(mapObj *map, labelCacheMemberObj *cachePtr) {
     map->labelcache.rendered_text_symbols = msSmallRealloc(map->labelcache.rendered_text_symbols,
             map->labelcache.num_allocated_rendered_members * sizeof(labelCacheMemberObj*));
   }
+
+  /* index everything the collision tests look at: text and styles (within bbox), leader and label point */
+  extent = cachePtr->bbox;
+  if(cachePtr->leaderbbox)
+    msMergeRect(&extent, cachePtr->leaderbbox);
+  extent.minx = MS_MIN(extent.minx, cachePtr->point.x);
+  extent.miny = MS_MIN(extent.miny, cachePtr->point.y);
+  extent.maxx = MS_MAX(extent.maxx, cachePtr->point.x);
+  extent.maxy = MS_MAX(extent.maxy, cachePtr->point.y);
+  if(!map->labelcache.rendered_grid.cells)
+    labelCacheGridInit(&map->labelcache.rendered_grid, map->width, map->height);
+  labelCacheGridInsert(&map->labelcache.rendered_grid, &extent, map->labelcache.num_rendered_members, 0);
+
   map->labelcache.rendered_text_symbols[map->labelcache.num_rendered_members++] = cachePtr;
 }
 
@@ -618,14 +815,16 @@ static inline int testSegmentLabelBBoxIntersection(const rectObj *leaderbbox, co
 }
 
 int msTestLabelCacheLeaderCollision(mapObj *map, pointObj *lp1, pointObj *lp2) {
-  int p;
   rectObj leaderbbox;
+  labelCacheGridSearchObj search;
+  labelCacheGridEntryObj *entry;
   leaderbbox.minx = MS_MIN(lp1->x,lp2->x);
   leaderbbox.maxx = MS_MAX(lp1->x,lp2->x);
   leaderbbox.miny = MS_MIN(lp1->y,lp2->y);
   leaderbbox.maxy = MS_MAX(lp1->y,lp2->y);
-  for(p=0; p<map->labelcache.num_rendered_members; p++) {
-    labelCacheMemberObj *curCachePtr= map->labelcache.rendered_text_symbols[p];
+  msLabelCacheGridSearchInit(&search, &map->labelcache.rendered_grid, &leaderbbox);
+  while((entry = msLabelCacheGridSearchNext(&search)) != NULL) {
+    labelCacheMemberObj *curCachePtr= map->labelcache.rendered_text_symbols[entry->index];
     if(msRectOverlap(&leaderbbox, &(curCachePtr->bbox))) {
     /* leaderbbox interesects with the curCachePtr's global bbox */
       int t;
@@ -671,6 +870,8 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, label
         int current_priority, int current_label)
 {
   labelCacheObj *labelcache = &(map->labelcache);
+  labelCacheGridSearchObj search;
+  labelCacheGridEntryObj *entry;
   int i, p, ll;
 
   /*
@@ -685,21 +886,23 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, label
   /* Compare against all rendered markers from this priority level and higher.
   ** Labels can overlap their own marker and markers from lower priority levels
   */
-  for (p=current_priority; p < MS_MAX_LABEL_PRIORITY; p++) {
-    labelCacheSlotObj *markerslot;
-    markerslot = &(labelcache->slots[p]);
-
-    for ( ll = 0; ll < markerslot->nummarkers; ll++ ) {
-      if ( !(p == current_priority && current_label == markerslot->markers[ll].id ) ) {  /* labels can overlap their own marker */
-        if ( intersectLabelPolygons(NULL, &markerslot->markers[ll].bounds, lb->poly, &lb->bbox ) == MS_TRUE ) {
-          return MS_FALSE;
-        }
+  indexLabelCacheMarkers(map);
+  msLabelCacheGridSearchInit(&search, &labelcache->marker_grid, &lb->bbox);
+  while((entry = msLabelCacheGridSearchNext(&search)) != NULL) {
+    p = entry->priority;
+    ll = entry->index;
+    if (p < current_priority)
+      continue;
+    if ( !(p == current_priority && current_label == labelcache->slots[p].markers[ll].id ) ) {  /* labels can overlap their own marker */
+      if ( intersectLabelPolygons(NULL, &labelcache->slots[p].markers[ll].bounds, lb->poly, &lb->bbox ) == MS_TRUE ) {
+        return MS_FALSE;
       }
     }
   }
 
-  for(p=0; p<labelcache->num_rendered_members; p++) {
-    labelCacheMemberObj *curCachePtr= labelcache->rendered_text_symbols[p];
+  msLabelCacheGridSearchInit(&search, &labelcache->rendered_grid, &lb->bbox);
+  while((entry = msLabelCacheGridSearchNext(&search)) != NULL) {
+    labelCacheMemberObj *curCachePtr= labelcache->rendered_text_symbols[entry->index];
     if(msRectOverlap(&curCachePtr->bbox,&lb->bbox)) {
       for(i=0; i<curCachePtr->numtextsymbols; i++) {
         int j;
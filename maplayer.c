@@ -471,6 +471,7 @@ void msLayerFreeExpressions(layerObj *layer)
 {
   int i,j,k;
 
+  msFreeClassLookup(layer); /* built from the class expression tokens */
   msFreeExpressionTokens(&(layer->filter));
   msFreeExpressionTokens(&(layer->cluster.group));
   msFreeExpressionTokens(&(layer->cluster.filter));
@@ -2163,6 +2164,7 @@ int msINLINELayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 
   layerinfo->searchrect = rect;
   layerinfo->is_relative = (layer->transform != MS_FALSE && layer->transform != MS_TRUE);
+  layer->currentfeature = layer->features; /* restart the scan, the layer may be searched more than once while open */
   
   return MS_SUCCESS;
 }
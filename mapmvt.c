@@ -35,12 +35,13 @@
 #include "mapows.h"
 #include "uthash.h"
 #include <float.h>
+#include <zlib.h>
 
 #define MOVETO 1
 #define LINETO 2
 #define CLOSEPATH 7
 
-#define FEATURES_INCREMENT_SIZE 5
+#define FEATURES_INCREMENT_SIZE 64
 
 enum MS_RING_DIRECTION { MS_DIRECTION_INVALID_RING, MS_DIRECTION_CLOCKWISE, MS_DIRECTION_COUNTERCLOCKWISE };
 
@@ -52,6 +53,7 @@ typedef struct {
 
 typedef struct {
   value_lookup *cache;
+  int values_size; /* allocated size of the layer values array */
 } value_lookup_table;
 
 #define COMMAND(id, count) (((id) & 0x7) | ((count) << 3))
@@ -120,7 +122,7 @@ static void mvtReorderRings(shapeObj *shape, int *outers) {
   }
 }
 
-static int mvtTransformShape(shapeObj *shape, rectObj *extent, int layer_type, int mvt_layer_extent) {
+static int mvtTransformShape(shapeObj *shape, rectObj *extent, int layer_type, int mvt_layer_extent, int drop_collinear) {
   double scale_x,scale_y;
   int i,j,outj;
 
@@ -136,13 +138,30 @@ static int mvtTransformShape(shapeObj *shape, rectObj *extent, int layer_type, i
   }
 
   for(i=0;i<shape->numlines;i++) {
+    pointObj *point = shape->line[i].point;
     for(j=0,outj=0;j<shape->line[i].numpoints;j++) {
 
-      shape->line[i].point[outj].x = (int)((shape->line[i].point[j].x - extent->minx)*scale_x);
-      shape->line[i].point[outj].y = mvt_layer_extent - (int)((shape->line[i].point[j].y - extent->miny)*scale_y);
+      point[outj].x = (int)((point[j].x - extent->minx)*scale_x);
+      point[outj].y = mvt_layer_extent - (int)((point[j].y - extent->miny)*scale_y);
 
-      if(!outj || shape->line[i].point[outj].x != shape->line[i].point[outj-1].x || shape->line[i].point[outj].y != shape->line[i].point[outj-1].y)
-        outj++; /* add the point to the shape only if it's the first one or if it's different than the previous one */
+      if(outj && point[outj].x == point[outj-1].x && point[outj].y == point[outj-1].y)
+        continue; /* snapped to the same tile cell as the previous point */
+
+      /*
+      ** With FORMATOPTION "DROP_COLLINEAR=ON", for lines and rings, drop the
+      ** previous point if it lies on the straight segment from the one before
+      ** to this one: at tile grid resolution it adds nothing but bytes to the
+      ** encoded geometry. Off by default, as it changes the tiles produced.
+      */
+      if(drop_collinear && outj >= 2 && layer_type != MS_LAYER_POINT) {
+        double ax = point[outj-1].x - point[outj-2].x, ay = point[outj-1].y - point[outj-2].y;
+        double bx = point[outj].x - point[outj-1].x, by = point[outj].y - point[outj-1].y;
+        if(ax*by == ay*bx && ax*bx + ay*by > 0) {
+          point[outj-1] = point[outj];
+          continue;
+        }
+      }
+      outj++;
     }
     shape->line[i].numpoints = outj;
 
@@ -222,7 +241,7 @@ static void freeMvtLayer( VectorTile__Tile__Layer *mvt_layer ) {
 
 int mvtWriteShape( layerObj *layer, shapeObj *shape, VectorTile__Tile__Layer *mvt_layer,
                    gmlItemListObj *item_list, value_lookup_table *value_lookup_cache,
-                   rectObj *unbuffered_bbox, int buffer) {
+                   rectObj *unbuffered_bbox, int buffer, int drop_collinear) {
   VectorTile__Tile__Feature *mvt_feature;
   int i,j,iout;
   value_lookup *value;
@@ -230,7 +249,7 @@ int mvtWriteShape( layerObj *layer, shapeObj *shape, VectorTile__Tile__Layer *mv
 
   /* could consider an intersection test here */
 
-  if(mvtTransformShape(shape, unbuffered_bbox, layer->type, mvt_layer->extent) != MS_SUCCESS) {
+  if(mvtTransformShape(shape, unbuffered_bbox, layer->type, mvt_layer->extent, drop_collinear) != MS_SUCCESS) {
     return MS_SUCCESS; /* degenerate shape */
   }
   if(mvtClipShape(shape, layer->type, buffer, mvt_layer->extent) != MS_SUCCESS) {
@@ -282,7 +301,11 @@ int mvtWriteShape( layerObj *layer, shapeObj *shape, VectorTile__Tile__Layer *mv
       value = msSmallMalloc(sizeof(value_lookup));
       value->value = msStrdup(shape->values[i]);
       value->index = mvt_layer->n_values;
-      mvt_layer->values = msSmallRealloc(mvt_layer->values,(++mvt_layer->n_values)*sizeof(VectorTile__Tile__Value*));
+      if(mvt_layer->n_values == value_lookup_cache->values_size) {
+        value_lookup_cache->values_size = MS_MAX(FEATURES_INCREMENT_SIZE, value_lookup_cache->values_size*2);
+        mvt_layer->values = msSmallRealloc(mvt_layer->values,value_lookup_cache->values_size*sizeof(VectorTile__Tile__Value*));
+      }
+      mvt_layer->n_values++;
       mvt_layer->values[mvt_layer->n_values-1] = msSmallMalloc(sizeof(VectorTile__Tile__Value));
       mvt_value = mvt_layer->values[mvt_layer->n_values-1];
       vector_tile__tile__value__init(mvt_value);
@@ -368,15 +391,13 @@ static void freeMvtTile( VectorTile__Tile *mvt_tile ) {
   msFree(mvt_tile->layers);
 }
 
-int msMVTWriteTile( mapObj *map, int sendheaders ) {
-  int iLayer,retcode=MS_SUCCESS;
-  unsigned len;
-  void *buf;
-  const char *mvt_extent = msGetOutputFormatOption(map->outputformat, "EXTENT", "4096");
-  const char *mvt_buffer = msGetOutputFormatOption(map->outputformat, "EDGE_BUFFER", "10");
-  int buffer = MS_ABS(atoi(mvt_buffer));
-  VectorTile__Tile mvt_tile = VECTOR_TILE__TILE__INIT;
-  mvt_tile.layers = msSmallCalloc(map->numlayers, sizeof(VectorTile__Tile__Layer*));
+/*
+** Sets the map extent, cellsize and scale for one tile. The extent is
+** the one set up by msTileSetExtent() (or by a WMS request), from pixel
+** center to pixel center.
+*/
+static void mvtSetTileExtent(mapObj *map, const rectObj *extent) {
+  map->extent = *extent;
 
   /* make sure we have a scale and cellsize computed */
   map->cellsize = MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width);
@@ -387,168 +408,295 @@ int msMVTWriteTile( mapObj *map, int sendheaders ) {
   map->extent.maxx += map->cellsize * 0.5;
   map->extent.miny -= map->cellsize * 0.5;
   map->extent.maxy += map->cellsize * 0.5;
+}
 
-  for( iLayer = 0; iLayer < map->numlayers; iLayer++ ) {
-    int status=MS_SUCCESS;
-    layerObj *layer = GET_LAYER(map, iLayer);
-    int i;
-    shapeObj shape;
-    gmlItemListObj *item_list = NULL;
-    VectorTile__Tile__Layer *mvt_layer;
-    value_lookup_table value_lookup_cache = {NULL};
-    value_lookup *cur_value_lookup, *tmp_value_lookup;
-    rectObj rect;
+/*
+** Adds the features of an open layer that fall in the current map extent
+** to a new layer of mvt_tile.
+*/
+static int mvtWriteLayer(mapObj *map, layerObj *layer, gmlItemListObj *item_list, VectorTile__Tile *mvt_tile, int mvt_extent, int buffer, int drop_collinear) {
+  int i,status,retcode=MS_SUCCESS;
+  shapeObj shape;
+  VectorTile__Tile__Layer *mvt_layer;
+  value_lookup_table value_lookup_cache = {NULL, 0};
+  value_lookup *cur_value_lookup, *tmp_value_lookup;
+  rectObj rect;
+  int features_size = 0;
+
+  rect = map->extent;
+  if(layer->project) msProjectRect(&(map->projection), &(layer->projection), &rect);
+
+  status = msLayerWhichShapes(layer, rect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap - that's ok */
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    return status;
+  }
 
-    int features_size = 0;
+  mvt_tile->layers[mvt_tile->n_layers++] = msSmallMalloc(sizeof(VectorTile__Tile__Layer));
+  mvt_layer = mvt_tile->layers[mvt_tile->n_layers-1];
+  vector_tile__tile__layer__init(mvt_layer);
+  mvt_layer->version = 2;
+  mvt_layer->name = layer->name;
 
-    if(!msLayerIsVisible(map, layer)) continue;
+  mvt_layer->extent = mvt_extent;
+  mvt_layer->has_extent = 1;
 
-    if(layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_POLYGON && layer->type != MS_LAYER_LINE)
+  /* -------------------------------------------------------------------- */
+  /*      Create appropriate attributes on this layer.                    */
+  /* -------------------------------------------------------------------- */
+  mvt_layer->keys = msSmallMalloc(layer->numitems * sizeof(char*));
+
+  for( i = 0; i < layer->numitems; i++ ) {
+    gmlItemObj *item = item_list->items + i;
+
+    if( !item->visible )
       continue;
 
-    status = msLayerOpen(layer);
-    if(status != MS_SUCCESS) {
-      retcode = status;
-      goto layer_cleanup;
+    if( item->alias )
+      mvt_layer->keys[mvt_layer->n_keys++] = msStrdup(item->alias);
+    else
+      mvt_layer->keys[mvt_layer->n_keys++] = msStrdup(item->name);
+  }
+
+  mvt_layer->features = msSmallCalloc(FEATURES_INCREMENT_SIZE, sizeof(VectorTile__Tile__Feature*));
+  features_size = FEATURES_INCREMENT_SIZE;
+
+  msInitShape(&shape);
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+
+    if(layer->numclasses > 0) {
+      shape.classindex = msShapeGetClass(layer, map, &shape, NULL, -1); /* Perform classification, and some annotation related magic. */
+      if(shape.classindex < 0)
+        goto feature_cleanup; /* no matching CLASS found, skip this feature */
     }
 
-    status = msLayerWhichItems(layer, MS_TRUE, NULL); /* we want all items - behaves like a query in that sense */
-    if(status != MS_SUCCESS) {
-      retcode = status;
-      goto layer_cleanup;
+    /*
+    ** prepare any necessary JOINs here (one-to-one only)
+    */
+    if( layer->numjoins > 0) {
+      int j;
+
+      for(j=0; j < layer->numjoins; j++) {
+        if(layer->joins[j].type == MS_JOIN_ONE_TO_ONE) {
+          msJoinPrepare(&(layer->joins[j]), &shape);
+          msJoinNext(&(layer->joins[j])); /* fetch the first row */
+        }
+      }
     }
 
-    /* -------------------------------------------------------------------- */
-    /*      Will we need to reproject?                                      */
-    /* -------------------------------------------------------------------- */
-    layer->project = msProjectionsDiffer(&(layer->projection), &(map->projection));
-
-    rect = map->extent;
-    if(layer->project) msProjectRect(&(map->projection), &(layer->projection), &rect);
-
-    status = msLayerWhichShapes(layer, rect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap - that's ok */
-      retcode = MS_SUCCESS;
-      goto layer_cleanup;
-    } else if(status != MS_SUCCESS) {
-      retcode = status;
-      goto layer_cleanup;
+    if(mvt_layer->n_features == features_size) { /* need to allocate more space */
+      features_size *= 2;
+      mvt_layer->features = msSmallRealloc(mvt_layer->features, sizeof(VectorTile__Tile__Feature*)*(features_size));
     }
 
-    mvt_tile.layers[mvt_tile.n_layers++] = msSmallMalloc(sizeof(VectorTile__Tile__Layer));
-    mvt_layer = mvt_tile.layers[mvt_tile.n_layers-1];
-    vector_tile__tile__layer__init(mvt_layer);
-    mvt_layer->version = 2;
-    mvt_layer->name = layer->name;
+    if( layer->project ) {
+      status = msProjectShape(&layer->projection, &layer->map->projection, &shape);
+    }
+    if( status == MS_SUCCESS ) {
+      status = mvtWriteShape( layer, &shape, mvt_layer, item_list, &value_lookup_cache, &map->extent, buffer, drop_collinear );
+    }
 
-    mvt_layer->extent = MS_ABS(atoi(mvt_extent));
-    mvt_layer->has_extent = 1;
+    feature_cleanup:
+    msFreeShape(&shape);
+    if(retcode != MS_SUCCESS) break;
+  } /* next shape */
 
-    /* -------------------------------------------------------------------- */
-    /*      Create appropriate attributes on this layer.                    */
-    /* -------------------------------------------------------------------- */
-    item_list = msGMLGetItems( layer, "G" );
-    assert( item_list->numitems == layer->numitems );
+  UT_HASH_ITER(hh, value_lookup_cache.cache, cur_value_lookup, tmp_value_lookup) {
+    msFree(cur_value_lookup->value);
+    UT_HASH_DEL(value_lookup_cache.cache,cur_value_lookup);
+    msFree(cur_value_lookup);
+  }
 
-    mvt_layer->keys = msSmallMalloc(layer->numitems * sizeof(char*));
+  return retcode;
+}
 
-    for( i = 0; i < layer->numitems; i++ ) {
-      gmlItemObj *item = item_list->items + i;
+/*
+** Builds one vector tile per extent. Each layer is opened once for the
+** whole batch and its shapes are then fetched tile by tile, so a batch
+** pays the connection and item setup costs of a single tile.
+*/
+static int mvtBuildTiles(mapObj *map, const rectObj *extents, int numtiles, VectorTile__Tile *mvt_tiles) {
+  int iLayer,iTile,retcode=MS_SUCCESS;
+  const char *mvt_extent = msGetOutputFormatOption(map->outputformat, "EXTENT", "4096");
+  const char *mvt_buffer = msGetOutputFormatOption(map->outputformat, "EDGE_BUFFER", "10");
+  int buffer = MS_ABS(atoi(mvt_buffer));
+  const char *drop_collinear_string = msGetOutputFormatOption(map->outputformat, "DROP_COLLINEAR", "OFF");
+  int drop_collinear = (strcasecmp(drop_collinear_string, "ON") == 0 || strcasecmp(drop_collinear_string, "YES") == 0 || strcasecmp(drop_collinear_string, "TRUE") == 0);
 
-      if( !item->visible )
-        continue;
+  for( iTile = 0; iTile < numtiles; iTile++ )
+    mvt_tiles[iTile].layers = msSmallCalloc(map->numlayers, sizeof(VectorTile__Tile__Layer*));
 
-      if( item->alias )
-        mvt_layer->keys[mvt_layer->n_keys++] = msStrdup(item->alias);
-      else
-        mvt_layer->keys[mvt_layer->n_keys++] = msStrdup(item->name);
-    }
+  for( iLayer = 0; iLayer < map->numlayers; iLayer++ ) {
+    int status=MS_SUCCESS, opened=MS_FALSE;
+    layerObj *layer = GET_LAYER(map, iLayer);
+    gmlItemListObj *item_list = NULL;
 
-    /* -------------------------------------------------------------------- */
-    /*      Setup joins if needed.  This is likely untested.                */
-    /* -------------------------------------------------------------------- */
-    if(layer->numjoins > 0) {
-      int j;
-      for(j=0; j<layer->numjoins; j++) {
-        status = msJoinConnect(layer, &(layer->joins[j]));
+    if(layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_POLYGON && layer->type != MS_LAYER_LINE)
+      continue;
+
+    for( iTile = 0; iTile < numtiles; iTile++ ) {
+      mvtSetTileExtent(map, &extents[iTile]);
+
+      if(!msLayerIsVisible(map, layer)) continue;
+
+      if(!opened) {
+        opened = MS_TRUE;
+
+        status = msLayerOpen(layer);
         if(status != MS_SUCCESS) {
           retcode = status;
-          goto layer_cleanup;
+          break;
         }
-      }
-    }
-
-    mvt_layer->features = msSmallCalloc(FEATURES_INCREMENT_SIZE, sizeof(VectorTile__Tile__Feature*));
-    features_size = FEATURES_INCREMENT_SIZE;
 
-    msInitShape(&shape);
-    while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
-      
-      if(layer->numclasses > 0) {
-        shape.classindex = msShapeGetClass(layer, map, &shape, NULL, -1); /* Perform classification, and some annotation related magic. */
-        if(shape.classindex < 0)
-          goto feature_cleanup; /* no matching CLASS found, skip this feature */
-      }
-
-      /*
-      ** prepare any necessary JOINs here (one-to-one only)
-      */
-      if( layer->numjoins > 0) {
-        int j;
+        status = msLayerWhichItems(layer, MS_TRUE, NULL); /* we want all items - behaves like a query in that sense */
+        if(status != MS_SUCCESS) {
+          retcode = status;
+          break;
+        }
 
-        for(j=0; j < layer->numjoins; j++) {
-          if(layer->joins[j].type == MS_JOIN_ONE_TO_ONE) {
-            msJoinPrepare(&(layer->joins[j]), &shape);
-            msJoinNext(&(layer->joins[j])); /* fetch the first row */
+        /* -------------------------------------------------------------------- */
+        /*      Will we need to reproject?                                      */
+        /* -------------------------------------------------------------------- */
+        layer->project = msProjectionsDiffer(&(layer->projection), &(map->projection));
+
+        item_list = msGMLGetItems( layer, "G" );
+        assert( item_list->numitems == layer->numitems );
+
+        /* -------------------------------------------------------------------- */
+        /*      Setup joins if needed.  This is likely untested.                */
+        /* -------------------------------------------------------------------- */
+        if(layer->numjoins > 0) {
+          int j;
+          for(j=0; j<layer->numjoins; j++) {
+            status = msJoinConnect(layer, &(layer->joins[j]));
+            if(status != MS_SUCCESS) {
+              retcode = status;
+              break;
+            }
           }
+          if(retcode != MS_SUCCESS) break;
         }
       }
 
-      if(mvt_layer->n_features == features_size) { /* need to allocate more space */
-        features_size += FEATURES_INCREMENT_SIZE;
-        mvt_layer->features = msSmallRealloc(mvt_layer->features, sizeof(VectorTile__Tile__Feature*)*(features_size));
+      status = mvtWriteLayer(map, layer, item_list, &mvt_tiles[iTile], MS_ABS(atoi(mvt_extent)), buffer, drop_collinear);
+      if(status != MS_SUCCESS) {
+        retcode = status;
+        break;
       }
+    } /* next tile */
 
-      if( layer->project ) {
-        status = msProjectShape(&layer->projection, &layer->map->projection, &shape);
-      }      if( status == MS_SUCCESS ) {
-        status = mvtWriteShape( layer, &shape, mvt_layer, item_list, &value_lookup_cache, &map->extent, buffer );
-      }
-
-      feature_cleanup:
-      msFreeShape(&shape);
-      if(retcode != MS_SUCCESS) goto layer_cleanup;
-    } /* next shape */
-    layer_cleanup:
-    msLayerClose(layer);
+    if(opened) msLayerClose(layer);
     msGMLFreeItems(item_list);
-    UT_HASH_ITER(hh, value_lookup_cache.cache, cur_value_lookup, tmp_value_lookup) {
-      msFree(cur_value_lookup->value);
-      UT_HASH_DEL(value_lookup_cache.cache,cur_value_lookup);
-      msFree(cur_value_lookup);
-    }
-    if(retcode != MS_SUCCESS) goto cleanup;
+    if(retcode != MS_SUCCESS) break;
   } /* next layer */
 
-  len = vector_tile__tile__get_packed_size(&mvt_tile); // This is the calculated packing length
+  return retcode;
+}
+
+/*
+** Packs a tile, gzip compressing it when the output format has
+** FORMATOPTION "COMPRESSION=GZIP" (level from COMPRESSION_LEVEL).
+*/
+static unsigned char* mvtPackTile(mapObj *map, VectorTile__Tile *mvt_tile, int *size) {
+  unsigned len;
+  unsigned char *buf, *zbuf;
+  z_stream zs;
+  const char *compression = msGetOutputFormatOption(map->outputformat, "COMPRESSION", "NONE");
+  int level = atoi(msGetOutputFormatOption(map->outputformat, "COMPRESSION_LEVEL", "-1"));
+
+  len = vector_tile__tile__get_packed_size(mvt_tile); // This is the calculated packing length
 
-  buf = msSmallMalloc(len); // Allocate memory
-  vector_tile__tile__pack(&mvt_tile, buf);
-  if( sendheaders ) {
-    msIO_fprintf( stdout,
-		  "Content-Length: %d\r\n"
-		  "Content-Type: application/x-protobuf\r\n\r\n",
-                  len);
+  buf = msSmallMalloc(MS_MAX(len, 1)); // Allocate memory, an empty tile packs to 0 bytes
+  vector_tile__tile__pack(mvt_tile, buf);
+  *size = len;
+
+  if(strcasecmp(compression, "GZIP") != 0)
+    return buf;
+
+  memset(&zs, 0, sizeof(zs));
+  if(deflateInit2(&zs, level, Z_DEFLATED, 15 + 16 /* gzip header */, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    msSetError(MS_MISCERR, "Invalid COMPRESSION_LEVEL \"%d\", expecting -1 to 9.", "mvtPackTile()", level);
+    msFree(buf);
+    return NULL;
+  }
+  zbuf = msSmallMalloc(deflateBound(&zs, len));
+  zs.next_in = buf;
+  zs.avail_in = len;
+  zs.next_out = zbuf;
+  zs.avail_out = deflateBound(&zs, len);
+  if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+    msSetError(MS_MISCERR, "Failed to compress vector tile.", "mvtPackTile()");
+    deflateEnd(&zs);
+    msFree(zbuf);
+    msFree(buf);
+    return NULL;
   }
-  msIO_fwrite(buf,len,1,stdout);
+  *size = zs.total_out;
+  deflateEnd(&zs);
   msFree(buf);
+  return zbuf;
+}
+
+/*
+** Writes numtiles vector tiles, one per extent. A single tile is written
+** as is; several tiles are written as a multipart/mixed response with a
+** part per tile, named by the matching entry of names.
+*/
+int msMVTWriteTiles( mapObj *map, const rectObj *extents, char **names, int numtiles, int sendheaders ) {
+  int iTile,retcode,size;
+  unsigned char *buf;
+  static const char *boundary = "xxMVTBoundaryxx";
+  const char *encoding = strcasecmp(msGetOutputFormatOption(map->outputformat, "COMPRESSION", "NONE"), "GZIP") ? NULL : "gzip";
+  VectorTile__Tile *mvt_tiles = msSmallMalloc(numtiles * sizeof(VectorTile__Tile));
+
+  for( iTile = 0; iTile < numtiles; iTile++ )
+    vector_tile__tile__init(&mvt_tiles[iTile]);
+
+  retcode = mvtBuildTiles(map, extents, numtiles, mvt_tiles);
+  if(retcode != MS_SUCCESS) goto cleanup;
+
+  if( numtiles > 1 && sendheaders )
+    msIO_fprintf( stdout, "Content-Type: multipart/mixed; boundary=%s\r\n\r\n", boundary);
+
+  for( iTile = 0; iTile < numtiles; iTile++ ) {
+    buf = mvtPackTile(map, &mvt_tiles[iTile], &size);
+    if(!buf) {
+      retcode = MS_FAILURE;
+      goto cleanup;
+    }
+    if( numtiles > 1 ) {
+      msIO_fprintf( stdout, "--%s\r\nContent-Location: %s\r\n", boundary, names[iTile]);
+    }
+    if( numtiles > 1 || sendheaders ) {
+      if(encoding)
+        msIO_fprintf( stdout, "Content-Encoding: %s\r\n", encoding);
+      msIO_fprintf( stdout,
+                    "Content-Length: %d\r\n"
+                    "Content-Type: application/x-protobuf\r\n\r\n",
+                    size);
+    }
+    msIO_fwrite(buf,size,1,stdout);
+    msFree(buf);
+    if( numtiles > 1 )
+      msIO_fprintf( stdout, "\r\n");
+  }
+  if( numtiles > 1 )
+    msIO_fprintf( stdout, "--%s--\r\n", boundary);
 
   cleanup:
-  freeMvtTile(&mvt_tile);
+  for( iTile = 0; iTile < numtiles; iTile++ )
+    freeMvtTile(&mvt_tiles[iTile]);
+  msFree(mvt_tiles);
 
   return retcode;
 }
 
+int msMVTWriteTile( mapObj *map, int sendheaders ) {
+  rectObj extent = map->extent;
+  return msMVTWriteTiles(map, &extent, NULL, 1, sendheaders);
+}
+
 int msPopulateRendererVTableMVT(rendererVTableObj * renderer) {
   return MS_SUCCESS;
 }
@@ -562,4 +710,9 @@ int msMVTWriteTile( mapObj *map, int sendheaders ) {
   msSetError(MS_MISCERR, "Vector Tile support is not available.", "msMVTWriteTile()");
   return MS_FAILURE;
 }
+
+int msMVTWriteTiles( mapObj *map, const rectObj *extents, char **names, int numtiles, int sendheaders ) {
+  msSetError(MS_MISCERR, "Vector Tile support is not available.", "msMVTWriteTiles()");
+  return MS_FAILURE;
+}
 #endif
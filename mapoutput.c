@@ -109,6 +109,12 @@ struct defaultOutputFormatEntry defaultoutputformats[] = {
   {"png24","AGG/PNG","image/png; mode=24bit"},
   {"jpegpng", "AGG/MIXED", "image/vnd.jpeg-png"},
   {"jpegpng8", "AGG/MIXED", "image/vnd.jpeg-png8"},
+#ifdef USE_WEBP
+  {"webp","AGG/WEBP","image/webp"},
+#endif
+#ifdef USE_AVIF
+  {"avif","AGG/AVIF","image/avif"},
+#endif
 #ifdef USE_CAIRO
   {"pdf","CAIRO/PDF","application/x-pdf"},
   {"svg","CAIRO/SVG","image/svg+xml"},
@@ -212,6 +218,26 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
     format->extension = msStrdup("jpg");
     format->renderer = MS_RENDER_WITH_AGG;
   }
+#if defined(USE_WEBP)
+  else if( strcasecmp(driver,"AGG/WEBP") == 0 ) {
+    if(!name) name="webp";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("image/webp");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->extension = msStrdup("webp");
+    format->renderer = MS_RENDER_WITH_AGG;
+  }
+#endif
+#if defined(USE_AVIF)
+  else if( strcasecmp(driver,"AGG/AVIF") == 0 ) {
+    if(!name) name="avif";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("image/avif");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->extension = msStrdup("avif");
+    format->renderer = MS_RENDER_WITH_AGG;
+  }
+#endif
 #if defined(USE_PBF)
   else if( strcasecmp(driver,"MVT") == 0 ) {
     if(!name) name="mvt";
@@ -271,6 +297,26 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
     format->extension = msStrdup("jpg");
     format->renderer = MS_RENDER_WITH_CAIRO_RASTER;
   }
+#if defined(USE_WEBP)
+  else if( strcasecmp(driver,"CAIRO/WEBP") == 0 ) {
+    if(!name) name="cairowebp";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("image/webp");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->extension = msStrdup("webp");
+    format->renderer = MS_RENDER_WITH_CAIRO_RASTER;
+  }
+#endif
+#if defined(USE_AVIF)
+  else if( strcasecmp(driver,"CAIRO/AVIF") == 0 ) {
+    if(!name) name="cairoavif";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("image/avif");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->extension = msStrdup("avif");
+    format->renderer = MS_RENDER_WITH_CAIRO_RASTER;
+  }
+#endif
   else if( strcasecmp(driver,"CAIRO/PDF") == 0 ) {
     if(!name) name="pdf";
     format = msAllocOutputFormat( map, name, driver );
@@ -2208,14 +2208,19 @@ void msOWSPrintBoundingBox(FILE *stream, const char *tabspace,
       /* reproject the extents for each SRS's bounding box */
       msInitProjection(&proj);
       if (msLoadProjectionStringEPSG(&proj, (char *)value) == 0) {
-        if (msProjectionsDiffer(srcproj, &proj) == MS_TRUE) {
+        projectionPairObj pair;
+
+        msGetProjectionPair(srcproj, &proj, &pair);
+        if (pair.differ) {
           msProjectRect(srcproj, &proj, &ext);
         }
         /*for wms 1.3.0 we need to make sure that we present the BBOX with
           a reversed axes for some espg codes*/
-        if (wms_version >= OWS_1_3_0 && value && strncasecmp(value, "EPSG:", 5) == 0) {
-          msAxisNormalizePoints( &proj, 1, &(ext.minx), &(ext.miny) );
-          msAxisNormalizePoints( &proj, 1, &(ext.maxx), &(ext.maxy) );
+        if (wms_version >= OWS_1_3_0 && value && strncasecmp(value, "EPSG:", 5) == 0
+            && pair.out_axis_inverted) {
+          double tmp;
+          tmp = ext.minx; ext.minx = ext.miny; ext.miny = tmp;
+          tmp = ext.maxx; ext.maxx = ext.maxy; ext.maxy = tmp;
         }
       }
       msFreeProjection( &proj );
@@ -51,6 +51,12 @@
 ** msPostGISNextShape reads a row, increments layerinfo->rownum, and returns
 ** MS_SUCCESS, until rownum reaches ntuples, and it returns MS_DONE instead.
 **
+** With PROCESSING "FETCH_SIZE=n" drawing (not querying) streams the rows
+** instead: the SQL is declared as a cursor, layerinfo->pgresult holds one
+** batch of at most n rows and the FETCH of the following batch is sent
+** before the current one is drawn, so transfer overlaps rendering and the
+** client never holds more than two batches.
+**
 */
 
 /* GNU needs this for strcasestr */
@@ -65,6 +71,7 @@
 #include "maptime.h"
 #include "mappostgis.h"
 #include "mapows.h"
+#include "mapthread.h"
 
 #define FP_EPSILON 1e-12
 #define FP_EQ(a, b) (fabs((a)-(b)) < FP_EPSILON)
@@ -91,6 +98,253 @@
 
 
 
+/*
+** Streaming state of a connection. Pooled connections are shared by all
+** the layers with the same CONNECTION, and several of them may stream at
+** once (e.g. the sources of a union layer), so the open cursors, the
+** transaction opened for them and the layer whose FETCH is in flight are
+** tracked per connection. A connection is only used by one thread at a
+** time, the lock only protects the list itself.
+*/
+typedef struct msPostGISConnState {
+  PGconn *pgconn;
+  int numcursors;       /* Cursors open on the connection */
+  int cursorid;         /* Used to name the cursors */
+  int ownstransaction;  /* The transaction was started for the cursors */
+  msPostGISLayerInfo *prefetcher; /* Layer with a FETCH in flight, if any */
+  struct msPostGISConnState *next;
+} msPostGISConnState;
+
+static msPostGISConnState *conn_states = NULL;
+
+static msPostGISConnState *msPostGISGetConnState(PGconn *pgconn, int create)
+{
+  msPostGISConnState *state;
+
+  msAcquireLock(TLOCK_POSTGIS);
+  for(state = conn_states; state; state = state->next) {
+    if(state->pgconn == pgconn) break;
+  }
+  if(!state && create) {
+    state = (msPostGISConnState*) msSmallCalloc(1, sizeof(msPostGISConnState));
+    state->pgconn = pgconn;
+    state->next = conn_states;
+    conn_states = state;
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+
+  return state;
+}
+
+static void msPostGISReleaseConnState(PGconn *pgconn, int force)
+{
+  msPostGISConnState **prev, *state;
+
+  msAcquireLock(TLOCK_POSTGIS);
+  for(prev = &conn_states; *prev; prev = &((*prev)->next)) {
+    state = *prev;
+    if(state->pgconn == pgconn) {
+      if(force || (state->numcursors == 0 && state->prefetcher == NULL)) {
+        *prev = state->next;
+        free(state);
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+}
+
+/*
+** msPostGISFinishPrefetch()
+**
+** Collects the result of a FETCH still in flight on the connection into
+** the nextresult of the layer that sent it, so the connection can run
+** another command.
+*/
+static void msPostGISFinishPrefetch(PGconn *pgconn)
+{
+  msPostGISConnState *state = msPostGISGetConnState(pgconn, MS_FALSE);
+  PGresult *pgresult;
+
+  if(!state || !state->prefetcher)
+    return;
+
+  while((pgresult = PQgetResult(pgconn)) != NULL) {
+    if(state->prefetcher->nextresult)
+      PQclear(pgresult);
+    else
+      state->prefetcher->nextresult = pgresult;
+  }
+  state->prefetcher = NULL;
+}
+
+/*
+** msPostGISExecParams()
+**
+** PQexecParams() for a connection that may have a FETCH in flight.
+*/
+static PGresult *msPostGISExecParams(PGconn *pgconn, const char *sql, int nparams, const char * const *values, int resultformat)
+{
+  msPostGISFinishPrefetch(pgconn);
+  return PQexecParams(pgconn, sql, nparams, NULL, values, NULL, NULL, resultformat);
+}
+
+/*
+** msPostGISFetchBatch()
+**
+** Replaces layerinfo->pgresult with the next batch of rows of the cursor
+** and sends the FETCH for the batch after it.
+*/
+static int msPostGISFetchBatch(layerObj *layer)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  msPostGISConnState *state;
+  PGresult *pgresult;
+  char sql[128];
+
+  snprintf(sql, sizeof(sql), "fetch forward %d from %s", layerinfo->fetchsize, layerinfo->cursor);
+
+  msPostGISFinishPrefetch(layerinfo->pgconn);
+  if(layerinfo->nextresult) {
+    pgresult = layerinfo->nextresult;
+    layerinfo->nextresult = NULL;
+  } else {
+    pgresult = PQexecParams(layerinfo->pgconn, sql, 0, NULL, NULL, NULL, NULL, RESULTSET_TYPE);
+  }
+
+  if (!pgresult || PQresultStatus(pgresult) != PGRES_TUPLES_OK) {
+    msDebug("msPostGISFetchBatch(): Error (%s) fetching from %s\n", PQerrorMessage(layerinfo->pgconn), layerinfo->cursor);
+    msSetError(MS_QUERYERR, "Error fetching rows. Check server logs","msPostGISFetchBatch()");
+    if (pgresult) {
+      PQclear(pgresult);
+    }
+    layerinfo->cursordone = MS_TRUE;
+    return MS_FAILURE;
+  }
+
+  if ( layer->debug > 1 ) {
+    msDebug("msPostGISFetchBatch got %d records from %s.\n", PQntuples(pgresult), layerinfo->cursor);
+  }
+
+  if(layerinfo->pgresult) {
+    layerinfo->rowoffset += PQntuples(layerinfo->pgresult);
+    PQclear(layerinfo->pgresult);
+  }
+  layerinfo->pgresult = pgresult;
+  layerinfo->rownum = 0;
+
+  if(PQntuples(pgresult) < layerinfo->fetchsize) {
+    layerinfo->cursordone = MS_TRUE;
+  } else if(PQsendQueryParams(layerinfo->pgconn, sql, 0, NULL, NULL, NULL, NULL, RESULTSET_TYPE)) {
+    state = msPostGISGetConnState(layerinfo->pgconn, MS_TRUE);
+    state->prefetcher = layerinfo;
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** msPostGISCloseCursor()
+**
+** Closes the cursor streamed by the layer, if any, and ends the
+** transaction opened for it once no cursor is left on the connection.
+*/
+static void msPostGISCloseCursor(msPostGISLayerInfo *layerinfo)
+{
+  msPostGISConnState *state;
+  PGresult *pgresult;
+  char sql[64];
+
+  if(!layerinfo->cursor)
+    return;
+
+  msPostGISFinishPrefetch(layerinfo->pgconn);
+  if(layerinfo->nextresult) {
+    PQclear(layerinfo->nextresult);
+    layerinfo->nextresult = NULL;
+  }
+
+  if(PQtransactionStatus(layerinfo->pgconn) == PQTRANS_INTRANS) {
+    snprintf(sql, sizeof(sql), "close %s", layerinfo->cursor);
+    pgresult = PQexec(layerinfo->pgconn, sql);
+    if(pgresult) PQclear(pgresult);
+  }
+
+  state = msPostGISGetConnState(layerinfo->pgconn, MS_FALSE);
+  if(state && --state->numcursors <= 0) {
+    state->numcursors = 0;
+    if(state->ownstransaction) {
+      pgresult = PQexec(layerinfo->pgconn, PQtransactionStatus(layerinfo->pgconn) == PQTRANS_INTRANS ? "commit" : "rollback");
+      if(pgresult) PQclear(pgresult);
+      state->ownstransaction = MS_FALSE;
+    }
+    msPostGISReleaseConnState(layerinfo->pgconn, MS_FALSE);
+  }
+
+  free(layerinfo->cursor);
+  layerinfo->cursor = NULL;
+  layerinfo->cursordone = MS_TRUE;
+}
+
+/*
+** msPostGISOpenCursor()
+**
+** Declares a cursor for strSQL and fetches its first batch of rows into
+** layerinfo->pgresult. A transaction is started if the connection isn't
+** in one already.
+*/
+static int msPostGISOpenCursor(layerObj *layer, const char *strSQL, int num_bind_values, const char **bind_values)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  msPostGISConnState *state;
+  PGresult *pgresult;
+  char *sql;
+
+  msPostGISFinishPrefetch(layerinfo->pgconn);
+  state = msPostGISGetConnState(layerinfo->pgconn, MS_TRUE);
+
+  if(state->numcursors == 0 && PQtransactionStatus(layerinfo->pgconn) == PQTRANS_IDLE) {
+    pgresult = PQexec(layerinfo->pgconn, "begin");
+    if (!pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK) {
+      msDebug("msPostGISOpenCursor(): Error (%s) starting a transaction.\n", PQerrorMessage(layerinfo->pgconn));
+      msSetError(MS_QUERYERR, "Error starting a transaction. Check server logs","msPostGISOpenCursor()");
+      if (pgresult) PQclear(pgresult);
+      msPostGISReleaseConnState(layerinfo->pgconn, MS_FALSE);
+      return MS_FAILURE;
+    }
+    PQclear(pgresult);
+    state->ownstransaction = MS_TRUE;
+  }
+
+  layerinfo->cursor = (char*) msSmallMalloc(32);
+  snprintf(layerinfo->cursor, 32, "mscursor%d", ++state->cursorid);
+
+  sql = (char*) msSmallMalloc(strlen(strSQL) + 64);
+  sprintf(sql, "declare %s no scroll cursor for %s", layerinfo->cursor, strSQL);
+  pgresult = PQexecParams(layerinfo->pgconn, sql, num_bind_values, NULL, bind_values, NULL, NULL, 0);
+  free(sql);
+
+  state->numcursors++;
+
+  if (!pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK) {
+    msDebug("msPostGISOpenCursor(): Error (%s) declaring cursor for query: %s\n", PQerrorMessage(layerinfo->pgconn), strSQL);
+    msSetError(MS_QUERYERR, "Error executing query. Check server logs","msPostGISOpenCursor()");
+    if (pgresult) PQclear(pgresult);
+    msPostGISCloseCursor(layerinfo);
+    return MS_FAILURE;
+  }
+  PQclear(pgresult);
+
+  layerinfo->cursordone = MS_FALSE;
+  layerinfo->rowoffset = 0;
+  if(layerinfo->pgresult) {
+    PQclear(layerinfo->pgresult);
+    layerinfo->pgresult = NULL;
+  }
+
+  return msPostGISFetchBatch(layer);
+}
+
 /*
 ** msPostGISCloseConnection()
 **
@@ -99,6 +353,7 @@
 */
 void msPostGISCloseConnection(void *pgconn)
 {
+  msPostGISReleaseConnState((PGconn*)pgconn, MS_TRUE);
   PQfinish((PGconn*)pgconn);
 }
 
@@ -119,6 +374,13 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->rownum = 0;
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
+  layerinfo->fetchsize = 0;
+  layerinfo->cursor = NULL;
+  layerinfo->cursordone = MS_TRUE;
+  layerinfo->rowoffset = 0;
+  layerinfo->nextresult = NULL;
+  layerinfo->wkbbuffer = NULL;
+  layerinfo->wkbbuffersize = 0;
 #ifdef USE_POINT_Z_M
   layerinfo->force2d = MS_FALSE;
 #else
@@ -139,6 +401,8 @@ void msPostGISFreeLayerInfo(layerObj *layer)
   if ( layerinfo->srid ) free(layerinfo->srid);
   if ( layerinfo->geomcolumn ) free(layerinfo->geomcolumn);
   if ( layerinfo->fromsource ) free(layerinfo->fromsource);
+  if ( layerinfo->wkbbuffer ) free(layerinfo->wkbbuffer);
+  if ( layerinfo->cursor ) msPostGISCloseCursor(layerinfo);
   if ( layerinfo->pgresult ) PQclear(layerinfo->pgresult);
   if ( layerinfo->pgconn ) msConnPoolRelease(layer, layerinfo->pgconn);
   free(layerinfo);
@@ -368,19 +632,50 @@ wkbReadPoint(wkbObj *w, int nZMFlag)
 ** point count, which is followed by that number of doubles * 2.
 ** Linestrings, circular strings, polygon rings, all show this
 ** form.
+**
+** The WKB is always in our endianess, so when its coordinates have the
+** layout of pointObj the whole run is copied at once, otherwise the
+** points are copied with a fixed stride. The point count is clamped to
+** what the WKB actually holds.
 */
 static void
 wkbReadLine(wkbObj *w, lineObj *line, int nZMFlag)
 {
   int i;
-  pointObj p;
   int npoints = wkbReadInt(w);
+  int ncoords = 2 + ((nZMFlag & HAS_Z) ? 1 : 0) + ((nZMFlag & HAS_M) ? 1 : 0);
+  size_t stride = ncoords * sizeof(double);
+  size_t available = (w->ptr < w->wkb + w->size) ? (size_t)(w->wkb + w->size - w->ptr) : 0;
+  const char *ptr = w->ptr;
+  pointObj *p;
+
+  if ( npoints < 0 )
+    npoints = 0;
+  if ( (size_t)npoints > available / stride )
+    npoints = available / stride;
 
   line->numpoints = npoints;
   line->point = msSmallMalloc(npoints * sizeof(pointObj));
-  for ( i = 0; i < npoints; i++ ) {
-    wkbReadPointP(w, &p, nZMFlag);
-    line->point[i] = p;
+  w->ptr += npoints * stride;
+
+  if ( stride == sizeof(pointObj) ) {
+    memcpy(line->point, ptr, npoints * stride);
+    return;
+  }
+
+  for ( i = 0, p = line->point; i < npoints; i++, p++, ptr += stride ) {
+    memcpy(&(p->x), ptr, sizeof(double));
+    memcpy(&(p->y), ptr + sizeof(double), sizeof(double));
+#ifdef USE_POINT_Z_M
+    p->z = p->m = 0.0;
+    if ( nZMFlag & HAS_Z ) {
+      memcpy(&(p->z), ptr + 2 * sizeof(double), sizeof(double));
+      if ( nZMFlag & HAS_M )
+        memcpy(&(p->m), ptr + 3 * sizeof(double), sizeof(double));
+    } else if ( nZMFlag & HAS_M ) {
+      memcpy(&(p->m), ptr + 2 * sizeof(double), sizeof(double));
+    }
+#endif
   }
 }
 
@@ -480,7 +775,7 @@ wkbConvPolygonToShape(wkbObj *w, shapeObj *shape)
 {
   int type;
   int i, nrings;
-  lineObj line;
+  lineObj *lines;
   int nZMFlag;
 
   /*endian = */wkbReadChar(w);
@@ -488,13 +783,19 @@ wkbConvPolygonToShape(wkbObj *w, shapeObj *shape)
 
   if( type != WKB_POLYGON ) return MS_FAILURE;
 
-  /* How many rings? */
+  /* How many rings? Each takes at least its point count. */
   nrings = wkbReadInt(w);
+  if( nrings <= 0 ) return MS_SUCCESS;
+  if( w->ptr + (size_t)nrings * sizeof(int) > w->wkb + w->size ) return MS_FAILURE;
+
+  /* Grow the line array once and read each ring straight into it */
+  lines = (lineObj*) realloc(shape->line, (shape->numlines + nrings) * sizeof(lineObj));
+  MS_CHECK_ALLOC(lines, (shape->numlines + nrings) * sizeof(lineObj), MS_FAILURE);
+  shape->line = lines;
 
-  /* Add each ring to the shape */
   for( i = 0; i < nrings; i++ ) {
-    wkbReadLine(w,&line, nZMFlag);
-    msAddLineDirectly(shape, &line);
+    wkbReadLine(w, &(shape->line[shape->numlines]), nZMFlag);
+    shape->numlines++;
   }
 
   return MS_SUCCESS;
@@ -1098,7 +1399,7 @@ msPostGISRetrieveVersion(PGconn *pgconn)
     return MS_FAILURE;
   }
 
-  pgresult = PQexecParams(pgconn, sql,0, NULL, NULL, NULL, NULL, 0);
+  pgresult = msPostGISExecParams(pgconn, sql, 0, NULL, 0);
 
   if ( !pgresult || PQresultStatus(pgresult) != PGRES_TUPLES_OK) {
     msDebug("Error executing SQL: (%s) in msPostGISRetrieveVersion()", sql);
@@ -1240,7 +1541,7 @@ msPostGISRetrievePK(layerObj *layer)
     return MS_FAILURE;
   }
 
-  pgresult = PQexecParams(layerinfo->pgconn, sql, 0, NULL, NULL, NULL, NULL, 0);
+  pgresult = msPostGISExecParams(layerinfo->pgconn, sql, 0, NULL, 0);
   if ( !pgresult || PQresultStatus(pgresult) != PGRES_TUPLES_OK) {
     static char *tmp1 = "Error executing SQL: ";
     char *tmp2 = NULL;
@@ -2261,12 +2562,27 @@ char *msPostGISBuildSQL(layerObj *layer, rectObj *rect, long *uid, rectObj *rect
   return strSQL;
 }
 
-#define wkbstaticsize 4096
+/*
+** msPostGISGetWKBBuffer()
+**
+** Returns the layer's scratch buffer for decoding WKB, grown to at least
+** size bytes. It is reused from one feature to the next.
+*/
+static unsigned char *msPostGISGetWKBBuffer(msPostGISLayerInfo *layerinfo, size_t size)
+{
+  if( size > layerinfo->wkbbuffersize ) {
+    size_t newsize = MS_MAX(size, 2 * layerinfo->wkbbuffersize);
+    free(layerinfo->wkbbuffer);
+    layerinfo->wkbbuffer = (unsigned char*) msSmallMalloc(newsize);
+    layerinfo->wkbbuffersize = newsize;
+  }
+  return layerinfo->wkbbuffer;
+}
+
 int msPostGISReadShape(layerObj *layer, shapeObj *shape)
 {
 
   char *wkbstr = NULL;
-  unsigned char wkbstatic[wkbstaticsize];
   unsigned char *wkb = NULL;
   wkbObj w;
   msPostGISLayerInfo *layerinfo = NULL;
@@ -2289,25 +2605,27 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
     return MS_FAILURE;
   }
 
-  if(wkbstrlen > wkbstaticsize) {
-    wkb = calloc(wkbstrlen, sizeof(char));
-  } else {
-    wkb = wkbstatic;
-  }
 #if TRANSFER_ENCODING == 64
+  wkb = msPostGISGetWKBBuffer(layerinfo, wkbstrlen);
   result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
-  w.size = (wkbstrlen - 1)/2;
+  w.size = result;
 #elif TRANSFER_ENCODING == 256
+  /* Raw WKB is read in place, unless the pre-2.0 SRID handling below has to patch it. */
   result = 1;
-  memcpy(wkb, wkbstr, wkbstrlen);
+  if( layerinfo->version >= 20000 || layerinfo->force2d == MS_TRUE ) {
+    wkb = (unsigned char*) wkbstr;
+  } else {
+    wkb = msPostGISGetWKBBuffer(layerinfo, wkbstrlen);
+    memcpy(wkb, wkbstr, wkbstrlen);
+  }
   w.size = wkbstrlen;
 #else
+  wkb = msPostGISGetWKBBuffer(layerinfo, wkbstrlen);
   result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
-  w.size = (wkbstrlen - 1)/2;
+  w.size = result;
 #endif
 
   if( ! result ) {
-    if(wkb!=wkbstatic) free(wkb);
     return MS_FAILURE;
   }
 
@@ -2332,6 +2650,7 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
             w.ptr[8] = w.ptr[4] & ~(0x20);
             w.ptr[4] = 1;
             w.ptr += 4;
+            w.wkb = w.ptr;
             w.size -= 4;
         }
     }
@@ -2372,9 +2691,6 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
       break;
   }
 
-  /* All done with WKB geometry, free it! */
-  if(wkb!=wkbstatic) free(wkb);
-
   if (result != MS_FAILURE) {
     int t;
     long uid;
@@ -2411,10 +2727,10 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
     }
     if( layer->debug > 4 ) {
       msDebug("msPostGISReadShape: Setting shape->index = %ld\n", uid);
-      msDebug("msPostGISReadShape: Setting shape->resultindex = %ld\n", layerinfo->rownum);
+      msDebug("msPostGISReadShape: Setting shape->resultindex = %ld\n", layerinfo->rowoffset + layerinfo->rownum);
     }
     shape->index = uid;
-    shape->resultindex = layerinfo->rownum;
+    shape->resultindex = layerinfo->rowoffset + layerinfo->rownum;
 
     if( layer->debug > 2 ) {
       msDebug("msPostGISReadShape: [index] %ld\n",  shape->index);
@@ -2450,6 +2766,7 @@ int msPostGISLayerOpen(layerObj *layer)
   msPostGISLayerInfo  *layerinfo;
   int order_test = 1;
   const char* force2d_processing;
+  const char* fetchsize_processing;
 
   assert(layer != NULL);
 
@@ -2580,6 +2897,15 @@ int msPostGISLayerOpen(layerObj *layer)
   if (layer->debug)
     msDebug("msPostGISLayerOpen: Forcing 2D geometries: %s.\n", (layerinfo->force2d)?"yes":"no");
 
+  fetchsize_processing = msLayerGetProcessingKey( layer, "FETCH_SIZE" );
+  if(fetchsize_processing) {
+    layerinfo->fetchsize = atoi(fetchsize_processing);
+    if(layerinfo->fetchsize < 0)
+      layerinfo->fetchsize = 0;
+    if (layer->debug)
+      msDebug("msPostGISLayerOpen: Streaming rows in batches of %d.\n", layerinfo->fetchsize);
+  }
+
   /* Save the layerinfo in the layerObj. */
   layer->layerinfo = (void*)layerinfo;
 
@@ -2771,10 +3097,37 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 
   // fprintf(stderr, "SQL: %s\n", strSQL);
 
+  /* Close any cursor left from the previous request. */
+  msPostGISCloseCursor(layerinfo);
+  layerinfo->rowoffset = 0;
+
+  /*
+  ** Stream the rows through a cursor when asked to. Queries keep the
+  ** whole result as they come back for shapes by result index.
+  */
+  if(layerinfo->fetchsize > 0 && !isQuery) {
+    int status = msPostGISOpenCursor(layer, strSQL, num_bind_values, layer_bind_values);
+
+    free(bind_key);
+    free(layer_bind_values);
+
+    if(layerinfo->sql) free(layerinfo->sql);
+    layerinfo->sql = strSQL;
+
+    if(status != MS_SUCCESS) {
+      if(layerinfo->pgresult) PQclear(layerinfo->pgresult);
+      layerinfo->pgresult = NULL;
+      return MS_FAILURE;
+    }
+
+    layerinfo->rownum = 0;
+    return MS_SUCCESS;
+  }
+
   if(num_bind_values > 0) {
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, layer_bind_values, NULL, NULL, RESULTSET_TYPE);
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQL, num_bind_values, layer_bind_values, RESULTSET_TYPE);
   } else {
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, RESULTSET_TYPE);
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQL, 0, NULL, RESULTSET_TYPE);
   }
 
   /* free bind values */
@@ -2844,7 +3197,17 @@ int msPostGISLayerNextShape(layerObj *layer, shapeObj *shape)
   ** Roll through pgresult until we hit non-null shape (usually right away).
   */
   while (shape->type == MS_SHAPE_NULL) {
-    if (layerinfo->rownum < PQntuples(layerinfo->pgresult)) {
+    if (layerinfo->pgresult && layerinfo->rownum >= PQntuples(layerinfo->pgresult) &&
+        layerinfo->cursor && !layerinfo->cursordone) {
+      /* End of this batch, move on to the next one. */
+      if (msPostGISFetchBatch(layer) != MS_SUCCESS)
+        return MS_FAILURE;
+    }
+    if (layerinfo->pgresult && layerinfo->rownum < PQntuples(layerinfo->pgresult)) {
+      /* Let libpq read the prefetched batch as it arrives. */
+      if (layerinfo->cursor && !layerinfo->cursordone && (layerinfo->rownum & 255) == 0)
+        PQconsumeInput(layerinfo->pgconn);
+
       /* Retrieve this shape, cursor access mode. */
       msPostGISReadShape(layer, shape);
       if( shape->type != MS_SHAPE_NULL ) {
@@ -2969,9 +3332,9 @@ int msPostGISLayerGetShapeCount(layerObj *layer, rectObj rect, projectionObj *re
   }
 
   if(num_bind_values > 0) {
-    pgresult = PQexecParams(layerinfo->pgconn, strSQLCount, num_bind_values, NULL, layer_bind_values, NULL, NULL, 1);
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQLCount, num_bind_values, layer_bind_values, 1);
   } else {
-    pgresult = PQexecParams(layerinfo->pgconn, strSQLCount,0, NULL, NULL, NULL, NULL, 0);
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQLCount, 0, NULL, 0);
   }
 
   /* free bind values */
@@ -3062,15 +3425,15 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     }
 
     /* Check the validity of the requested record number. */
-    if( resultindex >= PQntuples(pgresult) ) {
-      msDebug("msPostGISLayerGetShape got request for (%d) but only has %d tuples.\n", resultindex, PQntuples(pgresult));
+    if( resultindex < layerinfo->rowoffset || resultindex - layerinfo->rowoffset >= PQntuples(pgresult) ) {
+      msDebug("msPostGISLayerGetShape got request for (%d) but only has tuples %ld to %ld.\n", resultindex, layerinfo->rowoffset, layerinfo->rowoffset + PQntuples(pgresult) - 1);
       msSetError( MS_MISCERR,
                   "Got request larger than result set.",
                   "msPostGISLayerGetShape()");
       return MS_FAILURE;
     }
 
-    layerinfo->rownum = resultindex; /* Only return one result. */
+    layerinfo->rownum = resultindex - layerinfo->rowoffset; /* Only return one result. */
 
     /* We don't know the shape type until we read the geometry. */
     shape->type = MS_SHAPE_NULL;
@@ -3105,7 +3468,10 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
       msDebug("msPostGISLayerGetShape query: %s\n", strSQL);
     }
 
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, RESULTSET_TYPE);
+    /* This replaces the streamed result, if any. */
+    msPostGISCloseCursor(layerinfo);
+
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQL, 0, NULL, RESULTSET_TYPE);
 
     /* Something went wrong. */
     if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
@@ -3129,6 +3495,7 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     layerinfo->sql = strSQL;
 
     layerinfo->rownum = 0; /* Only return one result. */
+    layerinfo->rowoffset = 0;
 
     /* We don't know the shape type until we read the geometry. */
     shape->type = MS_SHAPE_NULL;
@@ -3333,7 +3700,7 @@ int msPostGISLayerGetItems(layerObj *layer)
     msDebug("msPostGISLayerGetItems executing SQL: %s\n", sql);
   }
 
-  pgresult = PQexecParams(layerinfo->pgconn, sql,0, NULL, NULL, NULL, NULL, 0);
+  pgresult = msPostGISExecParams(layerinfo->pgconn, sql, 0, NULL, 0);
 
   if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
     msDebug("msPostGISLayerGetItems(): Error (%s) executing SQL: %s\n", PQerrorMessage(layerinfo->pgconn), sql);
@@ -3475,7 +3842,7 @@ int msPostGISLayerGetExtent(layerObj *layer, rectObj *extent)
   }
 
   /* executing the query */
-  pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
+  pgresult = msPostGISExecParams(layerinfo->pgconn, strSQL, 0, NULL, 0);
 
   msFree(strSQL);
 
@@ -3607,7 +3974,7 @@ int msPostGISLayerGetNumFeatures(layerObj *layer)
     }
 
     /* executing the query */
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL, 0, NULL, NULL, NULL, NULL, 0);
+    pgresult = msPostGISExecParams(layerinfo->pgconn, strSQL, 0, NULL, 0);
 
     msFree(strSQL);
 
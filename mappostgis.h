@@ -65,6 +65,13 @@ typedef struct {
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
   int         force2d;     /* Pass geometry through ST_Force2D */
+  int         fetchsize;   /* Rows per FETCH when streaming through a cursor, 0 reads the whole result at once */
+  char        *cursor;     /* Name of the cursor being streamed, NULL if none */
+  int         cursordone;  /* All rows of the cursor have been fetched */
+  long        rowoffset;   /* Position of the first row of pgresult in the whole result */
+  PGresult    *nextresult; /* Prefetched batch, transferred while the current one is drawn */
+  unsigned char *wkbbuffer; /* Scratch buffer for decoding WKB, reused across features */
+  size_t      wkbbuffersize;
 }
 msPostGISLayerInfo;
 
@@ -42,6 +42,9 @@ static int msTestNeedWrap( pointObj pt1, pointObj pt2, pointObj pt2_geo,
                            projectionObj *src_proj,
                            projectionObj *dst_proj );
 #endif
+#ifdef USE_PROJ_API_6
+static PJ *msProjectGetTransformation(projectionObj *in, projectionObj *out);
+#endif
 
 
 /************************************************************************/
@@ -98,30 +101,49 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
   /*      output coordinate system, then we will use pj_transform.        */
   /* -------------------------------------------------------------------- */
   else if( in && in->proj && out && out->proj ) {
-    double  z = 0.0;
+#ifdef USE_PROJ_API_6
+    PJ *pj = msProjectGetTransformation(in, out);
+
+    if( pj ) {
+      PJ_COORD c;
+
+      c.v[0] = point->x;
+      c.v[1] = point->y;
+      c.v[2] = 0.0;
+      c.v[3] = 0.0;
+      c = proj_trans(pj, PJ_FWD, c);
+      if( c.v[0] == HUGE_VAL || c.v[1] == HUGE_VAL )
+        return MS_FAILURE;
+      point->x = c.v[0];
+      point->y = c.v[1];
+    } else
+#endif
+    {
+      double  z = 0.0;
 
-    if( pj_is_latlong(in->proj) ) {
-      point->x *= DEG_TO_RAD;
-      point->y *= DEG_TO_RAD;
-    }
+      if( pj_is_latlong(in->proj) ) {
+        point->x *= DEG_TO_RAD;
+        point->y *= DEG_TO_RAD;
+      }
 
 #if PJ_VERSION < 480
-    msAcquireLock( TLOCK_PROJ );
+      msAcquireLock( TLOCK_PROJ );
 #endif
-    error = pj_transform( in->proj, out->proj, 1, 0,
-                          &(point->x), &(point->y), &z );
+      error = pj_transform( in->proj, out->proj, 1, 0,
+                            &(point->x), &(point->y), &z );
 #if PJ_VERSION < 480
-    msReleaseLock( TLOCK_PROJ );
+      msReleaseLock( TLOCK_PROJ );
 #endif
 
-    if( error || point->x == HUGE_VAL || point->y == HUGE_VAL ) {
-//      msSetError(MS_PROJERR,"proj says: %s","msProjectPoint()",pj_strerrno(error));
-      return MS_FAILURE;
-    }
+      if( error || point->x == HUGE_VAL || point->y == HUGE_VAL ) {
+//        msSetError(MS_PROJERR,"proj says: %s","msProjectPoint()",pj_strerrno(error));
+        return MS_FAILURE;
+      }
 
-    if( pj_is_latlong(out->proj) ) {
-      point->x *= RAD_TO_DEG;
-      point->y *= RAD_TO_DEG;
+      if( pj_is_latlong(out->proj) ) {
+        point->x *= RAD_TO_DEG;
+        point->y *= RAD_TO_DEG;
+      }
     }
   }
 
@@ -184,6 +206,64 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
 #endif
 }
 
+#ifdef USE_PROJ_API_6
+/************************************************************************/
+/*                        msProjectLinePoints()                         */
+/*                                                                      */
+/*      Reprojects all the points of line to projected with a single    */
+/*      PROJ call, as msProjectPoint() would have. Failed points are    */
+/*      set to HUGE_VAL. Returns MS_FAILURE if the points have to go    */
+/*      through msProjectPoint() instead.                               */
+/************************************************************************/
+static int msProjectLinePoints(projectionObj *in, projectionObj *out,
+                               lineObj *line, pointObj *projected)
+{
+  int i;
+
+  if( line->numpoints == 0 || !in || !in->proj || !out || !out->proj )
+    return MS_FAILURE;
+  if( in->numargs == 1 && out->numargs == 1
+      && strcmp(in->args[0],out->args[0]) == 0 )
+    return MS_FAILURE;
+
+  memcpy(projected, line->point, sizeof(pointObj) * line->numpoints);
+
+  if( in->gt.need_geotransform ) {
+    for( i = 0; i < line->numpoints; i++ ) {
+      double x_out = in->gt.geotransform[0]
+                     + in->gt.geotransform[1] * projected[i].x
+                     + in->gt.geotransform[2] * projected[i].y;
+      projected[i].y = in->gt.geotransform[3]
+                       + in->gt.geotransform[4] * projected[i].x
+                       + in->gt.geotransform[5] * projected[i].y;
+      projected[i].x = x_out;
+    }
+  }
+
+  if( msProjectTransformPoints(in, out, line->numpoints,
+                               &(projected[0].x), &(projected[0].y),
+                               sizeof(pointObj)) != MS_SUCCESS )
+    return MS_FAILURE;
+
+  if( out->gt.need_geotransform ) {
+    for( i = 0; i < line->numpoints; i++ ) {
+      double x_out;
+      if( projected[i].x == HUGE_VAL || projected[i].y == HUGE_VAL )
+        continue;
+      x_out = out->gt.invgeotransform[0]
+              + out->gt.invgeotransform[1] * projected[i].x
+              + out->gt.invgeotransform[2] * projected[i].y;
+      projected[i].y = out->gt.invgeotransform[3]
+                       + out->gt.invgeotransform[4] * projected[i].x
+                       + out->gt.invgeotransform[5] * projected[i].y;
+      projected[i].x = x_out;
+    }
+  }
+
+  return MS_SUCCESS;
+}
+#endif /* def USE_PROJ_API_6 */
+
 /************************************************************************/
 /*                         msProjectGrowRect()                          */
 /************************************************************************/
@@ -307,6 +387,7 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
   int numpoints_in = line->numpoints;
   int line_alloc = numpoints_in;
   int wrap_test;
+  pointObj *projected = NULL;
 
 #ifdef USE_PROJ_FASTPATHS
 #define MAXEXTENT 20037508.34
@@ -348,6 +429,16 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
   wrap_test = out != NULL && out->proj != NULL && pj_is_latlong(out->proj)
               && !pj_is_latlong(in->proj);
 
+#ifdef USE_PROJ_API_6
+  /* reproject the whole line at once, the horizon logic below still */
+  /* goes through msProjectPoint() for the few points it looks for.  */
+  projected = (pointObj*) msSmallMalloc(sizeof(pointObj) * MS_MAX(numpoints_in,1));
+  if( msProjectLinePoints( in, out, line, projected ) != MS_SUCCESS ) {
+    free(projected);
+    projected = NULL;
+  }
+#endif
+
   line->numpoints = 0;
 
   memset( &lastPoint, 0, sizeof(lastPoint) );
@@ -359,7 +450,11 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
     int ms_err;
     wrkPoint = thisPoint = line->point[i];
 
-    ms_err = msProjectPoint(in, out, &wrkPoint );
+    if( projected ) {
+      wrkPoint = projected[i];
+      ms_err = (wrkPoint.x == HUGE_VAL || wrkPoint.y == HUGE_VAL) ? MS_FAILURE : MS_SUCCESS;
+    } else
+      ms_err = msProjectPoint(in, out, &wrkPoint );
 
     /* -------------------------------------------------------------------- */
     /*      Apply wrap logic.                                               */
@@ -495,6 +590,7 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
     msAddPointToLine( line_out, &sFirstPoint );
   }
 
+  free(projected);
   return(MS_SUCCESS);
 }
 #endif
@@ -569,6 +665,232 @@ int msProjectShape(projectionObj *in, projectionObj *out, shapeObj *shape)
 #endif
 }
 
+/************************************************************************/
+/*                      msProjectCreateApproxGrid()                     */
+/*                                                                      */
+/*      Projects the nodes of a grid laid over extent (in the source    */
+/*      projection) so that msProjectShapeApprox() can reproject        */
+/*      vertices by bilinear interpolation, the same way                */
+/*      msApproxTransformer() does for rasters. The middle of every     */
+/*      cell and of its edges is projected exactly as well: cells       */
+/*      where interpolating them is off by more than max_error (in      */
+/*      output units) are flagged so that their vertices are projected  */
+/*      exactly. Returns NULL if the grid would not help.               */
+/************************************************************************/
+
+#define MS_PROJ_APPROX_GRID_SIZE 32
+
+#ifdef USE_PROJ
+/* exact projection of (x,y), HUGE_VAL if it fails */
+static pointObj msProjectApproxNode(projectionObj *in, projectionObj *out, double x, double y)
+{
+  pointObj p;
+
+  p.x = x;
+  p.y = y;
+#ifdef USE_POINT_Z_M
+  p.z = p.m = 0;
+#endif
+  if( msProjectPoint(in, out, &p) != MS_SUCCESS
+      || p.x == HUGE_VAL || p.y == HUGE_VAL ) {
+    p.x = p.y = HUGE_VAL;
+  }
+  return p;
+}
+
+/* distance between the exact projection of the middle of a and b and the */
+/* average of their projections */
+static double msProjectApproxError(projectionObj *in, projectionObj *out,
+                                   double x, double y, const pointObj *a, const pointObj *b)
+{
+  pointObj p;
+
+  if( a->x == HUGE_VAL || b->x == HUGE_VAL )
+    return HUGE_VAL;
+  p = msProjectApproxNode(in, out, x, y);
+  if( p.x == HUGE_VAL )
+    return HUGE_VAL;
+  return MS_MAX(fabs(p.x - (a->x + b->x) / 2), fabs(p.y - (a->y + b->y) / 2));
+}
+#endif
+
+projApproxGridObj *msProjectCreateApproxGrid(projectionObj *in, projectionObj *out,
+    rectObj *extent, double max_error)
+{
+#ifdef USE_PROJ
+  projApproxGridObj *grid;
+  projectionPairObj pair;
+  pointObj *nodes, center;
+  double *hedges, *vedges, err;
+  int nx = MS_PROJ_APPROX_GRID_SIZE, ny = MS_PROJ_APPROX_GRID_SIZE;
+  int ix, iy, n;
+
+  if( max_error <= 0 || extent->maxx <= extent->minx || extent->maxy <= extent->miny )
+    return NULL;
+
+#ifdef USE_PROJ_FASTPATHS
+  if( (in->wellknownprojection == wkp_lonlat && out->wellknownprojection == wkp_gmerc) ||
+      (in->wellknownprojection == wkp_gmerc && out->wellknownprojection == wkp_lonlat) )
+    return NULL; /* as fast as interpolating */
+#endif
+
+  /* the dateline and horizon logic of msProjectShapeLine() is needed */
+  msGetProjectionPair(in, out, &pair);
+  if( !pair.differ || pair.need_wrap )
+    return NULL;
+
+  grid = (projApproxGridObj*) msSmallCalloc(1, sizeof(projApproxGridObj));
+  grid->extent = *extent;
+  grid->nx = nx;
+  grid->ny = ny;
+  grid->dx = (extent->maxx - extent->minx) / nx;
+  grid->dy = (extent->maxy - extent->miny) / ny;
+  grid->nodes = nodes = (pointObj*) msSmallMalloc(sizeof(pointObj) * (nx+1) * (ny+1));
+  grid->exact = (unsigned char*) msSmallMalloc(nx * ny);
+
+  for( iy = 0; iy <= ny; iy++ )
+    for( ix = 0; ix <= nx; ix++ )
+      nodes[iy*(nx+1)+ix] = msProjectApproxNode(in, out, extent->minx + ix * grid->dx,
+                                                extent->miny + iy * grid->dy);
+
+  /* errors at the middle of the edges, shared by neighbouring cells */
+  hedges = (double*) msSmallMalloc(sizeof(double) * nx * (ny+1));
+  vedges = (double*) msSmallMalloc(sizeof(double) * (nx+1) * ny);
+  for( iy = 0; iy <= ny; iy++ ) {
+    for( ix = 0; ix <= nx; ix++ ) {
+      n = iy*(nx+1)+ix;
+      if( ix < nx )
+        hedges[iy*nx+ix] = msProjectApproxError(in, out, extent->minx + (ix + 0.5) * grid->dx,
+                                                extent->miny + iy * grid->dy, nodes+n, nodes+n+1);
+      if( iy < ny )
+        vedges[iy*(nx+1)+ix] = msProjectApproxError(in, out, extent->minx + ix * grid->dx,
+                                                    extent->miny + (iy + 0.5) * grid->dy, nodes+n, nodes+n+nx+1);
+    }
+  }
+
+  for( iy = 0; iy < ny; iy++ ) {
+    for( ix = 0; ix < nx; ix++ ) {
+      n = iy*(nx+1)+ix;
+      err = MS_MAX(MS_MAX(hedges[iy*nx+ix], hedges[(iy+1)*nx+ix]),
+                   MS_MAX(vedges[iy*(nx+1)+ix], vedges[iy*(nx+1)+ix+1]));
+      if( err <= max_error ) {
+        /* the middle of the cell, against the average of its corners, */
+        /* which are all valid if the edges are */
+        center = msProjectApproxNode(in, out, extent->minx + (ix + 0.5) * grid->dx,
+                                     extent->miny + (iy + 0.5) * grid->dy);
+        if( center.x == HUGE_VAL )
+          err = HUGE_VAL;
+        else
+          err = MS_MAX(fabs(center.x - (nodes[n].x + nodes[n+1].x + nodes[n+nx+1].x + nodes[n+nx+2].x) / 4),
+                       fabs(center.y - (nodes[n].y + nodes[n+1].y + nodes[n+nx+1].y + nodes[n+nx+2].y) / 4));
+      }
+      grid->exact[iy*nx+ix] = (err > max_error);
+      grid->numexact += grid->exact[iy*nx+ix];
+    }
+  }
+
+  free(hedges);
+  free(vedges);
+
+  if( grid->numexact == nx * ny ) {
+    msFreeApproxGrid(grid);
+    return NULL;
+  }
+  return grid;
+#else
+  return NULL;
+#endif
+}
+
+void msFreeApproxGrid(projApproxGridObj *grid)
+{
+  if( !grid ) return;
+  free(grid->nodes);
+  free(grid->exact);
+  free(grid);
+}
+
+/************************************************************************/
+/*                        msProjectShapeApprox()                        */
+/*                                                                      */
+/*      msProjectShape() interpolating the vertices that fall in the    */
+/*      accurate cells of a grid built by msProjectCreateApproxGrid()   */
+/*      for the same projections. The other vertices are projected      */
+/*      exactly, and lines with vertices that cannot be projected go    */
+/*      through msProjectShapeLine() as usual.                          */
+/************************************************************************/
+
+int msProjectShapeApprox(projApproxGridObj *grid, projectionObj *in, projectionObj *out, shapeObj *shape)
+{
+#ifdef USE_PROJ
+  int i, j, ix, iy, n, nx, failed, maxpoints = 0;
+  double fx, fy;
+  pointObj *projected, *p, *n00, *n10, *n01, *n11;
+
+  if( grid == NULL )
+    return msProjectShape(in, out, shape);
+
+  nx = grid->nx;
+  for( i = 0; i < shape->numlines; i++ )
+    maxpoints = MS_MAX(maxpoints, shape->line[i].numpoints);
+  projected = (pointObj*) msSmallMalloc(sizeof(pointObj) * MS_MAX(maxpoints,1));
+
+  for( i = shape->numlines-1; i >= 0; i-- ) {
+    failed = MS_FALSE;
+    for( j = 0; j < shape->line[i].numpoints && !failed; j++ ) {
+      p = &(projected[j]);
+      *p = shape->line[i].point[j];
+      fx = (p->x - grid->extent.minx) / grid->dx;
+      fy = (p->y - grid->extent.miny) / grid->dy;
+      ix = (int) floor(fx);
+      iy = (int) floor(fy);
+      if( ix == grid->nx && fx == ix ) ix--; /* on the right or top edge */
+      if( iy == grid->ny && fy == iy ) iy--;
+
+      if( ix < 0 || iy < 0 || ix >= grid->nx || iy >= grid->ny
+          || grid->exact[iy*nx+ix] ) {
+        if( msProjectPoint(in, out, p) != MS_SUCCESS
+            || p->x == HUGE_VAL || p->y == HUGE_VAL )
+          failed = MS_TRUE;
+        continue;
+      }
+
+      fx -= ix;
+      fy -= iy;
+      n = iy*(nx+1)+ix;
+      n00 = grid->nodes + n;
+      n10 = n00 + 1;
+      n01 = n00 + nx + 1;
+      n11 = n01 + 1;
+      p->x = (1-fy) * ((1-fx) * n00->x + fx * n10->x) + fy * ((1-fx) * n01->x + fx * n11->x);
+      p->y = (1-fy) * ((1-fx) * n00->y + fx * n10->y) + fy * ((1-fx) * n01->y + fx * n11->y);
+    }
+
+    if( !failed ) {
+      memcpy(shape->line[i].point, projected, sizeof(pointObj) * shape->line[i].numpoints);
+    } else if( shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON ) {
+      if( msProjectShapeLine( in, out, shape, i ) == MS_FAILURE )
+        msShapeDeleteLine( shape, i );
+    } else if( msProjectLine(in, out, shape->line+i ) == MS_FAILURE ) {
+      msShapeDeleteLine( shape, i );
+    }
+  }
+
+  free(projected);
+
+  if( shape->numlines == 0 ) {
+    msFreeShape( shape );
+    return MS_FAILURE;
+  } else {
+    msComputeBounds( shape );
+    return(MS_SUCCESS);
+  }
+#else
+  msSetError(MS_PROJERR, "Projection support is not available.", "msProjectShapeApprox()");
+  return(MS_FAILURE);
+#endif
+}
+
 /************************************************************************/
 /*                           msProjectLine()                            */
 /*                                                                      */
@@ -581,6 +903,16 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
 {
 #ifdef USE_PROJ
   int i, be_careful = 1;
+  pointObj *projected = NULL;
+
+#ifdef USE_PROJ_API_6
+  /* reproject all the points at once */
+  projected = (pointObj*) msSmallMalloc(sizeof(pointObj) * MS_MAX(line->numpoints,1));
+  if( msProjectLinePoints( in, out, line, projected ) != MS_SUCCESS ) {
+    free(projected);
+    projected = NULL;
+  }
+#endif
 
   if( be_careful )
     be_careful = out->proj != NULL && pj_is_latlong(out->proj)
@@ -600,7 +932,10 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
       ** Read comments before msTestNeedWrap() to better understand
       ** this dateline wrapping logic.
       */
-      msProjectPoint(in, out, &(line->point[i]));
+      if( projected )
+        line->point[i] = projected[i];
+      else
+        msProjectPoint(in, out, &(line->point[i]));
       if( i > 0 ) {
         dist = line->point[i].x - line->point[0].x;
         if( fabs(dist) > 180.0 ) {
@@ -616,6 +951,14 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
 
       }
     }
+  } else if( projected ) {
+    for(i=0; i<line->numpoints; i++) {
+      if( projected[i].x == HUGE_VAL || projected[i].y == HUGE_VAL ) {
+        free(projected);
+        return MS_FAILURE;
+      }
+      line->point[i] = projected[i];
+    }
   } else {
     for(i=0; i<line->numpoints; i++) {
       if( msProjectPoint(in, out, &(line->point[i])) == MS_FAILURE )
@@ -623,6 +966,7 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
     }
   }
 
+  free(projected);
   return(MS_SUCCESS);
 #else
   msSetError(MS_PROJERR, "Projection support is not available.", "msProjectLine()");
@@ -1001,13 +1345,21 @@ int msProjectRect(projectionObj *in, projectionObj *out, rectObj *rect)
   int bFreeInOver = MS_FALSE;
   int bFreeOutOver = MS_FALSE;
   projectionObj in_over,out_over,*inp,*outp;
-  double dfLonWrap = 0.0;
+  projectionPairObj pair;
+
+  if( in && out )
+    msGetProjectionPair(in, out, &pair);
+  else {
+    memset(&pair, 0, sizeof(pair));
+    if( in )
+      pair.has_lon_wrap = msProjectHasLonWrap(in, &(pair.lon_wrap));
+  }
 
 #if USE_PROJ
   /* Detect projecting from north polar stereographic to longlat */
   if( in && !in->gt.need_geotransform &&
       out && !out->gt.need_geotransform &&
-      !pj_is_latlong(in->proj) && pj_is_latlong(out->proj) )
+      pair.need_wrap )
   {
       pointObj p;
       p.x = 0.0;
@@ -1036,7 +1388,7 @@ int msProjectRect(projectionObj *in, projectionObj *out, rectObj *rect)
   }
 #endif
 
-  if(in && msProjectHasLonWrap(in, &dfLonWrap) && dfLonWrap == 180.0) {
+  if(in && pair.has_lon_wrap && pair.lon_wrap == 180.0) {
     inp = in;
     outp = out;
     if( rect->maxx > 180.0 ) {
@@ -1186,7 +1538,7 @@ static int msProjectionsDifferInternal( projectionObj *proj1, projectionObj *pro
   return MS_FALSE;
 }
 
-int msProjectionsDiffer( projectionObj *proj1, projectionObj *proj2 )
+static int msProjectionsDifferUncached( projectionObj *proj1, projectionObj *proj2 )
 {
 #ifdef USE_PROJ
     int ret;
@@ -1215,6 +1567,146 @@ int msProjectionsDiffer( projectionObj *proj1, projectionObj *proj2 )
 #endif
 }
 
+int msProjectionsDiffer( projectionObj *proj1, projectionObj *proj2 )
+{
+  projectionPairObj pair;
+
+  /* cheap enough to not be worth a cache lookup */
+  if( proj1->numargs == 0 || proj2->numargs == 0 )
+    return MS_FALSE;
+
+  msGetProjectionPair( proj1, proj2, &pair );
+  return pair.differ;
+}
+
+/************************************************************************/
+/*                         msGetProjectionPair()                        */
+/*                                                                      */
+/*      Process wide cache of the properties of the projection pairs   */
+/*      seen so far, keyed on their arguments. Normalizing the          */
+/*      definitions in msProjectionsDiffer() is costly, and maps        */
+/*      with many layers in many projections would otherwise repeat     */
+/*      it for every layer of every request. The transformations        */
+/*      themselves are not shared between threads, see                  */
+/*      msProjectGetTransformation().                                   */
+/************************************************************************/
+
+#define MS_PROJ_PAIR_CACHE_SIZE 64
+
+typedef struct {
+  char **in_args, **out_args;
+  int in_numargs, out_numargs;
+  int in_flags, out_flags;
+  projectionPairObj pair;
+} projPairCacheEntry;
+
+static projPairCacheEntry proj_pair_cache[MS_PROJ_PAIR_CACHE_SIZE];
+static int proj_pair_cache_size = 0;
+static int proj_pair_cache_next = 0;
+
+static int msProjectArgsEqual(char **args1, int numargs1, char **args2, int numargs2)
+{
+  int i;
+  if(numargs1 != numargs2)
+    return MS_FALSE;
+  for(i=0; i<numargs1; i++)
+    if(strcmp(args1[i], args2[i]) != 0)
+      return MS_FALSE;
+  return MS_TRUE;
+}
+
+static char **msProjectDupArgs(char **args, int numargs)
+{
+  char **dup = (char**) msSmallMalloc(MS_MAX(numargs,1) * sizeof(char*));
+  int i;
+  for(i=0; i<numargs; i++)
+    dup[i] = msStrdup(args[i]);
+  return dup;
+}
+
+/* the parts of a projectionObj besides its arguments the pair depends on */
+static int msProjectPairFlags(projectionObj *p)
+{
+  return (p->proj != NULL ? 1 : 0) | (p->gt.need_geotransform ? 2 : 0);
+}
+
+static void msProjectFreePairEntry(projPairCacheEntry *entry)
+{
+  msFreeCharArray(entry->in_args, entry->in_numargs);
+  msFreeCharArray(entry->out_args, entry->out_numargs);
+}
+
+/* the caller must hold TLOCK_PROJ */
+static void msProjectClearPairCache(void)
+{
+  int i;
+  for(i=0; i<proj_pair_cache_size; i++)
+    msProjectFreePairEntry(&(proj_pair_cache[i]));
+  proj_pair_cache_size = 0;
+  proj_pair_cache_next = 0;
+}
+
+static void msProjectComputePair(projectionObj *in, projectionObj *out, projectionPairObj *pair)
+{
+  pair->differ = msProjectionsDifferUncached(in, out);
+#ifdef USE_PROJ
+  pair->in_latlong = in->proj != NULL && pj_is_latlong(in->proj);
+  pair->out_latlong = out->proj != NULL && pj_is_latlong(out->proj);
+  pair->need_wrap = in->proj != NULL && out->proj != NULL
+                    && !pair->in_latlong && pair->out_latlong;
+#else
+  pair->in_latlong = pair->out_latlong = pair->need_wrap = MS_FALSE;
+#endif
+#ifdef USE_PROJ
+  if( in->proj == NULL ) {
+    pair->has_lon_wrap = MS_FALSE;
+    pair->lon_wrap = 0;
+  } else
+#endif
+    pair->has_lon_wrap = msProjectHasLonWrap(in, &(pair->lon_wrap));
+  pair->in_axis_inverted = msIsAxisInvertedProj(in);
+  pair->out_axis_inverted = msIsAxisInvertedProj(out);
+}
+
+void msGetProjectionPair(projectionObj *in, projectionObj *out, projectionPairObj *pair)
+{
+  projPairCacheEntry *entry;
+  int i, in_flags = msProjectPairFlags(in), out_flags = msProjectPairFlags(out);
+
+  msAcquireLock( TLOCK_PROJ );
+  for(i=0; i<proj_pair_cache_size; i++) {
+    entry = &(proj_pair_cache[i]);
+    if(entry->in_flags == in_flags && entry->out_flags == out_flags
+        && msProjectArgsEqual(entry->in_args, entry->in_numargs, in->args, in->numargs)
+        && msProjectArgsEqual(entry->out_args, entry->out_numargs, out->args, out->numargs)) {
+      *pair = entry->pair;
+      msReleaseLock( TLOCK_PROJ );
+      return;
+    }
+  }
+  msReleaseLock( TLOCK_PROJ );
+
+  msProjectComputePair(in, out, pair);
+
+  /* another thread may have added the same pair meanwhile, which is harmless */
+  msAcquireLock( TLOCK_PROJ );
+  if(proj_pair_cache_size < MS_PROJ_PAIR_CACHE_SIZE) {
+    entry = &(proj_pair_cache[proj_pair_cache_size++]);
+  } else {
+    entry = &(proj_pair_cache[proj_pair_cache_next]);
+    proj_pair_cache_next = (proj_pair_cache_next + 1) % MS_PROJ_PAIR_CACHE_SIZE;
+    msProjectFreePairEntry(entry);
+  }
+  entry->in_args = msProjectDupArgs(in->args, in->numargs);
+  entry->in_numargs = in->numargs;
+  entry->in_flags = in_flags;
+  entry->out_args = msProjectDupArgs(out->args, out->numargs);
+  entry->out_numargs = out->numargs;
+  entry->out_flags = out_flags;
+  entry->pair = *pair;
+  msReleaseLock( TLOCK_PROJ );
+}
+
 /************************************************************************/
 /*                           msTestNeedWrap()                           */
 /************************************************************************/
@@ -1347,6 +1839,285 @@ static const char *msProjFinder( const char *filename)
 }
 #endif /* def USE_PROJ */
 
+#ifdef USE_PROJ_API_6
+/************************************************************************/
+/*                     PROJ 6+ transformation cache                     */
+/*                                                                      */
+/*      Every thread has its own PJ_CONTEXT, along with the PJ          */
+/*      transformations it created between pairs of projectionObj       */
+/*      (identified by their arguments). No lock is held while          */
+/*      transforming, and the costly creation of a transformation       */
+/*      happens once per pair and thread.                               */
+/************************************************************************/
+
+#define MS_PROJ_TRANSFORM_CACHE_SIZE 16
+
+typedef struct {
+  char **in_args;
+  int in_numargs;
+  char **out_args;
+  int out_numargs;
+  PJ *pj; /* NULL if PROJ could not create the transformation */
+} projTransformCacheEntry;
+
+typedef struct projThreadContext {
+  struct projThreadContext *next;
+  void *thread_id;
+  PJ_CONTEXT *ctx;
+  int proj_lib_generation;
+  int num_entries;
+  int next_entry;
+  projTransformCacheEntry entries[MS_PROJ_TRANSFORM_CACHE_SIZE];
+} projThreadContext;
+
+static projThreadContext *proj_thread_contexts = NULL;
+static int proj_lib_generation = 0; /* bumped when PROJ_LIB changes */
+static int proj_contexts_generation = 0; /* bumped by msProjectCleanup() */
+
+#if !defined(USE_THREAD)
+#  define MS_PROJ_THREAD_LOCAL
+#elif defined(_MSC_VER)
+#  define MS_PROJ_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#  define MS_PROJ_THREAD_LOCAL __thread
+#endif
+
+#ifdef MS_PROJ_THREAD_LOCAL
+static MS_PROJ_THREAD_LOCAL projThreadContext *current_context = NULL;
+static MS_PROJ_THREAD_LOCAL int current_context_generation = 0;
+#endif
+
+static void msProjectFreeCacheEntry(projTransformCacheEntry *entry)
+{
+  msFreeCharArray(entry->in_args, entry->in_numargs);
+  msFreeCharArray(entry->out_args, entry->out_numargs);
+  if(entry->pj)
+    proj_destroy(entry->pj);
+  memset(entry, 0, sizeof(projTransformCacheEntry));
+}
+
+static void msProjectFreeThreadContext(projThreadContext *link)
+{
+  int i;
+
+  for(i=0; i<link->num_entries; i++)
+    msProjectFreeCacheEntry(&(link->entries[i]));
+  proj_context_destroy(link->ctx);
+  free(link);
+}
+
+/*
+** Returns the context of the calling thread, creating it on first use.
+** Threads started with msThreadCreate() release it when they exit, see
+** msProjectThreadCleanup().
+*/
+static projThreadContext *msProjectGetThreadContext(void)
+{
+  projThreadContext *link, *prev = NULL;
+  void *thread_id;
+
+#ifdef MS_PROJ_THREAD_LOCAL
+  if(current_context && current_context_generation == proj_contexts_generation
+      && current_context->proj_lib_generation == proj_lib_generation)
+    return current_context;
+#endif
+
+  msAcquireLock( TLOCK_PROJ );
+
+  thread_id = msGetThreadId();
+  for(link = proj_thread_contexts; link && link->thread_id != thread_id; link = link->next)
+    prev = link;
+
+  if(link == NULL) {
+    link = (projThreadContext*) msSmallCalloc(1, sizeof(projThreadContext));
+    link->thread_id = thread_id;
+    link->ctx = proj_context_create();
+    /* "+init=epsg:XXXX" definitions keep their PROJ.4 meaning and axis order */
+    proj_context_use_proj4_init_rules(link->ctx, MS_TRUE);
+    link->proj_lib_generation = -1;
+    link->next = proj_thread_contexts;
+    proj_thread_contexts = link;
+  } else if(prev) {
+    /* move to the front, the next lookup will be quicker */
+    prev->next = link->next;
+    link->next = proj_thread_contexts;
+    proj_thread_contexts = link;
+  }
+
+  if(link->proj_lib_generation != proj_lib_generation) {
+    const char *paths[1];
+    paths[0] = ms_proj_lib;
+    proj_context_set_search_paths(link->ctx, ms_proj_lib ? 1 : 0, ms_proj_lib ? paths : NULL);
+    link->proj_lib_generation = proj_lib_generation;
+  }
+
+  msReleaseLock( TLOCK_PROJ );
+
+#ifdef MS_PROJ_THREAD_LOCAL
+  current_context = link;
+  current_context_generation = proj_contexts_generation;
+#endif
+  return link;
+}
+
+/*
+** PROJ 6 definition of the CRS of p, from its PROJ.4 style definition as
+** expanded by pj_init() (so AUTO projections are handled too).
+*/
+static char *msProjectGetCRSDefinition(projectionObj *p)
+{
+  char *def, *crs = NULL;
+  char **tokens;
+  int i, numtokens, expanded = MS_FALSE;
+
+  def = pj_get_def(p->proj, 0);
+  tokens = msStringSplit(def, ' ', &numtokens);
+  pj_dalloc(def);
+
+  for(i=0; i<numtokens; i++)
+    if(strncmp(tokens[i], "+proj=", 6) == 0)
+      expanded = MS_TRUE;
+
+  for(i=0; i<numtokens; i++) {
+    if(tokens[i][0] == '\0')
+      continue;
+    /* the init file has already been expanded */
+    if(expanded && strncmp(tokens[i], "+init=", 6) == 0)
+      continue;
+    crs = msStringConcatenate(crs, tokens[i]);
+    crs = msStringConcatenate(crs, " ");
+  }
+  crs = msStringConcatenate(crs, "+type=crs");
+
+  msFreeCharArray(tokens, numtokens);
+  return crs;
+}
+
+/*
+** Returns the transformation from in to out for the calling thread, or
+** NULL if PROJ cannot create it (the legacy API is then used).
+*/
+static PJ *msProjectGetTransformation(projectionObj *in, projectionObj *out)
+{
+  projThreadContext *tc = msProjectGetThreadContext();
+  projTransformCacheEntry *entry;
+  char *in_def, *out_def;
+  int i;
+
+  for(i=0; i<tc->num_entries; i++) {
+    entry = &(tc->entries[i]);
+    if(msProjectArgsEqual(entry->in_args, entry->in_numargs, in->args, in->numargs)
+        && msProjectArgsEqual(entry->out_args, entry->out_numargs, out->args, out->numargs))
+      return entry->pj;
+  }
+
+  /* not cached yet, take a free entry or replace the oldest one */
+  if(tc->num_entries < MS_PROJ_TRANSFORM_CACHE_SIZE) {
+    entry = &(tc->entries[tc->num_entries++]);
+  } else {
+    entry = &(tc->entries[tc->next_entry]);
+    tc->next_entry = (tc->next_entry + 1) % MS_PROJ_TRANSFORM_CACHE_SIZE;
+    msProjectFreeCacheEntry(entry);
+  }
+
+  entry->in_args = msProjectDupArgs(in->args, in->numargs);
+  entry->in_numargs = in->numargs;
+  entry->out_args = msProjectDupArgs(out->args, out->numargs);
+  entry->out_numargs = out->numargs;
+
+  in_def = msProjectGetCRSDefinition(in);
+  out_def = msProjectGetCRSDefinition(out);
+  entry->pj = proj_create_crs_to_crs(tc->ctx, in_def, out_def, NULL);
+  if(entry->pj == NULL)
+    msDebug("msProjectGetTransformation(): proj error \"%s\" for \"%s\" to \"%s\", "
+            "using the legacy API.\n",
+            proj_errno_string(proj_context_errno(tc->ctx)), in_def, out_def);
+  msFree(in_def);
+  msFree(out_def);
+
+  return entry->pj;
+}
+
+/************************************************************************/
+/*                      msProjectTransformPoints()                      */
+/*                                                                      */
+/*      Reprojects count points at once from in to out, not applying    */
+/*      the geotransforms. Coordinates are read and written at x and    */
+/*      y, every stride bytes, geographic ones in degrees. Points       */
+/*      that fail are set to HUGE_VAL. Returns MS_FAILURE if no         */
+/*      transformation is available.                                    */
+/************************************************************************/
+int msProjectTransformPoints( projectionObj *in, projectionObj *out, int count,
+                              double *x, double *y, size_t stride )
+{
+  PJ *pj = msProjectGetTransformation(in, out);
+
+  if(pj == NULL)
+    return MS_FAILURE;
+  proj_trans_generic(pj, PJ_FWD, x, stride, count, y, stride, count,
+                     NULL, 0, 0, NULL, 0, 0);
+  return MS_SUCCESS;
+}
+#endif /* def USE_PROJ_API_6 */
+
+/************************************************************************/
+/*                          msProjectCleanup()                          */
+/************************************************************************/
+void msProjectCleanup(void)
+{
+#ifdef USE_PROJ_API_6
+  projThreadContext *link;
+#endif
+
+  msAcquireLock( TLOCK_PROJ );
+  msProjectClearPairCache();
+#ifdef USE_PROJ_API_6
+  while(proj_thread_contexts) {
+    link = proj_thread_contexts;
+    proj_thread_contexts = link->next;
+    msProjectFreeThreadContext(link);
+  }
+  proj_contexts_generation++;
+#endif
+  msReleaseLock( TLOCK_PROJ );
+}
+
+/************************************************************************/
+/*                       msProjectThreadCleanup()                       */
+/*                                                                      */
+/*      Releases the PROJ context and cached transformations of the     */
+/*      calling thread. Called by msThreadCreate() threads before       */
+/*      they exit, so short lived worker threads do not leave their     */
+/*      context behind until msCleanup().                               */
+/************************************************************************/
+void msProjectThreadCleanup(void)
+{
+#ifdef USE_PROJ_API_6
+  projThreadContext *link, *prev = NULL;
+  void *thread_id;
+
+  msAcquireLock( TLOCK_PROJ );
+
+  thread_id = msGetThreadId();
+  for(link = proj_thread_contexts; link && link->thread_id != thread_id; link = link->next)
+    prev = link;
+
+  if(link) {
+    if(prev)
+      prev->next = link->next;
+    else
+      proj_thread_contexts = link->next;
+    msProjectFreeThreadContext(link);
+  }
+
+  msReleaseLock( TLOCK_PROJ );
+
+#ifdef MS_PROJ_THREAD_LOCAL
+  current_context = NULL;
+#endif
+#endif
+}
+
 /************************************************************************/
 /*                       msProjLibInitFromEnv()                         */
 /************************************************************************/
@@ -1398,6 +2169,11 @@ void msSetPROJ_LIB( const char *proj_lib, const char *pszRelToPath )
 
   if (proj_lib == NULL) pj_set_finder(NULL);
 
+  /* definitions may normalize differently with other init files */
+  if( (ms_proj_lib == NULL) != (proj_lib == NULL)
+      || (proj_lib != NULL && strcmp(ms_proj_lib, proj_lib) != 0) )
+    msProjectClearPairCache();
+
   if( ms_proj_lib != NULL ) {
     free( ms_proj_lib );
     ms_proj_lib = NULL;
@@ -1411,6 +2187,10 @@ void msSetPROJ_LIB( const char *proj_lib, const char *pszRelToPath )
   if( proj_lib != NULL )
     ms_proj_lib = msStrdup( proj_lib );
 
+#ifdef USE_PROJ_API_6
+  proj_lib_generation++;
+#endif
+
   msReleaseLock( TLOCK_PROJ );
 
   if ( extended_path )
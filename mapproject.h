@@ -41,6 +41,10 @@ extern "C" {
 #define ACCEPT_USE_OF_DEPRECATED_PROJ_API_H 1
 
 #ifdef USE_PROJ
+#ifdef USE_PROJ_API_6
+   /* must come first so that projPJ and projCtx are the PJ types */
+#  include <proj.h>
+#endif
 #  include <proj_api.h>
 #if PJ_VERSION >= 470 && PJ_VERSION < 480
    void pj_clear_initcache();
@@ -78,12 +82,40 @@ extern "C" {
 
 #ifndef SWIG
 
+  /* What reprojecting from one projection to another involves, as */
+  /* computed once per pair of projections by msGetProjectionPair(). */
+  typedef struct {
+    int differ; /* msProjectionsDiffer() */
+    int in_latlong, out_latlong;
+    int need_wrap; /* from a projected system to lat/long, see msTestNeedWrap() */
+    int has_lon_wrap; /* msProjectHasLonWrap() of the source */
+    double lon_wrap;
+    int in_axis_inverted, out_axis_inverted; /* msIsAxisInvertedProj() */
+  } projectionPairObj;
+
+  /* Grid of projected points for approximate reprojection, see */
+  /* msProjectCreateApproxGrid(). */
+  typedef struct {
+    rectObj extent; /* in the source projection */
+    int nx, ny; /* number of cells */
+    double dx, dy; /* cell size */
+    pointObj *nodes; /* (nx+1)*(ny+1) projected corners, row by row */
+    unsigned char *exact; /* cells too distorted to interpolate in */
+    int numexact;
+  } projApproxGridObj;
+
   MS_DLL_EXPORT int msIsAxisInverted(int epsg_code);
   MS_DLL_EXPORT int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point);
   MS_DLL_EXPORT int msProjectShape(projectionObj *in, projectionObj *out, shapeObj *shape);
   MS_DLL_EXPORT int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line);
   MS_DLL_EXPORT int msProjectRect(projectionObj *in, projectionObj *out, rectObj *rect);
+  MS_DLL_EXPORT projApproxGridObj *msProjectCreateApproxGrid(projectionObj *in, projectionObj *out,
+      rectObj *extent, double max_error);
+  MS_DLL_EXPORT void msFreeApproxGrid(projApproxGridObj *grid);
+  MS_DLL_EXPORT int msProjectShapeApprox(projApproxGridObj *grid, projectionObj *in, projectionObj *out,
+      shapeObj *shape);
   MS_DLL_EXPORT int msProjectionsDiffer(projectionObj *, projectionObj *);
+  MS_DLL_EXPORT void msGetProjectionPair(projectionObj *in, projectionObj *out, projectionPairObj *pair);
   MS_DLL_EXPORT int msOGCWKT2ProjectionObj( const char *pszWKT, projectionObj *proj, int
       debug_flag );
   MS_DLL_EXPORT char *msProjectionObj2OGCWKT( projectionObj *proj );
@@ -103,6 +135,12 @@ extern "C" {
 
   MS_DLL_EXPORT void msSetPROJ_LIB( const char *, const char * );
   MS_DLL_EXPORT void msProjLibInitFromEnv();
+  void msProjectCleanup(void);
+  void msProjectThreadCleanup(void);
+#ifdef USE_PROJ_API_6
+  int msProjectTransformPoints( projectionObj *in, projectionObj *out, int count,
+                                double *x, double *y, size_t stride );
+#endif
 
   /* Provides compatiblity with PROJ.4 4.4.2 */
 #ifndef PJ_VERSION
@@ -45,7 +45,14 @@
  */
 
 #include "mapserver.h"
+#include "mapthread.h"
 #include <stdlib.h>
+#include <stddef.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MS_QUANTIZE_SSE2
+#endif
 
 #define PAM_GETR(p) ((p).r)
 #define PAM_GETG(p) ((p).g)
@@ -71,16 +78,23 @@ struct acolorhist_item {
   int value;
 };
 
-typedef struct acolorhist_list_item *acolorhist_list;
-struct acolorhist_list_item {
-  struct acolorhist_item ch;
-  acolorhist_list next;
-};
-
-typedef acolorhist_list *acolorhash_table;
-
 #define MAXCOLORS  32767
 
+/*
+** Open addressing table of colors keyed by the 32 bit value of the pixel,
+** used both for the histogram (the value is the pixel count) and to
+** remember the palette index a color was classified to.
+*/
+#define COLOR_TABLE_BITS 16
+#define COLOR_TABLE_SIZE (1 << COLOR_TABLE_BITS)
+#define COLOR_TABLE_MAX_FILL (COLOR_TABLE_SIZE / 2) /* more than MAXCOLORS */
+
+typedef struct {
+  ms_uint32 *keys;
+  int *values; /* -1 for free slots */
+  int count;
+} colorTableObj;
+
 #define LARGE_NORM
 #define REP_AVERAGE_PIXELS
 
@@ -93,24 +107,17 @@ struct box {
 
 static acolorhist_vector mediancut
 (acolorhist_vector achv, int colors, int sum, unsigned char maxval, int newcolors);
-static int redcompare (const void *ch1, const void *ch2);
-static int greencompare (const void *ch1, const void *ch2);
-static int bluecompare (const void *ch1, const void *ch2);
-static int alphacompare (const void *ch1, const void *ch2);
+static void sortacolorhist
+(acolorhist_vector achv, int clrs, acolorhist_vector tmp, size_t component);
 static int sumcompare (const void *b1, const void *b2);
 
-static acolorhist_vector pam_acolorhashtoacolorhist
-(acolorhash_table acht, int maxacolors);
 static acolorhist_vector pam_computeacolorhist
 (rgbaPixel **apixels, int cols, int rows, int maxacolors, int* acolorsP);
-static acolorhash_table pam_computeacolorhash
-(rgbaPixel** apixels, int cols, int rows, int maxacolors, int* acolorsP);
-static acolorhash_table pam_allocacolorhash (void);
-static int pam_addtoacolorhash
-(acolorhash_table acht, rgbaPixel *acolorP, int value);
-static int pam_lookupacolor (acolorhash_table acht, rgbaPixel* acolorP);
 static void pam_freeacolorhist (acolorhist_vector achv);
-static void pam_freeacolorhash (acolorhash_table acht);
+
+static colorTableObj *colorTableCreate(void);
+static int *colorTableGetSlot(colorTableObj *table, ms_uint32 key);
+static void colorTableDestroy(colorTableObj *table);
 
 
 /**
@@ -195,74 +202,215 @@ int msQuantizeRasterBuffer(rasterBufferObj *rb,
 }
 
 
-int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb)
+/*
+** Index of the palette entry closest to the pixel, the first one on ties.
+** The palette is read by groups of 4 entries, its size must be a multiple
+** of 4 even if num_entries is not.
+*/
+static int findNearestColor(ms_uint32 pixel, const rgbaPixel *palette, int num_entries)
 {
-  register int ind;
-  unsigned char *outrow,*pQ;
-  register rgbaPixel *pP;
-  acolorhash_table acht;
-  int usehash, row, col;
+  int i, j, ind = 0;
+  long dist = 2000000000;
+#ifdef MS_QUANTIZE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i px = _mm_unpacklo_epi8(_mm_set1_epi32(pixel), zero);
+  int newdist[4];
+
+  for ( i = 0; i < num_entries; i += 4 ) {
+    /* 4 squared distances at once: the components of two entries are */
+    /* widened to 16 bits, and madd sums their squared differences by */
+    /* pairs, which are then added up per entry                        */
+    __m128i pal = _mm_loadu_si128((const __m128i*)(palette + i));
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(pal, zero), px);
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(pal, zero), px);
+    __m128 sqlo = _mm_castsi128_ps(_mm_madd_epi16(lo, lo));
+    __m128 sqhi = _mm_castsi128_ps(_mm_madd_epi16(hi, hi));
+    __m128i d = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sqlo, sqhi, _MM_SHUFFLE(2,0,2,0))),
+                              _mm_castps_si128(_mm_shuffle_ps(sqlo, sqhi, _MM_SHUFFLE(3,1,3,1))));
+    _mm_storeu_si128((__m128i*)newdist, d);
+    for ( j = 0; j < 4 && i + j < num_entries; ++j ) {
+      if ( newdist[j] < dist ) {
+        ind = i + j;
+        dist = newdist[j];
+      }
+    }
+  }
+#else
+  rgbaPixel p;
+  memcpy(&p, &pixel, sizeof(p));
+  (void)j;
+  for ( i = 0; i < num_entries; ++i ) {
+    long newdist = ( PAM_GETR(p) - PAM_GETR(palette[i]) ) * ( PAM_GETR(p) - PAM_GETR(palette[i]) ) +
+                   ( PAM_GETG(p) - PAM_GETG(palette[i]) ) * ( PAM_GETG(p) - PAM_GETG(palette[i]) ) +
+                   ( PAM_GETB(p) - PAM_GETB(palette[i]) ) * ( PAM_GETB(p) - PAM_GETB(palette[i]) ) +
+                   ( PAM_GETA(p) - PAM_GETA(palette[i]) ) * ( PAM_GETA(p) - PAM_GETA(palette[i]) );
+    if ( newdist < dist ) {
+      ind = i;
+      dist = newdist;
+    }
+  }
+#endif
+  return ind;
+}
+
+/*
+** Maps the pixels of rb to the palette of qrb, through lookup which holds
+** the colors already matched (possibly by previous calls with the same
+** palette) and gets the new ones added.
+*/
+static void classifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb, colorTableObj *lookup)
+{
+  rgbaPixel palette[256];
+  unsigned char *pQ;
+  rgbaPixel *pP;
+  int row, col, ind = 0;
+  int num_entries = qrb->data.palette.num_entries;
+
   /*
    ** Step 4: map the colors in the image to their closest match in the
    ** new colormap, and write 'em out.
    */
-  acht = pam_allocacolorhash( );
-  usehash = 1;
+  memset(palette, 0, sizeof(palette));
+  memcpy(palette, qrb->data.palette.palette, num_entries * sizeof(rgbaPixel));
 
   for ( row = 0; row < qrb->height; ++row ) {
-    outrow = &(qrb->data.palette.pixels[row*qrb->width]);
-    col = 0;
-    pP = (rgbaPixel*)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));;
-    pQ = outrow;
-    do {
-      /* Check hash table to see if we have already matched this color. */
-      ind = pam_lookupacolor( acht, pP );
-      if ( ind == -1 ) {
-        /* No; search acolormap for closest match. */
-        register int i, r1, g1, b1, a1, r2, g2, b2, a2;
-        register long dist, newdist;
-
-        r1 = PAM_GETR( *pP );
-        g1 = PAM_GETG( *pP );
-        b1 = PAM_GETB( *pP );
-        a1 = PAM_GETA( *pP );
-        dist = 2000000000;
-        for ( i = 0; i < qrb->data.palette.num_entries; ++i ) {
-          r2 = PAM_GETR( qrb->data.palette.palette[i] );
-          g2 = PAM_GETG( qrb->data.palette.palette[i] );
-          b2 = PAM_GETB( qrb->data.palette.palette[i] );
-          a2 = PAM_GETA( qrb->data.palette.palette[i] );
-          /* GRR POSSIBLE BUG */
-          newdist = ( r1 - r2 ) * ( r1 - r2 ) +  /* may overflow? */
-                    ( g1 - g2 ) * ( g1 - g2 ) +
-                    ( b1 - b2 ) * ( b1 - b2 ) +
-                    ( a1 - a2 ) * ( a1 - a2 );
-          if ( newdist < dist ) {
-            ind = i;
-            dist = newdist;
-          }
-        }
-        if ( usehash ) {
-          if ( pam_addtoacolorhash( acht, pP, ind ) < 0 ) {
-            usehash = 0;
-          }
+    ms_uint32 pixel, lastpixel = 0;
+    pP = (rgbaPixel*)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));
+    pQ = &(qrb->data.palette.pixels[row*qrb->width]);
+    for ( col = 0; col < rb->width; ++col, ++pP, ++pQ ) {
+      memcpy(&pixel, pP, sizeof(pixel));
+      /* runs of a single color are frequent in maps, they need no lookup */
+      if ( col == 0 || pixel != lastpixel ) {
+        /* Check the table to see if we have already matched this color. */
+        int *slot = colorTableGetSlot( lookup, pixel );
+        if ( slot && *slot != -1 ) {
+          ind = *slot;
+        } else {
+          /* No; search the colormap for the closest match. */
+          ind = findNearestColor( pixel, palette, num_entries );
+          if ( slot ) *slot = ind;
         }
+        lastpixel = pixel;
       }
-
-      /*          *pP = acolormap[ind].acolor;  */
       *pQ = (unsigned char)ind;
+    }
+  }
+}
 
-      ++col;
-      ++pP;
-      ++pQ;
+int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb)
+{
+  colorTableObj *lookup = colorTableCreate();
+  classifyRasterBuffer(rb, qrb, lookup);
+  colorTableDestroy(lookup);
+  return MS_SUCCESS;
+}
 
-    } while ( col != rb->width );
+
+/*
+** Palette cache: images quantized under the same key (in practice the
+** consecutive tiles of a given output format and set of layers) share the
+** palette computed for the first of them, along with the color lookup
+** table filled while classifying their pixels, so that neither the median
+** cut nor most of the nearest color searches are run again. A palette is
+** computed afresh once it has been used for maxuses images.
+*/
+#define PALETTE_CACHE_SIZE 16
+
+typedef struct {
+  char *key;
+  int uses;
+  unsigned int num_entries;
+  rgbaPixel palette[256];
+  colorTableObj *lookup;
+} paletteCacheEntryObj;
+
+static paletteCacheEntryObj *paletteCache[PALETTE_CACHE_SIZE];
+static int paletteCacheNext = 0;
+
+static void paletteCacheFreeEntry(paletteCacheEntryObj *entry)
+{
+  if(!entry) return;
+  msFree(entry->key);
+  colorTableDestroy(entry->lookup);
+  free(entry);
+}
+
+/*
+** Same as msQuantizeRasterBuffer() followed by msClassifyRasterBuffer(),
+** reusing the palette cached under key if any. qrb->data.palette.num_entries
+** holds the number of colors wanted on input.
+*/
+int msQuantizeRasterBufferCached(rasterBufferObj *rb, rasterBufferObj *qrb, const char *key, int maxuses)
+{
+  paletteCacheEntryObj *entry = NULL;
+  int i;
+
+  /* take the entry out of the cache while it is in use */
+  msAcquireLock(TLOCK_PALETTE);
+  for(i=0; i<PALETTE_CACHE_SIZE; i++) {
+    if(paletteCache[i] && strcmp(paletteCache[i]->key, key) == 0) {
+      entry = paletteCache[i];
+      paletteCache[i] = NULL;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_PALETTE);
+
+  if(entry && entry->uses >= maxuses) {
+    paletteCacheFreeEntry(entry);
+    entry = NULL;
+  }
+
+  if(!entry) {
+    if(msQuantizeRasterBuffer(rb, &(qrb->data.palette.num_entries), qrb->data.palette.palette,
+                              NULL, 0, &(qrb->data.palette.scaling_maxval)) != MS_SUCCESS)
+      return MS_FAILURE;
+    if(qrb->data.palette.scaling_maxval != 255) {
+      /* rb has been scaled down to fit in the histogram, this palette fits no other image */
+      return msClassifyRasterBuffer(rb, qrb);
+    }
+    entry = (paletteCacheEntryObj*)msSmallCalloc(1, sizeof(paletteCacheEntryObj));
+    entry->key = msStrdup(key);
+    entry->num_entries = qrb->data.palette.num_entries;
+    memcpy(entry->palette, qrb->data.palette.palette, entry->num_entries * sizeof(rgbaPixel));
+    entry->lookup = colorTableCreate();
+  } else {
+    qrb->data.palette.num_entries = entry->num_entries;
+    qrb->data.palette.scaling_maxval = 255;
+    memcpy(qrb->data.palette.palette, entry->palette, entry->num_entries * sizeof(rgbaPixel));
   }
-  pam_freeacolorhash(acht);
+
+  classifyRasterBuffer(rb, qrb, entry->lookup);
+  entry->uses++;
+
+  /* put it back, in a free slot or in place of the oldest entry */
+  msAcquireLock(TLOCK_PALETTE);
+  for(i=0; i<PALETTE_CACHE_SIZE && paletteCache[i]; i++);
+  if(i == PALETTE_CACHE_SIZE) {
+    i = paletteCacheNext;
+    paletteCacheNext = (paletteCacheNext + 1) % PALETTE_CACHE_SIZE;
+    paletteCacheFreeEntry(paletteCache[i]);
+  }
+  paletteCache[i] = entry;
+  msReleaseLock(TLOCK_PALETTE);
 
   return MS_SUCCESS;
 }
 
+/*
+** Releases all cached palettes, called from msCleanup().
+*/
+void msPaletteCacheCleanup()
+{
+  int i;
+  msAcquireLock(TLOCK_PALETTE);
+  for(i=0; i<PALETTE_CACHE_SIZE; i++) {
+    paletteCacheFreeEntry(paletteCache[i]);
+    paletteCache[i] = NULL;
+  }
+  msReleaseLock(TLOCK_PALETTE);
+}
+
 
 
 /*
@@ -274,7 +422,7 @@ int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb)
 static acolorhist_vector
 mediancut( acolorhist_vector achv, int colors, int sum, unsigned char maxval, int newcolors )
 {
-  acolorhist_vector acolormap;
+  acolorhist_vector acolormap, sorttmp;
   box_vector bv;
   register int bi, i;
   int boxes;
@@ -282,7 +430,9 @@ mediancut( acolorhist_vector achv, int colors, int sum, unsigned char maxval, in
   bv = (box_vector) malloc( sizeof(struct box) * newcolors );
   acolormap =
     (acolorhist_vector) malloc( sizeof(struct acolorhist_item) * newcolors);
-  if ( bv == (box_vector) 0 || acolormap == (acolorhist_vector) 0 ) {
+  sorttmp =
+    (acolorhist_vector) malloc( sizeof(struct acolorhist_item) * colors);
+  if ( bv == (box_vector) 0 || acolormap == (acolorhist_vector) 0 || sorttmp == (acolorhist_vector) 0 ) {
     fprintf( stderr, "  out of memory allocating box vector\n" );
     fflush(stderr);
     exit(6);
@@ -352,21 +502,13 @@ mediancut( acolorhist_vector achv, int colors, int sum, unsigned char maxval, in
      */
 #ifdef LARGE_NORM
     if ( maxa - mina >= maxr - minr && maxa - mina >= maxg - ming && maxa - mina >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        alphacompare );
+      sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, a) );
     else if ( maxr - minr >= maxg - ming && maxr - minr >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        redcompare );
+      sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, r) );
     else if ( maxg - ming >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        greencompare );
+      sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, g) );
     else
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        bluecompare );
+      sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, b) );
 #endif /*LARGE_NORM*/
 #ifdef LARGE_LUM
     {
@@ -389,21 +531,13 @@ mediancut( acolorhist_vector achv, int colors, int sum, unsigned char maxval, in
        */
 
       if ( al >= rl && al >= gl && al >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          alphacompare );
+        sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, a) );
       else if ( rl >= gl && rl >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          redcompare );
+        sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, r) );
       else if ( gl >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          greencompare );
+        sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, g) );
       else
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          bluecompare );
+        sortacolorhist( &(achv[indx]), clrs, sorttmp, offsetof(rgbaPixel, b) );
     }
 #endif /*LARGE_LUM*/
 
@@ -519,35 +653,28 @@ mediancut( acolorhist_vector achv, int colors, int sum, unsigned char maxval, in
    ** All done.
    */
   free(bv);
+  free(sorttmp);
   return acolormap;
 }
 
-static int
-redcompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETR( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETR( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-greencompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETG( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETG( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-bluecompare( const void *ch1, const void *ch2 )
+/*
+** Stable counting sort of a box on one color component, in the order the
+** (merge sort based) qsort of the per component comparators gave.
+*/
+static void
+sortacolorhist( acolorhist_vector achv, int clrs, acolorhist_vector tmp, size_t component )
 {
-  return (int) PAM_GETB( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETB( ((acolorhist_vector)ch2)->acolor );
-}
+  int count[257];
+  int i;
 
-static int
-alphacompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETA( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETA( ((acolorhist_vector)ch2)->acolor );
+  memset(count, 0, sizeof(count));
+  for ( i = 0; i < clrs; ++i )
+    count[((unsigned char*)&(achv[i].acolor))[component] + 1]++;
+  for ( i = 0; i < 256; ++i )
+    count[i + 1] += count[i];
+  for ( i = 0; i < clrs; ++i )
+    tmp[count[((unsigned char*)&(achv[i].acolor))[component]]++] = achv[i];
+  memcpy(achv, tmp, clrs * sizeof(struct acolorhist_item));
 }
 
 static int
@@ -589,157 +716,114 @@ sumcompare( const void *b1, const void *b2 )
     (long) PAM_GETA(p) * 24007 ) \
     & 0x7fffffff ) % HASH_SIZE )
 
-static acolorhist_vector
-pam_computeacolorhist( apixels, cols, rows, maxacolors, acolorsP )
-rgbaPixel** apixels;
-int cols, rows, maxacolors;
-int* acolorsP;
+static colorTableObj *colorTableCreate(void)
 {
-  acolorhash_table acht;
-  acolorhist_vector achv;
-
-  acht = pam_computeacolorhash( apixels, cols, rows, maxacolors, acolorsP );
-  if ( acht == (acolorhash_table) 0 )
-    return (acolorhist_vector) 0;
-  achv = pam_acolorhashtoacolorhist( acht, maxacolors );
-  pam_freeacolorhash( acht );
-  return achv;
+  colorTableObj *table = (colorTableObj*) msSmallMalloc(sizeof(colorTableObj));
+  table->keys = (ms_uint32*) msSmallMalloc(COLOR_TABLE_SIZE * sizeof(ms_uint32));
+  table->values = (int*) msSmallMalloc(COLOR_TABLE_SIZE * sizeof(int));
+  memset(table->values, 0xff, COLOR_TABLE_SIZE * sizeof(int));
+  table->count = 0;
+  return table;
 }
 
-
-
-static acolorhash_table
-pam_computeacolorhash( apixels, cols, rows, maxacolors, acolorsP )
-rgbaPixel** apixels;
-int cols, rows, maxacolors;
-int* acolorsP;
-{
-  acolorhash_table acht;
-  register rgbaPixel* pP;
-  acolorhist_list achl;
-  int col, row, hash;
-
-  acht = pam_allocacolorhash( );
-  *acolorsP = 0;
-
-  /* Go through the entire image, building a hash table of colors. */
-  for ( row = 0; row < rows; ++row )
-    for ( col = 0, pP = apixels[row]; col < cols; ++col, ++pP ) {
-      hash = pam_hashapixel( *pP );
-      for ( achl = acht[hash]; achl != (acolorhist_list) 0; achl = achl->next )
-        if ( PAM_EQUAL( achl->ch.acolor, *pP ) )
-          break;
-      if ( achl != (acolorhist_list) 0 )
-        ++(achl->ch.value);
-      else {
-        if ( ++(*acolorsP) > maxacolors ) {
-          pam_freeacolorhash( acht );
-          return (acolorhash_table) 0;
-        }
-        achl = (acolorhist_list) malloc( sizeof(struct acolorhist_list_item) );
-        if ( achl == 0 ) {
-          fprintf( stderr, "  out of memory computing hash table\n" );
-          exit(7);
-        }
-        achl->ch.acolor = *pP;
-        achl->ch.value = 1;
-        achl->next = acht[hash];
-        acht[hash] = achl;
-      }
-    }
-
-  return acht;
-}
-
-
-
-static acolorhash_table
-pam_allocacolorhash( )
+/*
+** Returns the value slot of key, adding the key with a -1 value if it is
+** not there yet. Returns NULL for new keys once the table is full.
+*/
+static int *colorTableGetSlot(colorTableObj *table, ms_uint32 key)
 {
-  acolorhash_table acht;
-  int i;
+  ms_uint32 i = (key * 2654435761U) >> (32 - COLOR_TABLE_BITS);
 
-  acht = (acolorhash_table) malloc( HASH_SIZE * sizeof(acolorhist_list) );
-  if ( acht == 0 ) {
-    fprintf( stderr, "  out of memory allocating hash table\n" );
-    exit(8);
+  while ( table->values[i] != -1 ) {
+    if ( table->keys[i] == key )
+      return &(table->values[i]);
+    i = (i + 1) & (COLOR_TABLE_SIZE - 1);
   }
-
-  for ( i = 0; i < HASH_SIZE; ++i )
-    acht[i] = (acolorhist_list) 0;
-
-  return acht;
+  if ( table->count >= COLOR_TABLE_MAX_FILL )
+    return NULL;
+  table->count++;
+  table->keys[i] = key;
+  return &(table->values[i]);
 }
 
-
-
-static int
-pam_addtoacolorhash( acht, acolorP, value )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-int value;
+static void colorTableDestroy(colorTableObj *table)
 {
-  register int hash;
-  register acolorhist_list achl;
-
-  achl = (acolorhist_list) msSmallMalloc( sizeof(struct acolorhist_list_item) );
-
-  hash = pam_hashapixel( *acolorP );
-  achl->ch.acolor = *acolorP;
-  achl->ch.value = value;
-  achl->next = acht[hash];
-  acht[hash] = achl;
-  return 0;
+  if ( !table ) return;
+  free(table->keys);
+  free(table->values);
+  free(table);
 }
 
-
-
+/*
+** The histogram used to be collated from a chained hash table, walking
+** the HASH_SIZE buckets in turn and each chain from its most recently
+** added color. Median cut sorts boxes with a stable sort, so the palette
+** depends on that order: the colors are put back in it, with a counting
+** sort on the old bucket, to keep palettes as they were.
+*/
 static acolorhist_vector
-pam_acolorhashtoacolorhist( acht, maxacolors )
-acolorhash_table acht;
-int maxacolors;
+pam_computeacolorhist( rgbaPixel **apixels, int cols, int rows, int maxacolors, int *acolorsP )
 {
+  colorTableObj *table;
   acolorhist_vector achv;
-  acolorhist_list achl;
-  int i, j;
+  int *order, *hashes, *buckets, *slot = NULL;
+  int col, row, i;
+  ms_uint32 pixel, lastpixel = 0;
 
-  /* Now collate the hash table into a simple acolorhist array. */
-  achv = (acolorhist_vector) malloc( maxacolors * sizeof(struct acolorhist_item) );
-  /* (Leave room for expansion by caller.) */
-  if ( achv == (acolorhist_vector) 0 ) {
-    fprintf( stderr, "  out of memory generating histogram\n" );
-    exit(9);
-  }
+  table = colorTableCreate();
+  order = (int*) msSmallMalloc( maxacolors * sizeof(int) );
+  *acolorsP = 0;
 
-  /* Loop through the hash table. */
-  j = 0;
-  for ( i = 0; i < HASH_SIZE; ++i )
-    for ( achl = acht[i]; achl != (acolorhist_list) 0; achl = achl->next ) {
-      /* Add the new entry. */
-      achv[j] = achl->ch;
-      ++j;
+  /* Go through the entire image, building a table of colors. */
+  for ( row = 0; row < rows; ++row ) {
+    rgbaPixel *pP = apixels[row];
+    for ( col = 0; col < cols; ++col, ++pP ) {
+      memcpy(&pixel, pP, sizeof(pixel));
+      if ( slot && pixel == lastpixel ) {
+        ++(*slot);
+        continue;
+      }
+      slot = colorTableGetSlot( table, pixel );
+      if ( slot == NULL || *slot == -1 ) {
+        if ( *acolorsP >= maxacolors || slot == NULL ) {
+          ++(*acolorsP);
+          colorTableDestroy( table );
+          free( order );
+          return (acolorhist_vector) 0;
+        }
+        *slot = 0;
+        order[(*acolorsP)++] = slot - table->values;
+      }
+      ++(*slot);
+      lastpixel = pixel;
     }
+  }
 
-  /* All done. */
-  return achv;
-}
-
-
-
-static int
-pam_lookupacolor( acht, acolorP )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-{
-  int hash;
-  acolorhist_list achl;
+  /* Now collate the table into a simple acolorhist array. */
+  hashes = (int*) msSmallMalloc( (*acolorsP + 1) * sizeof(int) );
+  buckets = (int*) msSmallCalloc( HASH_SIZE + 1, sizeof(int) );
+  for ( i = 0; i < *acolorsP; ++i ) {
+    rgbaPixel color;
+    memcpy(&color, &(table->keys[order[i]]), sizeof(rgbaPixel));
+    hashes[i] = pam_hashapixel( color );
+    buckets[hashes[i] + 1]++;
+  }
+  for ( i = 0; i < HASH_SIZE; ++i )
+    buckets[i + 1] += buckets[i];
 
-  hash = pam_hashapixel( *acolorP );
-  for ( achl = acht[hash]; achl != (acolorhist_list) 0; achl = achl->next )
-    if ( PAM_EQUAL( achl->ch.acolor, *acolorP ) )
-      return achl->ch.value;
+  achv = (acolorhist_vector) msSmallMalloc( maxacolors * sizeof(struct acolorhist_item) );
+  /* (Leave room for expansion by caller.) */
+  for ( i = *acolorsP - 1; i >= 0; --i ) {
+    acolorhist_vector ch = &(achv[buckets[hashes[i]]++]);
+    memcpy(&(ch->acolor), &(table->keys[order[i]]), sizeof(rgbaPixel));
+    ch->value = table->values[order[i]];
+  }
 
-  return -1;
+  free( buckets );
+  free( hashes );
+  colorTableDestroy( table );
+  free( order );
+  return achv;
 }
 
 
@@ -753,20 +837,4 @@ acolorhist_vector achv;
 
 
 
-static void
-pam_freeacolorhash( acht )
-acolorhash_table acht;
-{
-  int i;
-  acolorhist_list achl, achlnext;
-
-  for ( i = 0; i < HASH_SIZE; ++i )
-    for ( achl = acht[i]; achl != (acolorhist_list) 0; achl = achlnext ) {
-      achlnext = achl->next;
-      free( (char*) achl );
-    }
-  free( (char*) acht );
-}
-
-
 
@@ -208,15 +208,15 @@ static int addResult(mapObj* map, resultCacheObj *cache,
   int store_shape = canCacheShape (map, queryCache, shape, shape_ram_size);
 
   if(cache->numresults == cache->cachesize) { /* just add it to the end */
-    if(cache->cachesize == 0)
-      cache->results = (resultObj *) malloc(sizeof(resultObj)*MS_RESULTCACHEINCREMENT);
-    else
-      cache->results = (resultObj *) realloc(cache->results, sizeof(resultObj)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
-    if(!cache->results) {
+    /* grow geometrically, large result sets would otherwise be copied over and over */
+    int newsize = MS_MAX(cache->cachesize * 2, MS_RESULTCACHEINCREMENT);
+    resultObj *results = (resultObj *) realloc(cache->results, sizeof(resultObj)*newsize);
+    if(!results) {
       msSetError(MS_MEMERR, "Realloc() error.", "addResult()");
       return(MS_FAILURE);
     }
-    cache->cachesize += MS_RESULTCACHEINCREMENT;
+    cache->results = results;
+    cache->cachesize = newsize;
   }
 
   i = cache->numresults;
@@ -1288,14 +1288,78 @@ int msQueryByRect(mapObj *map)
   return(MS_FAILURE);
 }
 
-static int is_duplicate(resultCacheObj *resultcache, int shapeindex, int tileindex)
+/*
+** Open addressing set of (tileindex, shapeindex) pairs. msQueryByFeatures()
+** tracks the results of a layer in it so that shapes selected by several
+** selection features are only added once, without scanning the results.
+*/
+typedef struct {
+  long shapeindex;
+  int tileindex;
+  int used;
+} resultSetEntryObj;
+
+typedef struct {
+  resultSetEntryObj *entries;
+  int size; /* a power of two, 0 until the first insertion */
+  int count;
+} resultSetObj;
+
+#define MS_RESULTSET_INITSIZE 256
+
+static unsigned int resultSetHash(long shapeindex, int tileindex)
+{
+  unsigned long v = (unsigned long)shapeindex;
+  return ((unsigned int)(v ^ (v >> 16)) * 2654435761U) ^ ((unsigned int)tileindex * 40503U);
+}
+
+static void resultSetFree(resultSetObj *set)
 {
+  free(set->entries);
+  set->entries = NULL;
+  set->size = set->count = 0;
+}
+
+/* returns the slot of the pair, or the empty slot where it belongs */
+static resultSetEntryObj *resultSetLookup(resultSetEntryObj *entries, int size, long shapeindex, int tileindex)
+{
+  unsigned int i = resultSetHash(shapeindex, tileindex) & (size - 1);
+
+  while(entries[i].used && (entries[i].shapeindex != shapeindex || entries[i].tileindex != tileindex))
+    i = (i + 1) & (size - 1);
+  return &(entries[i]);
+}
+
+static int is_duplicate(resultSetObj *set, long shapeindex, int tileindex)
+{
+  if(set->count == 0) return(MS_FALSE);
+  return(resultSetLookup(set->entries, set->size, shapeindex, tileindex)->used);
+}
+
+static void resultSetAdd(resultSetObj *set, long shapeindex, int tileindex)
+{
+  resultSetEntryObj *entry;
   int i;
 
-  for(i=0; i<resultcache->numresults; i++)
-    if(resultcache->results[i].shapeindex == shapeindex && resultcache->results[i].tileindex == tileindex) return(MS_TRUE);
+  if(2 * (set->count + 1) > set->size) { /* keep it at most half full */
+    int newsize = set->size ? set->size * 2 : MS_RESULTSET_INITSIZE;
+    resultSetEntryObj *entries = (resultSetEntryObj *) msSmallCalloc(newsize, sizeof(resultSetEntryObj));
+    for(i=0; i<set->size; i++) {
+      if(set->entries[i].used)
+        *resultSetLookup(entries, newsize, set->entries[i].shapeindex, set->entries[i].tileindex) = set->entries[i];
+    }
+    free(set->entries);
+    set->entries = entries;
+    set->size = newsize;
+  }
 
-  return(MS_FALSE);
+  entry = resultSetLookup(set->entries, set->size, shapeindex, tileindex);
+  if(!entry->used) {
+    entry->shapeindex = shapeindex;
+    entry->tileindex = tileindex;
+    entry->used = MS_TRUE;
+    set->count++;
+  }
 }
 
 int msQueryByFeatures(mapObj *map)
@@ -1309,9 +1373,11 @@ int msQueryByFeatures(mapObj *map)
 
   rectObj searchrect;
   shapeObj shape, selectshape;
+  shapeIndexObj *sindex;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
+  resultSetObj results = {NULL, 0, 0};
 
   queryCacheObj queryCache;
 
@@ -1413,12 +1479,14 @@ int msQueryByFeatures(mapObj *map)
       if(status != MS_SUCCESS) {
         msLayerClose(lp);
         msLayerClose(slp);
+        resultSetFree(&results);
         return(MS_FAILURE);
       }
 
       if(selectshape.type != MS_SHAPE_POLYGON && selectshape.type != MS_SHAPE_LINE) {
         msLayerClose(lp);
         msLayerClose(slp);
+        resultSetFree(&results);
         msSetError(MS_QUERYERR, "Selection features MUST be polygons or lines.", "msQueryByFeatures()");
         return(MS_FAILURE);
       }
@@ -1448,6 +1516,7 @@ int msQueryByFeatures(mapObj *map)
       } else if(status != MS_SUCCESS) {
         msLayerClose(lp);
         msLayerClose(slp);
+        resultSetFree(&results);
         return(MS_FAILURE);
       }
 
@@ -1466,10 +1535,16 @@ int msQueryByFeatures(mapObj *map)
       if (lp->minfeaturesize > 0)
         minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+      /* the selection shape is tested against every candidate, index its edges once */
+      sindex = msCreateShapeIndex(&selectshape);
+
       while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
         /* check for dups when there are multiple selection shapes */
-        if(i > 0 && is_duplicate(lp->resultcache, shape.index, shape.tileindex)) continue;
+        if(i > 0 && is_duplicate(&results, shape.index, shape.tileindex)) {
+          msFreeShape(&shape);
+          continue;
+        }
 
 
         /* Check if the shape size is ok to be drawn */
@@ -1503,15 +1578,14 @@ int msQueryByFeatures(mapObj *map)
             switch(shape.type) { /* make sure shape actually intersects the selectshape */
               case MS_SHAPE_POINT:
                 if(tolerance == 0) /* just test for intersection */
-                  status = msIntersectMultipointPolygon(&shape, &selectshape);
+                  status = msIntersectMultipointPolygonIndexed(&shape, sindex);
                 else { /* check distance, distance=0 means they intersect */
-                  distance = msDistanceShapeToShape(&selectshape, &shape);
-                  if(distance < tolerance) status = MS_TRUE;
+                  if(msMultipointNearPolygonIndexed(&shape, sindex, tolerance)) status = MS_TRUE;
                 }
                 break;
               case MS_SHAPE_LINE:
                 if(tolerance == 0) { /* just test for intersection */
-                  status = msIntersectPolylinePolygon(&shape, &selectshape);
+                  status = msIntersectPolylinePolygonIndexed(&shape, sindex);
                 } else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1519,7 +1593,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_POLYGON:
                 if(tolerance == 0) /* just test for intersection */
-                  status = msIntersectPolygons(&shape, &selectshape);
+                  status = msIntersectPolygonsIndexed(&shape, sindex);
                 else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1543,7 +1617,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_LINE:
                 if(tolerance == 0) { /* just test for intersection */
-                  status = msIntersectPolylines(&shape, &selectshape);
+                  status = msIntersectPolylinesIndexed(&shape, sindex);
                 } else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1551,7 +1625,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_POLYGON:
                 if(tolerance == 0) /* just test for intersection */
-                  status = msIntersectPolylinePolygon(&selectshape, &shape);
+                  status = msIntersectIndexedPolylinePolygon(sindex, &shape);
                 else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1573,7 +1647,9 @@ int msQueryByFeatures(mapObj *map)
             msFreeShape(&shape);
             continue;
           }
-          addResult(map, lp->resultcache, &queryCache, &shape);
+          if(addResult(map, lp->resultcache, &queryCache, &shape) == MS_SUCCESS
+              && slp->resultcache->numresults > 1)
+            resultSetAdd(&results, shape.index, shape.tileindex);
         }
         msFreeShape(&shape);
 
@@ -1583,15 +1659,21 @@ int msQueryByFeatures(mapObj *map)
           break;
         }
       } /* next shape */
+      msFreeShapeIndex(sindex);
 
       if (classgroup)
         msFree(classgroup);
 
-      if(status != MS_DONE) return(MS_FAILURE);
+      if(status != MS_DONE) {
+        resultSetFree(&results);
+        return(MS_FAILURE);
+      }
 
       msFreeShape(&selectshape);
     } /* next selection shape */
 
+    resultSetFree(&results);
+
     if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
   } /* next layer */
 
@@ -1844,6 +1926,7 @@ int msQueryByShape(mapObj *map)
 {
   int start, stop=0, l;
   shapeObj shape, *qshape=NULL;
+  shapeIndexObj *qindex;
   layerObj *lp;
   char status;
   double distance, tolerance, layer_tolerance;
@@ -1980,6 +2063,9 @@ int msQueryByShape(mapObj *map)
     if (lp->minfeaturesize > 0)
       minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+    /* the query shape is tested against every candidate, index its edges once */
+    qindex = msCreateShapeIndex(qshape);
+
     while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       /* Check if the shape size is ok to be drawn */
@@ -2013,15 +2099,14 @@ int msQueryByShape(mapObj *map)
           switch(shape.type) { /* make sure shape actually intersects the shape */
             case MS_SHAPE_POINT:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectMultipointPolygon(&shape, qshape);
+                status = msIntersectMultipointPolygonIndexed(&shape, qindex);
               else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
+                if(msMultipointNearPolygonIndexed(&shape, qindex, tolerance)) status = MS_TRUE;
               }
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylinePolygon(&shape, qshape);
+                status = msIntersectPolylinePolygonIndexed(&shape, qindex);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2029,7 +2114,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_POLYGON:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolygons(&shape, qshape);
+                status = msIntersectPolygonsIndexed(&shape, qindex);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2052,7 +2137,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylines(&shape, qshape);
+                status = msIntersectPolylinesIndexed(&shape, qindex);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2060,7 +2145,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_POLYGON:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolylinePolygon(qshape, &shape);
+                status = msIntersectIndexedPolylinePolygon(qindex, &shape);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2098,6 +2183,7 @@ int msQueryByShape(mapObj *map)
         break;
       }
     } /* next shape */
+    msFreeShapeIndex(qindex);
 
     if(status != MS_DONE) {
       free(classgroup);
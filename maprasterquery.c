@@ -104,15 +104,15 @@ static int addResult(resultCacheObj *cache, int classindex, int shapeindex, int
   int i;
 
   if(cache->numresults == cache->cachesize) { /* just add it to the end */
-    if(cache->cachesize == 0)
-      cache->results = (resultObj *) malloc(sizeof(resultObj)*MS_RESULTCACHEINCREMENT);
-    else
-      cache->results = (resultObj *) realloc(cache->results, sizeof(resultObj)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
-    if(!cache->results) {
+    /* grow geometrically, large result sets would otherwise be copied over and over */
+    int newsize = MS_MAX(cache->cachesize * 2, MS_RESULTCACHEINCREMENT);
+    resultObj *results = (resultObj *) realloc(cache->results, sizeof(resultObj)*newsize);
+    if(!results) {
       msSetError(MS_MEMERR, "Realloc() error.", "addResult()");
       return(MS_FAILURE);
     }
-    cache->cachesize += MS_RESULTCACHEINCREMENT;
+    cache->results = results;
+    cache->cachesize = newsize;
   }
 
   i = cache->numresults;
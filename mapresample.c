@@ -28,9 +28,15 @@
  *****************************************************************************/
 
 #include <assert.h>
+#include <limits.h>
 #include "mapresample.h"
 #include "mapthread.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define MS_RESAMPLE_SSE2
+#endif
+
 
 
 #define SKIP_MASK(x,y) (mask_rb && !*(mask_rb->data.rgba.a+(y)*mask_rb->data.rgba.row_step+(x)*mask_rb->data.rgba.pixel_step))
@@ -74,41 +80,110 @@ int InvGeoTransform( double *gt_in, double *gt_out )
 
 #if defined(USE_PROJ) && defined(USE_GDAL)
 
+/************************************************************************/
+/*                            msResampleJob                             */
+/*                                                                      */
+/*      Arguments of a resampler, applied to the destination rows       */
+/*      nDstYStart to nDstYEnd so the image can be split in bands       */
+/*      resampled by different threads.                                 */
+/************************************************************************/
+
+typedef struct {
+  imageObj *psSrcImage;
+  rasterBufferObj *src_rb;
+  imageObj *psDstImage;
+  rasterBufferObj *dst_rb;
+  SimpleTransformer pfnTransform;
+  void *pCBData;
+  rasterBufferObj *mask_rb;
+  int bWrapAtLeftRight;
+  int nDstYStart, nDstYEnd;
+  int nFailedPoints, nSetPoints;
+} msResampleJob;
+
+typedef void (*msResampler)( msResampleJob *psJob );
+
+/************************************************************************/
+/*                         msSourcePixelIndex()                         */
+/*                                                                      */
+/*      Converts a row of source pixel coordinates to pixel indexes,    */
+/*      truncating them like an (int) cast, or rounding them down like  */
+/*      (int) floor() if bFloor is set.                                 */
+/************************************************************************/
+
+static void msSourcePixelIndex( const double *padfCoord, int nCount,
+                                int bFloor, int *panIndex )
+
+{
+  int i = 0;
+
+#ifdef MS_RESAMPLE_SSE2
+  const __m128i nOverflow = _mm_set1_epi32( INT_MIN );
+
+  for( ; i + 2 <= nCount; i += 2 ) {
+    __m128d dfValue = _mm_loadu_pd( padfCoord + i );
+    __m128i nValue = _mm_cvttpd_epi32( dfValue );
+
+    if( bFloor ) {
+      /* truncation rounded negative values up, take one off, except */
+      /* for the out of range marker that a cast produces too        */
+      __m128i nRoundedUp =
+        _mm_shuffle_epi32( _mm_castpd_si128(
+                             _mm_cmplt_pd( dfValue, _mm_cvtepi32_pd( nValue ) ) ),
+                           _MM_SHUFFLE(3,3,2,0) );
+      nRoundedUp = _mm_andnot_si128( _mm_cmpeq_epi32( nValue, nOverflow ),
+                                     nRoundedUp );
+      nValue = _mm_add_epi32( nValue, nRoundedUp );
+    }
+    _mm_storel_epi64( (__m128i *) (panIndex + i), nValue );
+  }
+#endif
+
+  for( ; i < nCount; i++ )
+    panIndex[i] = bFloor ? (int) floor(padfCoord[i]) : (int) padfCoord[i];
+}
+
 /************************************************************************/
 /*                      msNearestRasterResample()                       */
 /************************************************************************/
 
-static int
-msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                          imageObj *psDstImage, rasterBufferObj *dst_rb,
-                          int *panCMap,
-                          SimpleTransformer pfnTransform, void *pCBData,
-                          int debug, rasterBufferObj *mask_rb,
-                          int bWrapAtLeftRight )
+static void
+msNearestRasterResampler( msResampleJob *psJob )
 
 {
+  imageObj *psSrcImage = psJob->psSrcImage;
+  imageObj *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
+  int   bWrapAtLeftRight = psJob->bWrapAtLeftRight;
   double  *x, *y;
   int   nDstX, nDstY;
-  int         *panSuccess;
+  int         *panSuccess, *panSrcX, *panSrcY;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
   int   nSrcXSize = psSrcImage->width;
   int   nSrcYSize = psSrcImage->height;
   int   nFailedPoints = 0, nSetPoints = 0;
-  assert(!MS_RENDERER_PLUGIN(psSrcImage->format) || src_rb->type == MS_BUFFER_BYTE_RGBA);
+  int   bPlugin = MS_RENDERER_PLUGIN(psSrcImage->format);
+  assert(!bPlugin || src_rb->type == MS_BUFFER_BYTE_RGBA);
 
 
   x = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   y = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   panSuccess = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  panSrcX = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  panSrcY = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  for( nDstY = psJob->nDstYStart; nDstY < psJob->nDstYEnd; nDstY++ ) {
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform( pCBData, nDstXSize, x, y, panSuccess );
+    psJob->pfnTransform( psJob->pCBData, nDstXSize, x, y, panSuccess );
+
+    msSourcePixelIndex( x, nDstXSize, MS_FALSE, panSrcX );
+    msSourcePixelIndex( y, nDstXSize, MS_FALSE, panSrcY );
 
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       int   nSrcX, nSrcY;
@@ -120,8 +195,8 @@ msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
         continue;
       }
 
-      nSrcX = (int) x[nDstX];
-      nSrcY = (int) y[nDstX];
+      nSrcX = panSrcX[nDstX];
+      nSrcY = panSrcY[nDstX];
 
       if( bWrapAtLeftRight && nSrcX >= nSrcXSize && nSrcX < 2 * nSrcXSize )
           nSrcX -= nSrcXSize;
@@ -137,7 +212,7 @@ msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
         continue;
       }
 
-      if( MS_RENDERER_PLUGIN(psSrcImage->format) ) {
+      if( bPlugin ) {
         int src_rb_off;
         rgbaArrayObj *src,*dst;
         assert( src_rb->type == MS_BUFFER_BYTE_RGBA );
@@ -215,20 +290,13 @@ msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   }
 
   free( panSuccess );
+  free( panSrcX );
+  free( panSrcY );
   free( x );
   free( y );
-  msFree(mask_rb);
-
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug ) {
-    msDebug( "msNearestRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
-  }
 
-  return 0;
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
 }
 
 /************************************************************************/
@@ -301,20 +369,20 @@ static void msSourceSample( imageObj *psSrcImage, rasterBufferObj *rb,
 /*                      msBilinearRasterResample()                      */
 /************************************************************************/
 
-static int
-msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                           imageObj *psDstImage, rasterBufferObj *dst_rb,
-                           int *panCMap,
-                           SimpleTransformer pfnTransform, void *pCBData,
-                           int debug, rasterBufferObj *mask_rb,
-                           int bWrapAtLeftRight )
+static void
+msBilinearRasterResampler( msResampleJob *psJob )
 
 {
+  imageObj *psSrcImage = psJob->psSrcImage;
+  imageObj *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
+  int   bWrapAtLeftRight = psJob->bWrapAtLeftRight;
   double  *x, *y;
   int   nDstX, nDstY, i;
-  int         *panSuccess;
+  int         *panSuccess, *panSrcX, *panSrcY;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
   int   nSrcXSize = psSrcImage->width;
   int   nSrcYSize = psSrcImage->height;
   int   nFailedPoints = 0, nSetPoints = 0;
@@ -328,14 +396,28 @@ msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   x = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   y = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   panSuccess = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  panSrcX = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  panSrcY = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  for( nDstY = psJob->nDstYStart; nDstY < psJob->nDstYEnd; nDstY++ ) {
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform( pCBData, nDstXSize, x, y, panSuccess );
+    psJob->pfnTransform( psJob->pCBData, nDstXSize, x, y, panSuccess );
+
+    /*
+    ** Offset to treat TL pixel corners as pixel location instead
+    ** of the center.
+    */
+    for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
+      x[nDstX] -= 0.5;
+      y[nDstX] -= 0.5;
+    }
+
+    msSourcePixelIndex( x, nDstXSize, MS_TRUE, panSrcX );
+    msSourcePixelIndex( y, nDstXSize, MS_TRUE, panSrcY );
 
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       int   nSrcX, nSrcY, nSrcX2, nSrcY2;
@@ -347,15 +429,8 @@ msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
         continue;
       }
 
-      /*
-      ** Offset to treat TL pixel corners as pixel location instead
-      ** of the center.
-      */
-      x[nDstX] -= 0.5;
-      y[nDstX] -= 0.5;
-
-      nSrcX = (int) floor(x[nDstX]);
-      nSrcY = (int) floor(y[nDstX]);
+      nSrcX = panSrcX[nDstX];
+      nSrcY = panSrcY[nDstX];
 
       nSrcX2 = nSrcX+1;
       nSrcY2 = nSrcY+1;
@@ -448,21 +523,13 @@ msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
 
   free( padfPixelSum );
   free( panSuccess );
+  free( panSrcX );
+  free( panSrcY );
   free( x );
   free( y );
-  msFree(mask_rb);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug )
-  {
-    msDebug( "msBilinearRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
-  }
-
-  return 0;
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
 }
 
 /************************************************************************/
@@ -522,19 +589,21 @@ msAverageSample( imageObj *psSrcImage, rasterBufferObj *src_rb,
 /*                      msAverageRasterResample()                       */
 /************************************************************************/
 
-static int
-msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                          imageObj *psDstImage, rasterBufferObj *dst_rb,
-                          int *panCMap,
-                          SimpleTransformer pfnTransform, void *pCBData,
-                          int debug, rasterBufferObj *mask_rb )
+static void
+msAverageRasterResampler( msResampleJob *psJob )
 
 {
+  imageObj *psSrcImage = psJob->psSrcImage;
+  imageObj *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
+  SimpleTransformer pfnTransform = psJob->pfnTransform;
+  void *pCBData = psJob->pCBData;
   double  *x1, *y1, *x2, *y2;
   int   nDstX, nDstY;
   int         *panSuccess1, *panSuccess2;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
   int   nFailedPoints = 0, nSetPoints = 0;
   double     *padfPixelSum;
 
@@ -551,7 +620,7 @@ msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   panSuccess1 = (int *) msSmallMalloc( sizeof(int) * (nDstXSize+1) );
   panSuccess2 = (int *) msSmallMalloc( sizeof(int) * (nDstXSize+1) );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  for( nDstY = psJob->nDstYStart; nDstY < psJob->nDstYEnd; nDstY++ ) {
     for( nDstX = 0; nDstX <= nDstXSize; nDstX++ ) {
       x1[nDstX] = nDstX;
       y1[nDstX] = nDstY;
@@ -648,16 +717,93 @@ msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   free( panSuccess2 );
   free( x2 );
   free( y2 );
-  msFree(mask_rb);
+
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
+}
+
+#ifdef USE_THREAD
+typedef struct {
+  msResampler pfnResampler;
+  msResampleJob sJob;
+  void *hThread;
+} msResampleBand;
+
+static void msResampleBandThread( void *pArg )
+
+{
+  msResampleBand *psBand = (msResampleBand *) pArg;
+
+  psBand->pfnResampler( &(psBand->sJob) );
+}
+#endif
+
+/************************************************************************/
+/*                           msRunResampler()                           */
+/*                                                                      */
+/*      Applies pfnResampler to the whole destination image, split      */
+/*      in up to nThreads bands of rows resampled concurrently.         */
+/*      Every destination pixel only depends on its own transformed     */
+/*      location, so the result does not depend on the split.           */
+/************************************************************************/
+
+static int msRunResampler( msResampler pfnResampler, const char *pszName,
+                           msResampleJob *psJob, int nThreads, int debug )
+
+{
+  int nDstYSize = psJob->psDstImage->height;
+
+  psJob->nDstYStart = 0;
+  psJob->nDstYEnd = nDstYSize;
+  psJob->nFailedPoints = psJob->nSetPoints = 0;
+
+#ifdef USE_THREAD
+  if( nThreads > 1 && nDstYSize > 1 ) {
+    msResampleBand *pasBands;
+    int i, nBands, nBandHeight;
+
+    /* Bands start on a multiple of 32 rows, so that they never share a */
+    /* word of the raw data image mask.                                 */
+    nBandHeight = (nDstYSize + nThreads - 1) / nThreads;
+    nBandHeight = (nBandHeight + 31) & ~31;
+    nBands = (nDstYSize + nBandHeight - 1) / nBandHeight;
+
+    pasBands = (msResampleBand *) msSmallCalloc(nBands, sizeof(msResampleBand));
+    for( i = 0; i < nBands; i++ ) {
+      pasBands[i].pfnResampler = pfnResampler;
+      pasBands[i].sJob = *psJob;
+      pasBands[i].sJob.nDstYStart = i * nBandHeight;
+      pasBands[i].sJob.nDstYEnd = MS_MIN(nDstYSize, (i+1) * nBandHeight);
+      if( i > 0 )
+        pasBands[i].hThread = msThreadCreate( msResampleBandThread, pasBands + i );
+    }
+
+    /* the calling thread resamples the first band, and the bands no */
+    /* thread could be started for                                   */
+    for( i = 0; i < nBands; i++ ) {
+      if( i == 0 || pasBands[i].hThread == NULL )
+        pfnResampler( &(pasBands[i].sJob) );
+    }
+    for( i = 0; i < nBands; i++ ) {
+      if( pasBands[i].hThread != NULL )
+        msThreadJoin( pasBands[i].hThread );
+      psJob->nFailedPoints += pasBands[i].sJob.nFailedPoints;
+      psJob->nSetPoints += pasBands[i].sJob.nSetPoints;
+    }
+    free( pasBands );
+  } else
+#endif
+    pfnResampler( psJob );
+
+  msFree( psJob->mask_rb );
 
   /* -------------------------------------------------------------------- */
   /*      Some debugging output.                                          */
   /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug )
+  if( psJob->nFailedPoints > 0 && debug )
   {
-    msDebug( "msAverageRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
+    msDebug( "%s: %d failed to transform, %d actually set.\n",
+             pszName, psJob->nFailedPoints, psJob->nSetPoints );
   }
 
   return 0;
@@ -710,6 +856,7 @@ void *msInitProjTransformer( projectionObj *psSrc,
   /*      transformation for more convenient inverse application in       */
   /*      the transformer.                                                */
   /* -------------------------------------------------------------------- */
+  psPTInfo->psSrcProjObj = psSrc;
   psPTInfo->psSrcProj = psSrc->proj;
   if( psPTInfo->bUseProj )
     psPTInfo->bSrcIsGeographic = pj_is_latlong(psSrc->proj);
@@ -725,6 +872,7 @@ void *msInitProjTransformer( projectionObj *psSrc,
   /* -------------------------------------------------------------------- */
   /*      Record destination image information.                           */
   /* -------------------------------------------------------------------- */
+  psPTInfo->psDstProjObj = psDst;
   psPTInfo->psDstProj = psDst->proj;
   if( psPTInfo->bUseProj )
     psPTInfo->bDstIsGeographic = pj_is_latlong(psDst->proj);
@@ -757,6 +905,7 @@ int msProjTransformer( void *pCBData, int nPoints,
   int   i;
   msProjTransformInfo *psPTInfo = (msProjTransformInfo*) pCBData;
   double  x_out;
+  int   bProjected = MS_FALSE;
 
   /* -------------------------------------------------------------------- */
   /*      Transform into destination georeferenced space.                 */
@@ -773,10 +922,27 @@ int msProjTransformer( void *pCBData, int nPoints,
     panSuccess[i] = 1;
   }
 
+#ifdef USE_PROJ_API_6
+  /* -------------------------------------------------------------------- */
+  /*      Transform back to source projection space in one batch through  */
+  /*      the cached PROJ 6 transformation, which works in degrees.       */
+  /* -------------------------------------------------------------------- */
+  if( psPTInfo->bUseProj
+      && msProjectTransformPoints( psPTInfo->psDstProjObj,
+                                   psPTInfo->psSrcProjObj, nPoints,
+                                   x, y, sizeof(double) ) == MS_SUCCESS ) {
+    bProjected = MS_TRUE;
+    for( i = 0; i < nPoints; i++ ) {
+      if( x[i] == HUGE_VAL || y[i] == HUGE_VAL )
+        panSuccess[i] = 0;
+    }
+  }
+#endif
+
   /* -------------------------------------------------------------------- */
   /*      Transform from degrees to radians if geographic.                */
   /* -------------------------------------------------------------------- */
-  if( psPTInfo->bDstIsGeographic ) {
+  if( !bProjected && psPTInfo->bDstIsGeographic ) {
     for( i = 0; i < nPoints; i++ ) {
       x[i] = x[i] * DEG_TO_RAD;
       y[i] = y[i] * DEG_TO_RAD;
@@ -786,7 +952,7 @@ int msProjTransformer( void *pCBData, int nPoints,
   /* -------------------------------------------------------------------- */
   /*      Transform back to source projection space.                      */
   /* -------------------------------------------------------------------- */
-  if( psPTInfo->bUseProj ) {
+  if( !bProjected && psPTInfo->bUseProj ) {
     double *z;
     int tr_result;
 
@@ -815,7 +981,7 @@ int msProjTransformer( void *pCBData, int nPoints,
   /* -------------------------------------------------------------------- */
   /*      Transform back to degrees if source is geographic.              */
   /* -------------------------------------------------------------------- */
-  if( psPTInfo->bSrcIsGeographic ) {
+  if( !bProjected && psPTInfo->bSrcIsGeographic ) {
     for( i = 0; i < nPoints; i++ ) {
       if( panSuccess[i] ) {
         x[i] = x[i] * RAD_TO_DEG;
@@ -1290,7 +1456,8 @@ int msResampleGDALToMap( mapObj *map, layerObj *layer, imageObj *image,
   imageObj   *srcImage;
   void  *pTCBData;
   void  *pACBData;
-  int         anCMap[256];
+  msResampleJob sJob;
+  int         nThreads = 1;
   char       **papszAlteredProcessing = NULL;
   int         nLoadImgXSize, nLoadImgYSize;
   double      dfOversampleRatio;
@@ -1711,23 +1878,32 @@ int msResampleGDALToMap( mapObj *map, layerObj *layer, imageObj *image,
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Perform the resampling.                                         */
-  /* -------------------------------------------------------------------- */
-  if( EQUAL(resampleMode,"AVERAGE") )
-    result =
-      msAverageRasterResampler( srcImage, psrc_rb, image, rb,
-                                anCMap, msApproxTransformer, pACBData,
-                                layer->debug, mask_rb );
-  else if( EQUAL(resampleMode,"BILINEAR") )
-    result =
-      msBilinearRasterResampler( srcImage, psrc_rb, image, rb,
-                                 anCMap, msApproxTransformer, pACBData,
-                                 layer->debug, mask_rb, bWrapAtLeftRight );
+  /*      Perform the resampling, in bands of rows spread over            */
+  /*      RESAMPLE_THREADS threads if requested.                          */
+  /* -------------------------------------------------------------------- */
+  memset( &sJob, 0, sizeof(sJob) );
+  sJob.psSrcImage = srcImage;
+  sJob.src_rb = psrc_rb;
+  sJob.psDstImage = image;
+  sJob.dst_rb = rb;
+  sJob.pfnTransform = msApproxTransformer;
+  sJob.pCBData = pACBData;
+  sJob.mask_rb = mask_rb;
+  sJob.bWrapAtLeftRight = bWrapAtLeftRight;
+
+  if( CSLFetchNameValue( layer->processing, "RESAMPLE_THREADS" ) != NULL )
+    nThreads = MS_MIN(atoi(CSLFetchNameValue( layer->processing, "RESAMPLE_THREADS" )), MS_MAX_THREADS);
+
+  if( EQUAL(resampleMode,"AVERAGE") ) {
+    sJob.bWrapAtLeftRight = MS_FALSE;
+    result = msRunResampler( msAverageRasterResampler, "msAverageRasterResampler",
+                             &sJob, nThreads, layer->debug );
+  } else if( EQUAL(resampleMode,"BILINEAR") )
+    result = msRunResampler( msBilinearRasterResampler, "msBilinearRasterResampler",
+                             &sJob, nThreads, layer->debug );
   else
-    result =
-      msNearestRasterResampler( srcImage, psrc_rb, image, rb,
-                                anCMap, msApproxTransformer, pACBData,
-                                layer->debug, mask_rb, bWrapAtLeftRight );
+    result = msRunResampler( msNearestRasterResampler, "msNearestRasterResampler",
+                             &sJob, nThreads, layer->debug );
 
   /* -------------------------------------------------------------------- */
   /*      cleanup                                                         */
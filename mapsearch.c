@@ -33,6 +33,8 @@
  * DEALINGS IN THE SOFTWARE.
  ****************************************************************************/
 
+#include <float.h>
+
 #include "mapserver.h"
 
 
@@ -309,6 +311,287 @@ int msIntersectPolygons(shapeObj *p1, shapeObj *p2)
   return(MS_FALSE);
 }
 
+/*
+** Segment index for shapes tested against many others, typically the
+** selection shape of a query. The edges are bucketed into horizontal bands
+** over the vertical extent of the shape so the functions below only look at
+** the edges sharing a band with the point or segment at hand, using the same
+** crossing and segment tests as the brute force versions above.
+*/
+struct shapeIndexSegmentObj {
+  pointObj *a, *b; /* previous and current vertex, as in msPointInPolygon() */
+  double minx, miny, maxx, maxy;
+  int closing; /* last to first vertex, only counts for point in polygon tests */
+};
+
+static int shapeIndexBand(shapeIndexObj *index, double y)
+{
+  int band;
+
+  if(y <= index->miny) return 0;
+  band = (int) ((y - index->miny) / index->bandheight);
+  return MS_MIN(band, index->numbands-1);
+}
+
+/*
+** Walks the edges of the shape, counting the bands each one spans. Band
+** counts are accumulated in counts and, if next is set, the edges are
+** stored at the offsets it holds. Returns the total number of entries.
+*/
+static int shapeIndexFill(shapeIndexObj *index, int *counts, int *next)
+{
+  int i, j, band, first, last, numentries = 0;
+  shapeIndexSegmentObj segment;
+  lineObj *line;
+
+  for(i=0; i<index->shape->numlines; i++) {
+    line = &(index->shape->line[i]);
+    if(line->numpoints < 2) continue; /* can't cross anything */
+    for(j=0; j<line->numpoints; j++) {
+      segment.a = &(line->point[(j == 0) ? line->numpoints-1 : j-1]);
+      segment.b = &(line->point[j]);
+      segment.minx = MS_MIN(segment.a->x, segment.b->x);
+      segment.maxx = MS_MAX(segment.a->x, segment.b->x);
+      segment.miny = MS_MIN(segment.a->y, segment.b->y);
+      segment.maxy = MS_MAX(segment.a->y, segment.b->y);
+      segment.closing = (j == 0);
+
+      first = shapeIndexBand(index, segment.miny);
+      last = shapeIndexBand(index, segment.maxy);
+      numentries += last - first + 1;
+      for(band=first; band<=last; band++) {
+        if(counts) counts[band]++;
+        if(next) index->segments[next[band]++] = segment;
+      }
+    }
+  }
+
+  return numentries;
+}
+
+shapeIndexObj *msCreateShapeIndex(shapeObj *shape)
+{
+  shapeIndexObj *index;
+  int i, j, numsegments = 0, numentries, *next;
+
+  index = (shapeIndexObj *) msSmallCalloc(1, sizeof(shapeIndexObj));
+  index->shape = shape;
+  index->miny = DBL_MAX;
+  index->maxy = -DBL_MAX;
+
+  for(i=0; i<shape->numlines; i++) {
+    if(shape->line[i].numpoints < 2) continue;
+    numsegments += shape->line[i].numpoints;
+    for(j=0; j<shape->line[i].numpoints; j++) {
+      index->miny = MS_MIN(index->miny, shape->line[i].point[j].y);
+      index->maxy = MS_MAX(index->maxy, shape->line[i].point[j].y);
+    }
+  }
+
+  /* a few edges per band, but fewer bands when long edges would fill too many of them */
+  index->numbands = MS_MAX(1, MS_MIN(numsegments/4, 65536));
+  while(1) {
+    index->bandheight = (index->maxy > index->miny) ? (index->maxy - index->miny) / index->numbands : 1;
+    numentries = shapeIndexFill(index, NULL, NULL);
+    if(index->numbands == 1 || numentries <= 8 * numsegments) break;
+    index->numbands = MS_MAX(1, index->numbands / 4);
+  }
+
+  index->bands = (int *) msSmallCalloc(index->numbands + 1, sizeof(int));
+  index->segments = (shapeIndexSegmentObj *) msSmallMalloc(MS_MAX(1, numentries) * sizeof(shapeIndexSegmentObj));
+
+  /* count the entries of each band, turn the counts into offsets and fill */
+  next = (int *) msSmallCalloc(index->numbands, sizeof(int));
+  shapeIndexFill(index, next, NULL);
+  for(i=0; i<index->numbands; i++) {
+    index->bands[i+1] = index->bands[i] + next[i];
+    next[i] = index->bands[i];
+  }
+  shapeIndexFill(index, NULL, next);
+  free(next);
+
+  return index;
+}
+
+void msFreeShapeIndex(shapeIndexObj *index)
+{
+  if(!index) return;
+  free(index->bands);
+  free(index->segments);
+  free(index);
+}
+
+/*
+** Does segment ab intersect one of the (non closing) edges of the indexed
+** shape? The index edge is passed second to msIntersectSegments() unless
+** indexfirst is set, to keep the argument order of the brute force tests.
+*/
+static int shapeIndexIntersectSegment(shapeIndexObj *index, pointObj *a, pointObj *b, int indexfirst)
+{
+  int band, last, k, degenerate;
+  double minx, miny, maxx, maxy;
+  shapeIndexSegmentObj *segment;
+
+  miny = MS_MIN(a->y, b->y);
+  maxy = MS_MAX(a->y, b->y);
+  if(maxy < index->miny || miny > index->maxy) return MS_FALSE;
+  minx = MS_MIN(a->x, b->x);
+  maxx = MS_MAX(a->x, b->x);
+  degenerate = (minx == maxx && miny == maxy);
+
+  last = shapeIndexBand(index, maxy);
+  for(band=shapeIndexBand(index, miny); band<=last; band++) {
+    for(k=index->bands[band]; k<index->bands[band+1]; k++) {
+      segment = &(index->segments[k]);
+      if(segment->closing || segment->maxy < miny || segment->miny > maxy)
+        continue;
+      /* msIntersectSegments() only looks at the y's of zero length segments, so those skip the x test */
+      if((segment->maxx < minx || segment->minx > maxx) && !degenerate && !(segment->minx == segment->maxx && segment->miny == segment->maxy))
+        continue;
+      if(indexfirst) {
+        if(msIntersectSegments(segment->a, segment->b, a, b) == MS_TRUE)
+          return MS_TRUE;
+      } else {
+        if(msIntersectSegments(a, b, segment->a, segment->b) == MS_TRUE)
+          return MS_TRUE;
+      }
+    }
+  }
+
+  return MS_FALSE;
+}
+
+static int shapeIndexIntersectPolylines(shapeObj *line, shapeIndexObj *index, int indexfirst)
+{
+  int c, v;
+
+  for(c=0; c<line->numlines; c++)
+    for(v=1; v<line->line[c].numpoints; v++)
+      if(shapeIndexIntersectSegment(index, &(line->line[c].point[v-1]), &(line->line[c].point[v]), indexfirst) == MS_TRUE)
+        return MS_TRUE;
+
+  return MS_FALSE;
+}
+
+/*
+** Same as msIntersectPointPolygon(): the parity of the crossings over all
+** the rings, which are all found in the band of the point.
+*/
+int msIntersectPointPolygonIndexed(pointObj *p, shapeIndexObj *poly)
+{
+  int band, k, status = MS_FALSE;
+  pointObj *a, *b;
+
+  if(p->y < poly->miny || p->y >= poly->maxy) return MS_FALSE;
+
+  band = shapeIndexBand(poly, p->y);
+  for(k=poly->bands[band]; k<poly->bands[band+1]; k++) {
+    a = poly->segments[k].a;
+    b = poly->segments[k].b;
+    if((((b->y<=p->y) && (p->y<a->y)) || ((a->y<=p->y) && (p->y<b->y))) && (p->x < (a->x - b->x) * (p->y - b->y) / (a->y - b->y) + b->x))
+      status = !status;
+  }
+
+  return status;
+}
+
+int msIntersectMultipointPolygonIndexed(shapeObj *multipoint, shapeIndexObj *poly)
+{
+  int i,j;
+
+  for(i=0; i<multipoint->numlines; i++) {
+    for(j=0; j<multipoint->line[i].numpoints; j++) {
+      if(msIntersectPointPolygonIndexed(&(multipoint->line[i].point[j]), poly) == MS_TRUE)
+        return(MS_TRUE);
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+/*
+** Is one of the points closer than tolerance to the indexed polygon (or in
+** it)? Same as testing msDistanceShapeToShape(polygon, multipoint) < tolerance.
+*/
+int msMultipointNearPolygonIndexed(shapeObj *multipoint, shapeIndexObj *poly, double tolerance)
+{
+  int i, j, band, last, k;
+  pointObj *p;
+  shapeIndexSegmentObj *segment;
+
+  if(msIntersectMultipointPolygonIndexed(multipoint, poly) == MS_TRUE)
+    return(MS_TRUE);
+
+  for(i=0; i<multipoint->numlines; i++) {
+    for(j=0; j<multipoint->line[i].numpoints; j++) {
+      p = &(multipoint->line[i].point[j]);
+      if(p->y + tolerance < poly->miny || p->y - tolerance > poly->maxy) continue;
+      last = shapeIndexBand(poly, p->y + tolerance);
+      for(band=shapeIndexBand(poly, p->y - tolerance); band<=last; band++) {
+        for(k=poly->bands[band]; k<poly->bands[band+1]; k++) {
+          segment = &(poly->segments[k]);
+          if(segment->closing || segment->minx - tolerance > p->x || segment->maxx + tolerance < p->x)
+            continue;
+          if(sqrt(msSquareDistancePointToSegment(p, segment->a, segment->b)) < tolerance)
+            return(MS_TRUE);
+        }
+      }
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+/* msIntersectPolylines() with line2 indexed */
+int msIntersectPolylinesIndexed(shapeObj *line1, shapeIndexObj *line2)
+{
+  return shapeIndexIntersectPolylines(line1, line2, MS_FALSE);
+}
+
+/* msIntersectPolylinePolygon() with the polygon indexed */
+int msIntersectPolylinePolygonIndexed(shapeObj *line, shapeIndexObj *poly)
+{
+  int i;
+
+  for(i=0; i<line->numlines; i++) {
+    if(msIntersectPointPolygonIndexed(&(line->line[i].point[0]), poly) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  return shapeIndexIntersectPolylines(line, poly, MS_FALSE);
+}
+
+/* msIntersectPolylinePolygon() with the polyline indexed */
+int msIntersectIndexedPolylinePolygon(shapeIndexObj *line, shapeObj *poly)
+{
+  int i;
+
+  for(i=0; i<line->shape->numlines; i++) {
+    if(msIntersectPointPolygon(&(line->shape->line[i].point[0]), poly) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  return shapeIndexIntersectPolylines(poly, line, MS_TRUE);
+}
+
+/* msIntersectPolygons() with p2 indexed */
+int msIntersectPolygonsIndexed(shapeObj *p1, shapeIndexObj *p2)
+{
+  int i;
+
+  for(i=0; i<p2->shape->numlines; i++) {
+    if(msIntersectPointPolygon(&(p2->shape->line[i].point[0]), p1) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  for(i=0; i<p1->numlines; i++) {
+    if(msIntersectPointPolygonIndexed(&(p1->line[i].point[0]), p2) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  return shapeIndexIntersectPolylines(p1, p2, MS_FALSE);
+}
+
 
 /*
 ** Distance computations
@@ -237,6 +237,7 @@ extern "C" {
 #define MS_TEMPLATE_EXPR "\\.(xml|wml|html|htm|svg|kml|gml|js|tmpl)$"
 
 #define MS_INDEX_EXTENSION ".qix"
+#define MS_HRTREE_INDEX_EXTENSION ".hix"
 
 #define MS_QUERY_RESULTS_MAGIC_STRING "MapServer Query Results"
 #define MS_QUERY_PARAMS_MAGIC_STRING "MapServer Query Params"
@@ -282,6 +283,8 @@ extern "C" {
 
 #define MS_LABELCACHEINITSIZE 100
 #define MS_LABELCACHEINCREMENT 10
+#define MS_LABELCACHEGRIDCELLSIZE 64 /* pixels */
+#define MS_LABELCACHEGRIDMAXCELLS 512 /* per axis */
 
 #define MS_RESULTCACHEINITSIZE 10
 #define MS_RESULTCACHEINCREMENT 10
@@ -1299,6 +1302,36 @@ typedef struct labelObj labelObj;
     int markercachesize;
   } labelCacheSlotObj;
 
+#ifndef SWIG
+  /************************************************************************/
+  /*                         labelCacheGridObj                            */
+  /*                                                                      */
+  /*      Uniform grid over the image used to find the rendered labels    */
+  /*      and markers a candidate label may collide with.                 */
+  /************************************************************************/
+  typedef struct {
+    int index; /* rendered member or marker index */
+    int priority; /* slot of the marker, unused for rendered members */
+    int mincol, minrow; /* first cell covered, so an entry is reported once per search */
+    int next; /* next entry in the same cell, -1 terminates the list */
+  } labelCacheGridEntryObj;
+
+  typedef struct {
+    int cellsize; /* in pixels, 0 until the grid is first used */
+    int numcols, numrows;
+    int *cells; /* first entry of each cell, -1 if empty */
+    labelCacheGridEntryObj *entries;
+    int numentries;
+    int numallocatedentries;
+  } labelCacheGridObj;
+
+  typedef struct {
+    labelCacheGridObj *grid;
+    int mincol, maxcol, minrow, maxrow;
+    int col, row, entry;
+  } labelCacheGridSearchObj;
+#endif /* not SWIG */
+
   /************************************************************************/
   /*                            labelCacheObj                             */
   /************************************************************************/
@@ -1309,6 +1342,13 @@ typedef struct labelObj labelObj;
     labelCacheMemberObj **rendered_text_symbols;
     int num_allocated_rendered_members;
     int num_rendered_members;
+#ifndef SWIG
+    labelCacheGridObj rendered_grid; /* index of rendered_text_symbols */
+    labelCacheGridObj marker_grid; /* index of the markers of all slots */
+    int num_indexed_markers[MS_MAX_LABEL_PRIORITY];
+    void **fontcaches; /* detached font caches the cached glyphs point into */
+    int numfontcaches;
+#endif /* not SWIG */
   } labelCacheObj;
 
   /************************************************************************/
@@ -1712,6 +1752,9 @@ typedef struct labelObj labelObj;
     /* SDL has converted OracleSpatial, SDE, Graticules */
     void *layerinfo; /* all connection types should use this generic pointer to a vendor specific structure */
     void *wfslayerinfo; /* For WFS layers, will contain a msWFSLayerInfo struct */
+    void *classlookup; /* compiled class expressions, built by msShapeGetClass() */
+    labelCacheObj *drawlabelcache; /* private label cache while drawn by a worker thread, see msDrawMap() */
+    projApproxGridObj *approxgrid; /* approximate reprojection while drawn, see msDrawVectorLayer() */
 #endif /* not SWIG */
 
     /* attribute/classification handling components */
@@ -1798,6 +1841,10 @@ typedef struct labelObj labelObj;
 #ifndef SWIG
 void msFontCacheSetup();
 void msFontCacheCleanup();
+#ifdef USE_THREAD
+void* msFontCacheDetach();
+void msFontCacheRelease(void *cache);
+#endif
 
 typedef struct {
   double minx,miny,maxx,maxy,advance;
@@ -2114,6 +2161,8 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msGetLayerIndex(mapObj *map, const char *name);
   MS_DLL_EXPORT int msGetSymbolIndex(symbolSetObj *set, char *name, int try_addimage_if_notfound);
   MS_DLL_EXPORT mapObj  *msLoadMap(char *filename, char *new_mappath);
+  MS_DLL_EXPORT mapObj  *msLoadMapCached(char *filename, char *new_mappath);
+  MS_DLL_EXPORT void msMapCacheCleanup(void);
   MS_DLL_EXPORT int msTransformXmlMapfile(const char *stylesheet, const char *xmlMapfile, FILE *tmpfile);
   MS_DLL_EXPORT int msSaveMap(mapObj *map, char *filename);
   MS_DLL_EXPORT void msFreeCharArray(char **array, int num_items);
@@ -2192,6 +2241,28 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msIntersectPolygons(shapeObj *p1, shapeObj *p2);
   MS_DLL_EXPORT int msIntersectPolylines(shapeObj *line1, shapeObj *line2);
 
+#ifndef SWIG
+  typedef struct shapeIndexSegmentObj shapeIndexSegmentObj;
+
+  typedef struct { /* edges of a shape bucketed in horizontal bands, see mapsearch.c */
+    shapeObj *shape;
+    double miny, maxy, bandheight;
+    int numbands;
+    int *bands; /* numbands+1 offsets into segments */
+    shapeIndexSegmentObj *segments;
+  } shapeIndexObj;
+
+  MS_DLL_EXPORT shapeIndexObj *msCreateShapeIndex(shapeObj *shape);
+  MS_DLL_EXPORT void msFreeShapeIndex(shapeIndexObj *index);
+  MS_DLL_EXPORT int msIntersectPointPolygonIndexed(pointObj *p, shapeIndexObj *poly);
+  MS_DLL_EXPORT int msIntersectMultipointPolygonIndexed(shapeObj *multipoint, shapeIndexObj *poly);
+  MS_DLL_EXPORT int msMultipointNearPolygonIndexed(shapeObj *multipoint, shapeIndexObj *poly, double tolerance);
+  MS_DLL_EXPORT int msIntersectPolylinesIndexed(shapeObj *line1, shapeIndexObj *line2);
+  MS_DLL_EXPORT int msIntersectPolylinePolygonIndexed(shapeObj *line, shapeIndexObj *poly);
+  MS_DLL_EXPORT int msIntersectIndexedPolylinePolygon(shapeIndexObj *line, shapeObj *poly);
+  MS_DLL_EXPORT int msIntersectPolygonsIndexed(shapeObj *p1, shapeIndexObj *p2);
+#endif
+
   MS_DLL_EXPORT int msInitQuery(queryObj *query); /* in mapquery.c */
   MS_DLL_EXPORT void msFreeQuery(queryObj *query);
   MS_DLL_EXPORT int msSaveQuery(mapObj *map, char *filename, int results);
@@ -2334,9 +2405,13 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
 
   MS_DLL_EXPORT int WARN_UNUSED msAddLabel(mapObj *map, imageObj *image, labelObj *label, int layerindex, int classindex, shapeObj *shape, pointObj *point, double featuresize, textSymbolObj *ts);
   MS_DLL_EXPORT int WARN_UNUSED msAddLabelGroup(mapObj *map, imageObj *image, layerObj *layer, int classindex, shapeObj *shape, pointObj *point, double featuresize);
+  MS_DLL_EXPORT int msMergeLabelCache(labelCacheObj *dst, labelCacheObj *src);
   MS_DLL_EXPORT void insertRenderedLabelMember(mapObj *map, labelCacheMemberObj *cachePtr);
   MS_DLL_EXPORT int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, label_bounds *lb, int current_priority, int current_label);
   MS_DLL_EXPORT int msTestLabelCacheLeaderCollision(mapObj *map, pointObj *lp1, pointObj *lp2);
+  MS_DLL_EXPORT void msFreeLabelCacheGrid(labelCacheGridObj *grid);
+  MS_DLL_EXPORT void msLabelCacheGridSearchInit(labelCacheGridSearchObj *search, labelCacheGridObj *grid, const rectObj *rect);
+  MS_DLL_EXPORT labelCacheGridEntryObj *msLabelCacheGridSearchNext(labelCacheGridSearchObj *search);
   MS_DLL_EXPORT labelCacheMemberObj *msGetLabelCacheMember(labelCacheObj *labelcache, int i);
 
   MS_DLL_EXPORT void msFreeShape(shapeObj *shape); /* in mapprimitive.c */
@@ -2636,6 +2711,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   /* in interpolation.c */
   MS_DLL_EXPORT int msComputeKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void **hDSvoid, void **cleanup_ptr);
   MS_DLL_EXPORT int msCleanupKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void *cleanup_ptr);
+  MS_DLL_EXPORT void msKernelDensityBlur(float *values, int width, int height, int radius, int use_box_blur, int nthreads);
 
   /* in mapchart.c */
   MS_DLL_EXPORT int msDrawChartLayer(mapObj *map, layerObj *layer, imageObj *image);
@@ -2740,6 +2816,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msCheckParentPointer(void* p, char* objname);
 
   MS_DLL_EXPORT int *msAllocateValidClassGroups(layerObj *lp, int *nclasses);
+  MS_DLL_EXPORT void msFreeClassLookup(layerObj *layer);
 
   MS_DLL_EXPORT void msFreeRasterBuffer(rasterBufferObj *b);
   MS_DLL_EXPORT void msSetLayerOpacity(layerObj *layer, int opacity);
@@ -3063,6 +3140,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msPopulateRendererVTableMVT( rendererVTableObj *renderer );
 
   MS_DLL_EXPORT int msMVTWriteTile( mapObj *map, int sendheaders );
+  MS_DLL_EXPORT int msMVTWriteTiles( mapObj *map, const rectObj *extents, char **names, int numtiles, int sendheaders );
 
 #ifdef USE_CAIRO
   MS_DLL_EXPORT void msCairoCleanup(void);
@@ -3084,6 +3162,8 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
                              rgbaPixel *forced_palette, int num_forced_palette_entries,
                              unsigned int *palette_scaling_maxval);
   int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb);
+  int msQuantizeRasterBufferCached(rasterBufferObj *rb, rasterBufferObj *qrb, const char *key, int maxuses);
+  void msPaletteCacheCleanup(void);
   int msSaveRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream, outputFormatObj *format);
   int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer, outputFormatObj *format);
   int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb);
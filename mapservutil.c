@@ -188,6 +188,20 @@ static void setClassGroup(layerObj *layer, char *classgroup)
   }
 }
 
+/*
+** Loads a mapfile, going through the parsed mapfile cache when the MS_MAP_CACHE
+** environment variable is set (only useful for long running FastCGI processes).
+*/
+static mapObj *msCGILoadMapFile(char *filename)
+{
+  const char *cache = getenv("MS_MAP_CACHE");
+
+  if(cache && (strcasecmp(cache, "ON") == 0 || strcasecmp(cache, "YES") == 0 || strcasecmp(cache, "TRUE") == 0))
+    return msLoadMapCached(filename, NULL);
+
+  return msLoadMap(filename, NULL);
+}
+
 /*
 ** Extract Map File name from params and load it.
 ** Returns map object or NULL on error.
@@ -203,14 +217,14 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
   if(i == mapserv->request->NumParams) {
     char *ms_mapfile = getenv("MS_MAPFILE");
     if(ms_mapfile) {
-      map = msLoadMap(ms_mapfile,NULL);
+      map = msCGILoadMapFile(ms_mapfile);
     } else {
       msSetError(MS_WEBERR, "CGI variable \"map\" is not set.", "msCGILoadMap()"); /* no default, outta here */
       return NULL;
     }
   } else {
     if(getenv(mapserv->request->ParamValues[i])) /* an environment variable references the actual file to use */
-      map = msLoadMap(getenv(mapserv->request->ParamValues[i]), NULL);
+      map = msCGILoadMapFile(getenv(mapserv->request->ParamValues[i]));
     else {
       /* by here we know the request isn't for something in an environment variable */
       if(getenv("MS_MAP_NO_PATH")) {
@@ -224,7 +238,7 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
       }
 
       /* ok to try to load now */
-      map = msLoadMap(mapserv->request->ParamValues[i], NULL);
+      map = msCGILoadMapFile(mapserv->request->ParamValues[i]);
     }
   }
   
@@ -1491,6 +1505,68 @@ int msCGIDispatchQueryRequest(mapservObj *mapserv)
   return MS_SUCCESS;
 }
 
+static void msCGISendImageHeaders(mapservObj *mapserv)
+{
+  /*
+   ** Set the Cache control headers if the option is set.
+   */
+  if( mapserv->sendheaders && msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age") ) {
+    msIO_setHeader("Cache-Control","max-age=%s", msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age"));
+  }
+
+  if(mapserv->sendheaders)  {
+    const char *attachment = msGetOutputFormatOption(mapserv->map->outputformat, "ATTACHMENT", NULL );
+    if(attachment)
+      msIO_setHeader("Content-disposition","attachment; filename=%s", attachment);
+
+    if(!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat), "application/json")) {
+      msIO_setHeader("Content-Type","application/json; charset=utf-8");
+    } else {
+      msIO_setHeader("Content-Type","%s", MS_IMAGE_MIME_TYPE(mapserv->map->outputformat));
+    }
+    msIO_sendHeaders();
+  }
+}
+
+/*
+** Tiles are encoded to memory before being sent, so that they can be written
+** back to the tile cache and carry an ETag computed from their content. A
+** request whose If-None-Match lists that ETag gets a 304 without the image.
+*/
+static int msCGIDispatchTileRequest(mapservObj *mapserv)
+{
+  unsigned char *data;
+  const char *match;
+  char etag[32];
+  int size, status;
+
+  if((data = msTileGetCached(mapserv, &size)) == NULL) {
+    imageObj *img = msTileDraw(mapserv);
+    if(!img) return MS_FAILURE;
+    data = msTileEncodeImage(mapserv->map, img, &size);
+    msFreeImage(img);
+    if(!data) return MS_FAILURE;
+    msTilePutCached(mapserv, data, size);
+  }
+
+  msTileGetETag(data, size, etag);
+  match = getenv("HTTP_IF_NONE_MATCH");
+  if(mapserv->sendheaders && match && (strstr(match, etag) || strcmp(match, "*") == 0)) {
+    msIO_setHeader("Status", "304 Not Modified");
+    msIO_setHeader("ETag", "%s", etag);
+    msCGISendImageHeaders(mapserv);
+    msFree(data);
+    return MS_SUCCESS;
+  }
+
+  if(mapserv->sendheaders)
+    msIO_setHeader("ETag", "%s", etag);
+  msCGISendImageHeaders(mapserv);
+  status = (msIO_fwrite(data, 1, size, stdout) == size) ? MS_SUCCESS : MS_FAILURE;
+  msFree(data);
+  return status;
+}
+
 int msCGIDispatchImageRequest(mapservObj *mapserv)
 {
   int status;
@@ -1512,15 +1588,12 @@ int msCGIDispatchImageRequest(mapservObj *mapserv)
       img = msDrawScalebar(mapserv->map);
       break;
     case TILE:
-      msTileSetExtent(mapserv);
-
-      if(!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat), "application/x-protobuf")) {
-        if((status = msMVTWriteTile(mapserv->map, mapserv->sendheaders)) != MS_SUCCESS) return MS_FAILURE;
-        return MS_SUCCESS;
-      }
+      /* vector tiles bypass the tile cache and are sent without an ETag */
+      if(!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat), "application/x-protobuf"))
+        return msTileWriteMVT(mapserv);
 
-      img = msTileDraw(mapserv);
-      break;
+      msTileSetExtent(mapserv);
+      return msCGIDispatchTileRequest(mapserv);
     case LEGEND:
     case MAPLEGEND:
       img = msDrawLegend(mapserv->map, MS_FALSE, mapserv->hittest);
@@ -1532,25 +1605,7 @@ int msCGIDispatchImageRequest(mapservObj *mapserv)
 
   if(!img) return MS_FAILURE;
 
-  /*
-   ** Set the Cache control headers if the option is set.
-   */
-  if( mapserv->sendheaders && msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age") ) {
-    msIO_setHeader("Cache-Control","max-age=%s", msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age"));
-  }
-
-  if(mapserv->sendheaders)  {
-    const char *attachment = msGetOutputFormatOption(mapserv->map->outputformat, "ATTACHMENT", NULL );
-    if(attachment)
-      msIO_setHeader("Content-disposition","attachment; filename=%s", attachment);
-
-    if(!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat), "application/json")) {
-      msIO_setHeader("Content-Type","application/json; charset=utf-8");
-    } else {
-      msIO_setHeader("Content-Type","%s", MS_IMAGE_MIME_TYPE(mapserv->map->outputformat));
-    }
-    msIO_sendHeaders();
-  }
+  msCGISendImageHeaders(mapserv);
 
   if( mapserv->Mode == MAP || mapserv->Mode == TILE )
     status = msSaveImage(mapserv->map, img, NULL);
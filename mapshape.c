@@ -44,6 +44,13 @@
 #include <ogr_srs_api.h>
 #endif
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#define SHP_HAVE_MMAP
+#endif
+
 /* Only use this macro on 32-bit integers! */
 #define SWAP_FOUR_BYTES(data) \
   ( ((data >> 24) & 0x000000FF) | ((data >>  8) & 0x0000FF00) | \
@@ -82,6 +89,107 @@ static void * SfRealloc( void * pMem, int nNewSize )
   return realloc(pMem, nNewSize);
 }
 
+/************************************************************************/
+/*                            msSHPMapFile()                            */
+/*                                                                      */
+/*      Return a read-only memory mapping of an open file. Mappings     */
+/*      are shared process wide (by device, inode, size and mtime) and  */
+/*      reference counted, so several handles - possibly in different   */
+/*      threads - opening the same file share one mapping. Returns      */
+/*      NULL if the file can't be mapped, callers should then fall      */
+/*      back to stdio.                                                  */
+/************************************************************************/
+#ifdef SHP_HAVE_MMAP
+typedef struct shpMappedFile {
+  dev_t nDevice;
+  ino_t nInode;
+  time_t nMTime;
+  size_t nSize;
+  const uchar *pabyData;
+  int nRefCount;
+  struct shpMappedFile *psNext;
+} shpMappedFileObj;
+
+static shpMappedFileObj *psMappedFiles = NULL;
+#endif
+
+const uchar *msSHPMapFile( FILE *fp, size_t *pnSize )
+{
+#ifdef SHP_HAVE_MMAP
+  struct stat sStat;
+  shpMappedFileObj *psMapped;
+  void *pData;
+
+  if( fp == NULL || fstat( fileno(fp), &sStat ) != 0 || sStat.st_size <= 0 )
+    return NULL;
+
+  msAcquireLock( TLOCK_SHPMAP );
+
+  for( psMapped = psMappedFiles; psMapped != NULL; psMapped = psMapped->psNext ) {
+    if( psMapped->nDevice == sStat.st_dev && psMapped->nInode == sStat.st_ino &&
+        psMapped->nMTime == sStat.st_mtime && psMapped->nSize == (size_t) sStat.st_size ) {
+      psMapped->nRefCount++;
+      msReleaseLock( TLOCK_SHPMAP );
+      *pnSize = psMapped->nSize;
+      return psMapped->pabyData;
+    }
+  }
+
+  pData = mmap( NULL, (size_t) sStat.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0 );
+  if( pData == MAP_FAILED ) {
+    msReleaseLock( TLOCK_SHPMAP );
+    return NULL;
+  }
+
+  psMapped = (shpMappedFileObj *) msSmallMalloc( sizeof(shpMappedFileObj) );
+  psMapped->nDevice = sStat.st_dev;
+  psMapped->nInode = sStat.st_ino;
+  psMapped->nMTime = sStat.st_mtime;
+  psMapped->nSize = (size_t) sStat.st_size;
+  psMapped->pabyData = (const uchar *) pData;
+  psMapped->nRefCount = 1;
+  psMapped->psNext = psMappedFiles;
+  psMappedFiles = psMapped;
+
+  msReleaseLock( TLOCK_SHPMAP );
+
+  *pnSize = psMapped->nSize;
+  return psMapped->pabyData;
+#else
+  return NULL;
+#endif
+}
+
+/************************************************************************/
+/*                           msSHPUnmapFile()                           */
+/*                                                                      */
+/*      Release a mapping obtained with msSHPMapFile(), the file is     */
+/*      unmapped once the last reference is gone.                       */
+/************************************************************************/
+void msSHPUnmapFile( const uchar *pabyData )
+{
+#ifdef SHP_HAVE_MMAP
+  shpMappedFileObj **ppsMapped, *psMapped;
+
+  if( pabyData == NULL )
+    return;
+
+  msAcquireLock( TLOCK_SHPMAP );
+  for( ppsMapped = &psMappedFiles; *ppsMapped != NULL; ppsMapped = &((*ppsMapped)->psNext) ) {
+    psMapped = *ppsMapped;
+    if( psMapped->pabyData == pabyData ) {
+      if( --psMapped->nRefCount == 0 ) {
+        *ppsMapped = psMapped->psNext;
+        munmap( (void *) psMapped->pabyData, psMapped->nSize );
+        free( psMapped );
+      }
+      break;
+    }
+  }
+  msReleaseLock( TLOCK_SHPMAP );
+#endif
+}
+
 /************************************************************************/
 /*                          writeHeader()                               */
 /*                                                                      */
@@ -192,6 +300,19 @@ static void writeHeader( SHPHandle psSHP )
 /*      files or either file name.                                      */
 /************************************************************************/
 SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
+{
+  return msSHPOpenEx( pszLayer, pszAccess, 0 );
+}
+
+/************************************************************************/
+/*                             msSHPOpenEx()                            */
+/*                                                                      */
+/*      Same as msSHPOpen(), with MS_SHAPEFILE_OPEN_MMAP records of     */
+/*      read-only handles are decoded straight from shared memory       */
+/*      mappings of the .shp and .shx files rather than read through    */
+/*      stdio, which also makes the handle free of file position state. */
+/************************************************************************/
+SHPHandle msSHPOpenEx( const char * pszLayer, const char * pszAccess, int nFlags )
 {
   char *pszFullname, *pszBasename;
   SHPHandle psSHP;
@@ -230,6 +351,13 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   psSHP->panParts = NULL;
   psSHP->nBufSize = psSHP->nPartMax = 0;
 
+  psSHP->pabySHPMap = psSHP->pabySHXMap = NULL;
+  psSHP->nSHPMapSize = psSHP->nSHXMapSize = 0;
+
+  psSHP->pabyReadAhead = NULL;
+  psSHP->nReadAheadOffset = psSHP->nReadAheadSize = 0;
+  psSHP->nLastRecordEnd = -1;
+
   /* -------------------------------------------------------------------- */
   /*  Compute the base (layer) name.  If there is any extension     */
   /*  on the passed in filename we will strip it off.         */
@@ -372,6 +500,28 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   /* -------------------------------------------------------------------- */
   psSHP->nMaxRecords = psSHP->nRecords;
 
+  /* -------------------------------------------------------------------- */
+  /*      Map the files if requested, offsets are then decoded straight   */
+  /*      from the .shx mapping and the in-memory cache isn't needed.     */
+  /* -------------------------------------------------------------------- */
+  if( (nFlags & MS_SHAPEFILE_OPEN_MMAP) && strcmp(pszAccess, "rb") == 0 ) {
+    psSHP->pabySHPMap = msSHPMapFile( psSHP->fpSHP, &psSHP->nSHPMapSize );
+    if( psSHP->pabySHPMap )
+      psSHP->pabySHXMap = msSHPMapFile( psSHP->fpSHX, &psSHP->nSHXMapSize );
+    if( psSHP->pabySHXMap && psSHP->nSHXMapSize >= 100 + 8 * (size_t) psSHP->nRecords ) {
+      psSHP->panRecOffset = NULL;
+      psSHP->panRecSize = NULL;
+      psSHP->panRecLoaded = NULL;
+      psSHP->panRecAllLoaded = 1;
+      return( psSHP );
+    }
+    /* mapping failed or truncated .shx, fall back to stdio */
+    msSHPUnmapFile( psSHP->pabySHPMap );
+    msSHPUnmapFile( psSHP->pabySHXMap );
+    psSHP->pabySHPMap = psSHP->pabySHXMap = NULL;
+    psSHP->nSHPMapSize = psSHP->nSHXMapSize = 0;
+  }
+
   /* Our in-memory cache of offset information */
   psSHP->panRecOffset = (int *) malloc(sizeof(int) * psSHP->nMaxRecords );
   /* Our in-memory cache of size information */
@@ -422,6 +572,10 @@ void msSHPClose(SHPHandle psSHP )
 
   free(psSHP->pabyRec);
   free(psSHP->panParts);
+  free(psSHP->pabyReadAhead);
+
+  msSHPUnmapFile( psSHP->pabySHPMap );
+  msSHPUnmapFile( psSHP->pabySHXMap );
 
   fclose( psSHP->fpSHX );
   fclose( psSHP->fpSHP );
@@ -619,6 +773,8 @@ int msSHPWritePoint(SHPHandle psSHP, pointObj *point )
   if( psSHP->nShapeType != SHP_POINT) return(-1);
 
   psSHP->bUpdated = MS_TRUE;
+  psSHP->nReadAheadSize = 0;
+  psSHP->nLastRecordEnd = -1;
 
   /* Fill the SHX buffer if it is not already full. */
   if( ! psSHP->panRecAllLoaded ) msSHXLoadAll( psSHP );
@@ -715,6 +871,8 @@ int msSHPWriteShape(SHPHandle psSHP, shapeObj *shape )
   double dfMMin, dfMMax = 0;
 #endif
   psSHP->bUpdated = MS_TRUE;
+  psSHP->nReadAheadSize = 0;
+  psSHP->nLastRecordEnd = -1;
 
   /* Fill the SHX buffer if it is not already full. */
   if( ! psSHP->panRecAllLoaded ) msSHXLoadAll( psSHP );
@@ -1043,12 +1201,77 @@ static int msSHPReadAllocateBuffer( SHPHandle psSHP, int hEntity, const char* ps
   return MS_SUCCESS;
 }
 
+/*
+** msSHPReadRecord() - Returns the raw bytes of a record, either straight from the
+** .shp mapping or read into the handle's record buffer.
+*/
+static const uchar *msSHPReadRecord( SHPHandle psSHP, int hEntity, int nEntitySize, const char* pszCallingFunction)
+{
+  int nOffset = msSHXReadOffset( psSHP, hEntity);
+
+  if( psSHP->pabySHPMap ) {
+    if( nOffset < 0 || nEntitySize < 0 || (size_t) nOffset + (size_t) nEntitySize > psSHP->nSHPMapSize ) {
+      msSetError(MS_IOERR, "record %d is beyond the end of the file", pszCallingFunction, hEntity);
+      return NULL;
+    }
+    return psSHP->pabySHPMap + nOffset;
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Records read in file order (e.g. from a spatially sorted        */
+  /*      shapefile) are served from a read-ahead window, so a run of     */
+  /*      nearby records costs one read instead of a seek and read each.  */
+  /*      The window is only filled once a second forward read shows      */
+  /*      the access is sequential.                                       */
+  /* -------------------------------------------------------------------- */
+  if( psSHP->nReadAheadSize > 0 && nOffset >= psSHP->nReadAheadOffset && nEntitySize >= 0 &&
+      nOffset + nEntitySize <= psSHP->nReadAheadOffset + psSHP->nReadAheadSize ) {
+    psSHP->nLastRecordEnd = nOffset + nEntitySize;
+    return psSHP->pabyReadAhead + (nOffset - psSHP->nReadAheadOffset);
+  }
+
+  if( psSHP->nLastRecordEnd >= 0 && nOffset >= psSHP->nLastRecordEnd &&
+      nOffset - psSHP->nLastRecordEnd < SHP_READAHEAD_SIZE &&
+      nEntitySize >= 0 && nEntitySize <= SHP_READAHEAD_SIZE ) {
+    size_t nRead;
+
+    if( psSHP->pabyReadAhead == NULL )
+      psSHP->pabyReadAhead = (uchar *) msSmallMalloc( SHP_READAHEAD_SIZE );
+    psSHP->nReadAheadSize = 0;
+
+    if( 0 == fseek( psSHP->fpSHP, nOffset, 0 ) ) {
+      nRead = fread( psSHP->pabyReadAhead, 1, SHP_READAHEAD_SIZE, psSHP->fpSHP );
+      if( nRead >= (size_t) nEntitySize ) {
+        psSHP->nReadAheadOffset = nOffset;
+        psSHP->nReadAheadSize = (int) nRead;
+        psSHP->nLastRecordEnd = nOffset + nEntitySize;
+        return psSHP->pabyReadAhead;
+      }
+    }
+  }
+
+  if (msSHPReadAllocateBuffer(psSHP, hEntity, pszCallingFunction) == MS_FAILURE) {
+    return NULL;
+  }
+  if( 0 != fseek( psSHP->fpSHP, nOffset, 0 )) {
+    msSetError(MS_IOERR, "failed to seek offset", pszCallingFunction);
+    return NULL;
+  }
+  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
+    msSetError(MS_IOERR, "failed to fread record", pszCallingFunction);
+    return NULL;
+  }
+  psSHP->nLastRecordEnd = nOffset + nEntitySize;
+  return psSHP->pabyRec;
+}
+
 /*
 ** msSHPReadPoint() - Reads a single point from a POINT shape file.
 */
 int msSHPReadPoint( SHPHandle psSHP, int hEntity, pointObj *point )
 {
   int nEntitySize;
+  const uchar *pabyRec;
 
   /* -------------------------------------------------------------------- */
   /*      Only valid for point shapefiles                                 */
@@ -1077,25 +1300,15 @@ int msSHPReadPoint( SHPHandle psSHP, int hEntity, pointObj *point )
     return(MS_FAILURE);
   }
 
-  if (msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadPoint()") == MS_FAILURE) {
-    return MS_FAILURE;
-  }
-
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  if( 0 != fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity), 0 )) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadPoint()");
+  pabyRec = msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadPoint()" );
+  if( pabyRec == NULL )
     return(MS_FAILURE);
-  }
-  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
-    return(MS_FAILURE);
-  }
 
-
-  memcpy( &(point->x), psSHP->pabyRec + 12, 8 );
-  memcpy( &(point->y), psSHP->pabyRec + 20, 8 );
+  memcpy( &(point->x), pabyRec + 12, 8 );
+  memcpy( &(point->y), pabyRec + 20, 8 );
 
   if( bBigEndian ) {
     SwapWord( 8, &(point->x));
@@ -1120,6 +1333,10 @@ int msSHXLoadPage( SHPHandle psSHP, int shxBufferPage )
   /* Each SHX record is 8 bytes long (two ints), hence our buffer size. */
   char buffer[SHX_BUFFER_PAGE * 8];
 
+  /* Nothing to page in, offsets are read straight from the mapping. */
+  if( psSHP->pabySHXMap )
+    return(MS_SUCCESS);
+
   /*  Validate the page number. */
   if( shxBufferPage < 0  )
     return(MS_FAILURE);
@@ -1176,6 +1393,9 @@ int msSHXLoadAll( SHPHandle psSHP )
   int i;
   uchar *pabyBuf;
 
+  if( psSHP->pabySHXMap )
+    return(MS_SUCCESS);
+
   pabyBuf = (uchar *) msSmallMalloc(8 * psSHP->nRecords );
   if(psSHP->nRecords != fread( pabyBuf, 8, psSHP->nRecords, psSHP->fpSHX )) {
     msSetError(MS_IOERR, "failed to read shx records", "msSHXLoadAll()");
@@ -1203,6 +1423,21 @@ int msSHXLoadAll( SHPHandle psSHP )
 
 }
 
+/*
+** msSHXReadMapped() - Decodes one of the two (big endian, 2 byte unit) integers
+** of a .shx record straight from the mapping.
+*/
+static int msSHXReadMapped( SHPHandle psSHP, int hEntity, int iWord )
+{
+  ms_int32 nValue;
+
+  memcpy( &nValue, psSHP->pabySHXMap + 100 + 8 * (size_t) hEntity + 4 * iWord, 4 );
+  if( !bBigEndian )
+    nValue = SWAP_FOUR_BYTES( nValue );
+
+  return nValue * 2;
+}
+
 int msSHXReadOffset( SHPHandle psSHP, int hEntity )
 {
 
@@ -1212,6 +1447,9 @@ int msSHXReadOffset( SHPHandle psSHP, int hEntity )
   if( hEntity < 0 || hEntity >= psSHP->nRecords )
     return(MS_FAILURE);
 
+  if( psSHP->pabySHXMap )
+    return msSHXReadMapped( psSHP, hEntity, 0 );
+
   if( ! (psSHP->panRecAllLoaded || msGetBit(psSHP->panRecLoaded, shxBufferPage)) ) {
     msSHXLoadPage( psSHP, shxBufferPage );
   }
@@ -1229,6 +1467,9 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity )
   if( hEntity < 0 || hEntity >= psSHP->nRecords )
     return(MS_FAILURE);
 
+  if( psSHP->pabySHXMap )
+    return msSHXReadMapped( psSHP, hEntity, 1 );
+
   if( ! (psSHP->panRecAllLoaded || msGetBit(psSHP->panRecLoaded, shxBufferPage)) ) {
     msSHXLoadPage( psSHP, shxBufferPage );
   }
@@ -1247,6 +1488,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   int nOffset = 0;
 #endif
   int nEntitySize, nRequiredSize;
+  const uchar *pabyRec;
 
   msInitShape(shape); /* initialize the shape */
 
@@ -1262,21 +1504,12 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   }
 
   nEntitySize = msSHXReadSize(psSHP, hEntity) + 8;
-  if (msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadShape()") == MS_FAILURE) {
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
 
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  if( 0 != fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity), 0 )) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadShape()");
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
-  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
+  pabyRec = msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadShape()" );
+  if( pabyRec == NULL ) {
     shape->type = MS_SHAPE_NULL;
     return;
   }
@@ -1297,10 +1530,10 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     }
 
     /* copy the bounding box */
-    memcpy( &shape->bounds.minx, psSHP->pabyRec + 8 + 4, 8 );
-    memcpy( &shape->bounds.miny, psSHP->pabyRec + 8 + 12, 8 );
-    memcpy( &shape->bounds.maxx, psSHP->pabyRec + 8 + 20, 8 );
-    memcpy( &shape->bounds.maxy, psSHP->pabyRec + 8 + 28, 8 );
+    memcpy( &shape->bounds.minx, pabyRec + 8 + 4, 8 );
+    memcpy( &shape->bounds.miny, pabyRec + 8 + 12, 8 );
+    memcpy( &shape->bounds.maxx, pabyRec + 8 + 20, 8 );
+    memcpy( &shape->bounds.maxy, pabyRec + 8 + 28, 8 );
 
     if( bBigEndian ) {
       SwapWord( 8, &shape->bounds.minx);
@@ -1309,8 +1542,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       SwapWord( 8, &shape->bounds.maxy);
     }
 
-    memcpy( &nPoints, psSHP->pabyRec + 40 + 8, 4 );
-    memcpy( &nParts, psSHP->pabyRec + 36 + 8, 4 );
+    memcpy( &nPoints, pabyRec + 40 + 8, 4 );
+    memcpy( &nParts, pabyRec + 36 + 8, 4 );
 
     if( bBigEndian ) {
       nPoints = SWAP_FOUR_BYTES(nPoints);
@@ -1357,7 +1590,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       return;
     }
 
-    memcpy( psSHP->panParts, psSHP->pabyRec + 44 + 8, 4 * nParts );
+    memcpy( psSHP->panParts, pabyRec + 44 + 8, 4 * nParts );
     if( bBigEndian ) {
       for( i = 0; i < nParts; i++ ) {
         *(psSHP->panParts+i) = SWAP_FOUR_BYTES(*(psSHP->panParts+i));
@@ -1402,8 +1635,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
 
       /* nOffset = 44 + 8 + 4*nParts; */
       for( j = 0; j < shape->line[i].numpoints; j++ ) {
-        memcpy(&(shape->line[i].point[j].x), psSHP->pabyRec + 44 + 4*nParts + 8 + k * 16, 8 );
-        memcpy(&(shape->line[i].point[j].y), psSHP->pabyRec + 44 + 4*nParts + 8 + k * 16 + 8, 8 );
+        memcpy(&(shape->line[i].point[j].x), pabyRec + 44 + 4*nParts + 8 + k * 16, 8 );
+        memcpy(&(shape->line[i].point[j].y), pabyRec + 44 + 4*nParts + 8 + k * 16 + 8, 8 );
 
         if( bBigEndian ) {
           SwapWord( 8, &(shape->line[i].point[j].x) );
@@ -1418,7 +1651,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
         if (psSHP->nShapeType == SHP_POLYGONZ || psSHP->nShapeType == SHP_ARCZ) {
           nOffset = 44 + 8 + (4*nParts) + (16*nPoints) ;
           if( nEntitySize >= nOffset + 16 + 8*nPoints ) {
-            memcpy(&(shape->line[i].point[j].z), psSHP->pabyRec + nOffset + 16 + k*8, 8 );
+            memcpy(&(shape->line[i].point[j].z), pabyRec + nOffset + 16 + k*8, 8 );
             if( bBigEndian ) SwapWord( 8, &(shape->line[i].point[j].z) );
           }
         }
@@ -1430,7 +1663,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
         if (psSHP->nShapeType == SHP_POLYGONM || psSHP->nShapeType == SHP_ARCM) {
           nOffset = 44 + 8 + (4*nParts) + (16*nPoints) ;
           if( nEntitySize >= nOffset + 16 + 8*nPoints ) {
-            memcpy(&(shape->line[i].point[j].m), psSHP->pabyRec + nOffset + 16 + k*8, 8 );
+            memcpy(&(shape->line[i].point[j].m), pabyRec + nOffset + 16 + k*8, 8 );
             if( bBigEndian ) SwapWord( 8, &(shape->line[i].point[j].m) );
           }
         }
@@ -1463,10 +1696,10 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     }
 
     /* copy the bounding box */
-    memcpy( &shape->bounds.minx, psSHP->pabyRec + 8 + 4, 8 );
-    memcpy( &shape->bounds.miny, psSHP->pabyRec + 8 + 12, 8 );
-    memcpy( &shape->bounds.maxx, psSHP->pabyRec + 8 + 20, 8 );
-    memcpy( &shape->bounds.maxy, psSHP->pabyRec + 8 + 28, 8 );
+    memcpy( &shape->bounds.minx, pabyRec + 8 + 4, 8 );
+    memcpy( &shape->bounds.miny, pabyRec + 8 + 12, 8 );
+    memcpy( &shape->bounds.maxx, pabyRec + 8 + 20, 8 );
+    memcpy( &shape->bounds.maxy, pabyRec + 8 + 28, 8 );
 
     if( bBigEndian ) {
       SwapWord( 8, &shape->bounds.minx);
@@ -1475,7 +1708,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       SwapWord( 8, &shape->bounds.maxy);
     }
 
-    memcpy( &nPoints, psSHP->pabyRec + 44, 4 );
+    memcpy( &nPoints, pabyRec + 44, 4 );
     if( bBigEndian ) nPoints = SWAP_FOUR_BYTES(nPoints);
 
     /* -------------------------------------------------------------------- */
@@ -1518,8 +1751,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     }
 
     for( i = 0; i < nPoints; i++ ) {
-      memcpy(&(shape->line[0].point[i].x), psSHP->pabyRec + 48 + 16 * i, 8 );
-      memcpy(&(shape->line[0].point[i].y), psSHP->pabyRec + 48 + 16 * i + 8, 8 );
+      memcpy(&(shape->line[0].point[i].x), pabyRec + 48 + 16 * i, 8 );
+      memcpy(&(shape->line[0].point[i].y), pabyRec + 48 + 16 * i + 8, 8 );
 
       if( bBigEndian ) {
         SwapWord( 8, &(shape->line[0].point[i].x) );
@@ -1533,7 +1766,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       shape->line[0].point[i].z = 0; /* initialize */
       if (psSHP->nShapeType == SHP_MULTIPOINTZ) {
         nOffset = 48 + 16*nPoints;
-        memcpy(&(shape->line[0].point[i].z), psSHP->pabyRec + nOffset + 16 + i*8, 8 );
+        memcpy(&(shape->line[0].point[i].z), pabyRec + nOffset + 16 + i*8, 8 );
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[i].z));
       }
 
@@ -1543,7 +1776,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       shape->line[0].point[i].m = 0; /* initialize */
       if (psSHP->nShapeType == SHP_MULTIPOINTM) {
         nOffset = 48 + 16*nPoints;
-        memcpy(&(shape->line[0].point[i].m), psSHP->pabyRec + nOffset + 16 + i*8, 8 );
+        memcpy(&(shape->line[0].point[i].m), pabyRec + nOffset + 16 + i*8, 8 );
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[i].m));
       }
 #endif /* USE_POINT_Z_M */
@@ -1575,8 +1808,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     shape->line[0].numpoints = 1;
     shape->line[0].point = (pointObj *) msSmallMalloc(sizeof(pointObj));
 
-    memcpy( &(shape->line[0].point[0].x), psSHP->pabyRec + 12, 8 );
-    memcpy( &(shape->line[0].point[0].y), psSHP->pabyRec + 20, 8 );
+    memcpy( &(shape->line[0].point[0].x), pabyRec + 12, 8 );
+    memcpy( &(shape->line[0].point[0].y), pabyRec + 20, 8 );
 
     if( bBigEndian ) {
       SwapWord( 8, &(shape->line[0].point[0].x));
@@ -1591,7 +1824,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     if (psSHP->nShapeType == SHP_POINTZ) {
       nOffset = 20 + 8;
       if( nEntitySize >= nOffset + 8 ) {
-        memcpy(&(shape->line[0].point[0].z), psSHP->pabyRec + nOffset, 8 );
+        memcpy(&(shape->line[0].point[0].z), pabyRec + nOffset, 8 );
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[0].z));
       }
     }
@@ -1603,7 +1836,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     if (psSHP->nShapeType == SHP_POINTM) {
       nOffset = 20 + 8;
       if( nEntitySize >= nOffset + 8 ) {
-        memcpy(&(shape->line[0].point[0].m), psSHP->pabyRec + nOffset, 8 );
+        memcpy(&(shape->line[0].point[0].m), pabyRec + nOffset, 8 );
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[0].m));
       }
     }
@@ -1646,7 +1879,32 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
       return MS_FAILURE;
     }
 
-    if( psSHP->nShapeType != SHP_POINT && psSHP->nShapeType != SHP_POINTZ && psSHP->nShapeType != SHP_POINTM) {
+    if( psSHP->pabySHPMap ) {
+      const uchar *pabyRec;
+      int bIsPoint = (psSHP->nShapeType == SHP_POINT || psSHP->nShapeType == SHP_POINTZ || psSHP->nShapeType == SHP_POINTM);
+
+      pabyRec = msSHPReadRecord( psSHP, hEntity, 12 + (bIsPoint ? 16 : 32), "msSHPReadBounds()" );
+      if( pabyRec == NULL )
+        return(MS_FAILURE);
+
+      memcpy( padBounds, pabyRec + 12, bIsPoint ? 16 : 32 );
+      if( bBigEndian ) {
+        SwapWord( 8, &(padBounds->minx) );
+        SwapWord( 8, &(padBounds->miny) );
+        if( !bIsPoint ) {
+          SwapWord( 8, &(padBounds->maxx) );
+          SwapWord( 8, &(padBounds->maxy) );
+        }
+      }
+
+      if( bIsPoint ) {
+        padBounds->maxx = padBounds->minx;
+        padBounds->maxy = padBounds->miny;
+      } else if(msIsNan(padBounds->minx)) { /* empty shape */
+        padBounds->minx = padBounds->miny = padBounds->maxx = padBounds->maxy = 0.0;
+        return MS_FAILURE;
+      }
+    } else if( psSHP->nShapeType != SHP_POINT && psSHP->nShapeType != SHP_POINTZ && psSHP->nShapeType != SHP_POINTM) {
       if( 0 != fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity) + 12, 0 )) {
         msSetError(MS_IOERR, "failed to seek offset", "msSHPReadBounds()");
         return(MS_FAILURE);
@@ -1696,6 +1954,11 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
 }
 
 int msShapefileOpen(shapefileObj *shpfile, const char *mode, const char *filename, int log_failures)
+{
+  return msShapefileOpenEx(shpfile, mode, filename, log_failures, 0);
+}
+
+int msShapefileOpenEx(shapefileObj *shpfile, const char *mode, const char *filename, int log_failures, int flags)
 {
   int i;
   char *dbfFilename;
@@ -1714,9 +1977,9 @@ int msShapefileOpen(shapefileObj *shpfile, const char *mode, const char *filenam
 
   /* open the shapefile file (appending ok) and get basic info */
   if(!mode)
-    shpfile->hSHP = msSHPOpen( filename, "rb");
+    shpfile->hSHP = msSHPOpenEx( filename, "rb", flags);
   else
-    shpfile->hSHP = msSHPOpen( filename, mode);
+    shpfile->hSHP = msSHPOpenEx( filename, mode, flags);
 
   if(!shpfile->hSHP) {
     if( log_failures )
@@ -1745,7 +2008,7 @@ int msShapefileOpen(shapefileObj *shpfile, const char *mode, const char *filenam
 
   strlcat(dbfFilename, ".dbf", bufferSize);
 
-  shpfile->hDBF = msDBFOpen(dbfFilename, "rb");
+  shpfile->hDBF = msDBFOpenEx(dbfFilename, "rb", flags);
 
   if(!shpfile->hDBF) {
     if( log_failures )
@@ -1838,18 +2101,23 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
         *s = '\0';
     }
 
-    filename = (char *)malloc(strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+1);
-    MS_CHECK_ALLOC(filename, strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+1, MS_FAILURE);
+    filename = (char *)malloc(strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+strlen(MS_HRTREE_INDEX_EXTENSION)+1);
+    MS_CHECK_ALLOC(filename, strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+strlen(MS_HRTREE_INDEX_EXTENSION)+1, MS_FAILURE);
 
-    sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+    /* a packed Hilbert R-tree is exact, prefer it over the quadtree */
+    sprintf(filename, "%s%s", sourcename, MS_HRTREE_INDEX_EXTENSION);
+    shpfile->status = msSearchHilbertTree(filename, rect, debug, shpfile->numshapes);
 
-    shpfile->status = msSearchDiskTree(filename, rect, debug, shpfile->numshapes);
+    if(!shpfile->status) {
+      sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+      shpfile->status = msSearchDiskTree(filename, rect, debug, shpfile->numshapes);
+      if(shpfile->status) /* quadtree index */
+        msFilterTreeSearch(shpfile, shpfile->status, rect);
+    }
     free(filename);
     free(sourcename);
 
-    if(shpfile->status) { /* index  */
-      msFilterTreeSearch(shpfile, shpfile->status, rect);
-    } else { /* no index  */
+    if(!shpfile->status) { /* no index  */
       shpfile->status = msAllocBitArray(shpfile->numshapes);
       if(!shpfile->status) {
         msSetError(MS_MEMERR, NULL, "msShapefileWhichShapes()");
@@ -1880,6 +2148,19 @@ void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer)
   free(tiFileAbsDirTmp);
 }
 
+/*
+** Returns the msShapefileOpenEx() flags requested through layer PROCESSING options.
+*/
+static int msSHPLayerGetOpenFlags(layerObj *layer)
+{
+  const char *value = msLayerGetProcessingKey(layer, "SHAPEFILE_MMAP");
+
+  if(value && strcasecmp(value, "OFF"))
+    return MS_SHAPEFILE_OPEN_MMAP;
+
+  return 0;
+}
+
 /*
 ** Build possible paths we might find the tile file at:
 **   map dir + shape path + filename?
@@ -1897,13 +2178,14 @@ int msTiledSHPTryOpen(shapefileObj *shpfile, layerObj *layer, char *tiFileAbsDir
   char szPath[MS_MAXPATHLEN];
   int ignore_missing = msMapIgnoreMissingData(layer->map);
   int log_failures = MS_TRUE;
+  int flags = msSHPLayerGetOpenFlags(layer);
 
   if( ignore_missing == MS_MISSING_DATA_IGNORE )
     log_failures = MS_FALSE;
 
-  if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures) == -1) {
-    if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures) == -1) {
-      if(msShapefileOpen(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), log_failures) == -1) {
+  if(msShapefileOpenEx(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures, flags) == -1) {
+    if(msShapefileOpenEx(shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures, flags) == -1) {
+      if(msShapefileOpenEx(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), log_failures, flags) == -1) {
         if(ignore_missing == MS_MISSING_DATA_FAIL) {
           msSetError(MS_IOERR, "Unable to open shapefile '%s' for layer '%s' ... fatal error.", "msTiledSHPTryOpen()", filename, layer->name);
           return(MS_FAILURE);
@@ -1954,6 +2236,7 @@ static
 int msTiledSHPOpenFile(layerObj *layer)
 {
   int i;
+  int flags = msSHPLayerGetOpenFlags(layer);
   const char *filename;
   char tilename[MS_MAXPATHLEN], szPath[MS_MAXPATHLEN];
   char tiFileAbsDir[MS_MAXPATHLEN];
@@ -2021,8 +2304,8 @@ int msTiledSHPOpenFile(layerObj *layer)
     }
 
 
-    if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->tileindex), MS_TRUE) == -1)
-      if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->tileindex), MS_TRUE) == -1)
+    if(msShapefileOpenEx(tSHP->tileshpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->tileindex), MS_TRUE, flags) == -1)
+      if(msShapefileOpenEx(tSHP->tileshpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->tileindex), MS_TRUE, flags) == -1)
         return(MS_FAILURE);
   }
 
@@ -2360,6 +2643,7 @@ int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 
   long shapeindex = record->shapeindex;
   int tileindex = record->tileindex;
+  int flags = msSHPLayerGetOpenFlags(layer);
 
   if ( msCheckParentPointer(layer->map,"map")==MS_FAILURE )
     return MS_FAILURE;
@@ -2381,9 +2665,9 @@ int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 
     /* open the shapefile, since a specific tile was request an error should be generated if that tile does not exist */
     if(strlen(filename) == 0) return(MS_FAILURE);
-    if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE) == -1) {
-      if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE) == -1) {
-        if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE) == -1) {
+    if(msShapefileOpenEx(tSHP->shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE, flags) == -1) {
+      if(msShapefileOpenEx(tSHP->shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE, flags) == -1) {
+        if(msShapefileOpenEx(tSHP->shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE, flags) == -1) {
           return(MS_FAILURE);
         }
       }
@@ -2643,6 +2927,7 @@ int msSHPLayerOpen(layerObj *layer)
 {
   char szPath[MS_MAXPATHLEN];
   shapefileObj *shpfile;
+  int flags = msSHPLayerGetOpenFlags(layer);
 
   if(layer->layerinfo) return MS_SUCCESS; /* layer already open */
 
@@ -2656,8 +2941,8 @@ int msSHPLayerOpen(layerObj *layer)
 
   layer->layerinfo = shpfile;
 
-  if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->data), MS_TRUE) == -1) {
-    if(msShapefileOpen(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->data), MS_TRUE) == -1) {
+  if(msShapefileOpenEx(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->data), MS_TRUE, flags) == -1) {
+    if(msShapefileOpenEx(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->data), MS_TRUE, flags) == -1) {
       layer->layerinfo = NULL;
       free(shpfile);
       return MS_FAILURE;
@@ -39,6 +39,10 @@ extern "C" {
 #endif
 
 #define SHX_BUFFER_PAGE 1024
+#define SHP_READAHEAD_SIZE 65536
+
+/* msShapefileOpenEx()/msSHPOpenEx()/msDBFOpenEx() flags */
+#define MS_SHAPEFILE_OPEN_MMAP 1 /* read records from a shared read-only memory mapping */
 
 #ifndef SWIG
 #define MS_PATH_LENGTH 1024
@@ -103,6 +107,16 @@ extern "C" {
     int   nPartMax;
     int   *panParts;
 
+    const uchar *pabySHPMap; /* shared read-only mappings, NULL when reading through stdio */
+    size_t nSHPMapSize;
+    const uchar *pabySHXMap;
+    size_t nSHXMapSize;
+
+    uchar *pabyReadAhead; /* window over the .shp serving forward sequential record reads */
+    int nReadAheadOffset;
+    int nReadAheadSize;
+    int nLastRecordEnd;
+
   } SHPInfo;
   typedef SHPInfo * SHPHandle;
 #endif
@@ -136,6 +150,10 @@ extern "C" {
 
     char  *pszStringField;
     int   nStringFieldLen;
+#ifndef SWIG
+    const uchar *pabyMap; /* shared read-only mapping, NULL when reading through stdio */
+    size_t nMapSize;
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -185,12 +203,14 @@ extern "C" {
 
   /* shapefileObj function prototypes  */
   MS_DLL_EXPORT int msShapefileOpen(shapefileObj *shpfile, const char *mode, const char *filename, int log_failures);
+  MS_DLL_EXPORT int msShapefileOpenEx(shapefileObj *shpfile, const char *mode, const char *filename, int log_failures, int flags);
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
+  MS_DLL_EXPORT SHPHandle msSHPOpenEx( const char * pszShapeFile, const char * pszAccess, int nFlags );
   MS_DLL_EXPORT SHPHandle msSHPCreate( const char * pszShapeFile, int nShapeType );
   MS_DLL_EXPORT void msSHPClose( SHPHandle hSHP );
   MS_DLL_EXPORT void msSHPGetInfo( SHPHandle hSHP, int * pnEntities, int * pnShapeType );
@@ -204,12 +224,16 @@ extern "C" {
   MS_DLL_EXPORT int msSHXLoadPage( SHPHandle psSHP, int shxBufferPage );
   MS_DLL_EXPORT int msSHXReadOffset( SHPHandle psSHP, int hEntity );
   MS_DLL_EXPORT int msSHXReadSize( SHPHandle psSHP, int hEntity );
+  /* shared read-only file mappings */
+  MS_DLL_EXPORT const uchar *msSHPMapFile( FILE *fp, size_t *pnSize );
+  MS_DLL_EXPORT void msSHPUnmapFile( const uchar *pabyData );
 
 
   /* tiledShapefileObj function prototypes are in mapserver.h */
 
   /* XBase function prototypes */
   MS_DLL_EXPORT DBFHandle msDBFOpen( const char * pszDBFFile, const char * pszAccess );
+  MS_DLL_EXPORT DBFHandle msDBFOpenEx( const char * pszDBFFile, const char * pszAccess, int nFlags );
   MS_DLL_EXPORT void msDBFClose( DBFHandle hDBF );
   MS_DLL_EXPORT DBFHandle msDBFCreate( const char * pszDBFFile );
 
@@ -114,7 +114,8 @@ int setExtent(mapservObj *mapserv)
 {
   double cellx,celly,cellsize;
 
-  if(mapserv->Mode == TILE) {
+  /* the tiles of a vector tile batch get their extents in msTileWriteMVT() */
+  if(mapserv->Mode == TILE && !(mapserv->TileCoords && strchr(mapserv->TileCoords, ';'))) {
     if(MS_SUCCESS != msTileSetExtent(mapserv)) {
       return MS_FAILURE;
     }
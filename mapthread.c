@@ -144,7 +144,7 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", "MAPCACHE", "SHPMAP", "TREECACHE", "POSTGIS", "DRAW", "PALETTE", NULL
 };
 #endif
 
@@ -227,6 +227,54 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                           msThreadCreate()                           */
+/*                                                                      */
+/*      Starts func(arg) in a new thread, returns NULL on failure.      */
+/************************************************************************/
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+  pthread_t thread;
+} msThreadObj;
+
+static void *msThreadStart( void *arg )
+
+{
+  msThreadObj *thread = (msThreadObj *) arg;
+  thread->func( thread->arg );
+  msProjectThreadCleanup();
+  return NULL;
+}
+
+void *msThreadCreate( void (*func)(void *), void *arg )
+
+{
+  msThreadObj *thread = (msThreadObj *) malloc(sizeof(msThreadObj));
+
+  if( thread == NULL )
+    return NULL;
+  thread->func = func;
+  thread->arg = arg;
+  if( pthread_create( &(thread->thread), NULL, msThreadStart, thread ) != 0 ) {
+    free( thread );
+    return NULL;
+  }
+  return thread;
+}
+
+/************************************************************************/
+/*                            msThreadJoin()                            */
+/************************************************************************/
+
+void msThreadJoin( void *thread )
+
+{
+  pthread_join( ((msThreadObj *) thread)->thread, NULL );
+  free( thread );
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -315,4 +363,54 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                           msThreadCreate()                           */
+/*                                                                      */
+/*      Starts func(arg) in a new thread, returns NULL on failure.      */
+/************************************************************************/
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+  HANDLE thread;
+} msThreadObj;
+
+static DWORD WINAPI msThreadStart( LPVOID arg )
+
+{
+  msThreadObj *thread = (msThreadObj *) arg;
+  thread->func( thread->arg );
+  msProjectThreadCleanup();
+  return 0;
+}
+
+void *msThreadCreate( void (*func)(void *), void *arg )
+
+{
+  msThreadObj *thread = (msThreadObj *) malloc(sizeof(msThreadObj));
+
+  if( thread == NULL )
+    return NULL;
+  thread->func = func;
+  thread->arg = arg;
+  thread->thread = CreateThread( NULL, 0, msThreadStart, thread, 0, NULL );
+  if( thread->thread == NULL ) {
+    free( thread );
+    return NULL;
+  }
+  return thread;
+}
+
+/************************************************************************/
+/*                            msThreadJoin()                            */
+/************************************************************************/
+
+void msThreadJoin( void *thread )
+
+{
+  WaitForSingleObject( ((msThreadObj *) thread)->thread, INFINITE );
+  CloseHandle( ((msThreadObj *) thread)->thread );
+  free( thread );
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
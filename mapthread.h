@@ -39,6 +39,8 @@ extern "C" {
   void* msGetThreadId(void);
   void msAcquireLock(int);
   void msReleaseLock(int);
+  void* msThreadCreate(void (*func)(void *), void *arg);
+  void msThreadJoin(void *thread);
 #else
 #define msThreadInit()
 #define msGetThreadId() (0)
@@ -46,6 +48,12 @@ extern "C" {
 #define msReleaseLock(x)
 #endif
 
+  /*
+  ** Upper bound of the thread counts taken from the mapfile (MS_DRAW_THREADS,
+  ** RESAMPLE_THREADS, KERNELDENSITY_THREADS).
+  */
+#define MS_MAX_THREADS 64
+
   /*
   ** lock ids - note there is a corresponding lock_names[] array in
   ** mapthread.c that needs to be extended when new ids are added.
@@ -69,8 +77,14 @@ extern "C" {
 #define TLOCK_FRIBIDI   16
 #define TLOCK_WxS       17
 #define TLOCK_GEOS       18
-
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_MAPCACHE   19
+#define TLOCK_SHPMAP     20
+#define TLOCK_TREECACHE  21
+#define TLOCK_POSTGIS    22
+#define TLOCK_DRAW       23
+#define TLOCK_PALETTE    24
+
+#define TLOCK_STATIC_MAX 30
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
@@ -29,6 +29,11 @@
 
 #include "maptile.h"
 #include "mapproject.h"
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 #ifdef USE_TILE_API
 static void msTileResetMetatileLevel(mapObj *map)
@@ -116,6 +121,33 @@ static void msTileGetParams(mapObj *map, tileParams *params)
 
 }
 
+/************************************************************************
+ *                            msTileCropImage                           *
+ *                                                                      *
+ *  Copy the tile whose top corner is at (mini, minj) out of the        *
+ *  metatile pixels.                                                    *
+ ************************************************************************/
+static imageObj* msTileCropImage(const mapservObj *msObj, rasterBufferObj *imgBuffer, const tileParams *params, int mini, int minj)
+{
+  imageObj* imgOut = NULL;
+
+  imgOut = msImageCreate(params->tile_size, params->tile_size, msObj->map->outputformat, NULL, NULL, msObj->map->resolution, msObj->map->defresolution, NULL);
+
+  if( imgOut == NULL ) {
+    return NULL;
+  }
+
+  if(msObj->map->debug)
+    msDebug("msTileCropImage(): extracting (%d x %d) tile, top corner (%d, %d)\n",params->tile_size,params->tile_size,mini,minj);
+
+  if(UNLIKELY(MS_FAILURE == MS_MAP_RENDERER(msObj->map)->mergeRasterBuffer(imgOut,imgBuffer,1.0,mini, minj,0, 0,params->tile_size, params->tile_size))) {
+    msFreeImage(imgOut);
+    return NULL;
+  }
+
+  return imgOut;
+}
+
 /************************************************************************
  *                            msTileExtractSubTile                      *
  *                                                                      *
@@ -125,9 +157,7 @@ static imageObj* msTileExtractSubTile(const mapservObj *msObj, const imageObj *i
 
   int width, mini, minj;
   int zoom = 2;
-  imageObj* imgOut = NULL;
   tileParams params;
-  rendererVTableObj *renderer;
   rasterBufferObj imgBuffer;
 
   if( !MS_RENDERER_PLUGIN(msObj->map->outputformat)
@@ -136,9 +166,8 @@ static imageObj* msTileExtractSubTile(const mapservObj *msObj, const imageObj *i
     msSetError(MS_MISCERR,"unsupported or mixed renderers","msTileExtractSubTile()");
     return NULL;
   }
-  renderer = MS_MAP_RENDERER(msObj->map);
 
-  if (renderer->getRasterBufferHandle((imageObj*)img,&imgBuffer) != MS_SUCCESS) {
+  if (MS_MAP_RENDERER(msObj->map)->getRasterBufferHandle((imageObj*)img,&imgBuffer) != MS_SUCCESS) {
     return NULL;
   }
 
@@ -208,25 +237,73 @@ static imageObj* msTileExtractSubTile(const mapservObj *msObj, const imageObj *i
     return(NULL); /* Huh? Should have a mode. */
   }
 
-  imgOut = msImageCreate(params.tile_size, params.tile_size, msObj->map->outputformat, NULL, NULL, msObj->map->resolution, msObj->map->defresolution, NULL);
+  return msTileCropImage(msObj, &imgBuffer, &params, mini, minj);
+}
 
-  if( imgOut == NULL ) {
-    return NULL;
-  }
 
-  if(msObj->map->debug)
-    msDebug("msTileExtractSubTile(): extracting (%d x %d) tile, top corner (%d, %d)\n",params.tile_size,params.tile_size,mini,minj);
+/************************************************************************
+ *                            msTileCheckCoords                         *
+ *                                                                      *
+ *  Checks one set of tile coordinates for legality, dropping the       *
+ *  metatile level when the tile zoom is too small for it.              *
+ ************************************************************************/
+#ifdef USE_TILE_API
+static int msTileCheckCoords(mapservObj *msObj, const char *coords, const tileParams *params)
+{
+  if( msObj->TileMode == TILE_GMAP ) {
 
+    int x, y, zoom;
+    double zoomfactor;
 
+    if( coords ) {
+      if( msTileGetGMapCoords(coords, &x, &y, &zoom) == MS_FAILURE )
+        return MS_FAILURE;
+    } else {
+      msSetError(MS_WEBERR, "Tile parameter not set.", "msTileCheckCoords()");
+      return MS_FAILURE;
+    }
 
-  if(UNLIKELY(MS_FAILURE == renderer->mergeRasterBuffer(imgOut,&imgBuffer,1.0,mini, minj,0, 0,params.tile_size, params.tile_size))) {
-    msFreeImage(imgOut);
-    return NULL;
+    if( params->metatile_level >= zoom ) {
+      msTileResetMetatileLevel(msObj->map);
+    }
+
+    zoomfactor = pow(2.0, (double)zoom);
+
+    /*
+    ** Check the input request for sanity.
+    */
+    if( x >= zoomfactor || y >= zoomfactor ) {
+      msSetError(MS_CGIERR, "GMap tile coordinates are too large for supplied zoom.", "msTileCheckCoords()");
+      return(MS_FAILURE);
+    }
+    if( x < 0 || y < 0 ) {
+      msSetError(MS_CGIERR, "GMap tile coordinates should not be less than zero.", "msTileCheckCoords()");
+      return(MS_FAILURE);
+    }
+
+  } else if ( msObj->TileMode == TILE_VE ) {
+
+    if( !coords || !*coords ) {
+      msSetError(MS_WEBERR, "Tile parameter not set.", "msTileCheckCoords()");
+      return MS_FAILURE;
+    }
+
+    if( strspn( coords, "0123" ) < strlen( coords ) ) {
+      msSetError(MS_CGIERR, "VE tile name should only include characters 0, 1, 2 and 3.", "msTileCheckCoords()");
+      return(MS_FAILURE);
+    }
+
+    if( params->metatile_level >= strlen(coords) ) {
+      msTileResetMetatileLevel(msObj->map);
+    }
+
+  } else {
+    return(MS_FAILURE); /* Huh? Should have a mode. */
   }
 
-  return imgOut;
+  return MS_SUCCESS;
 }
-
+#endif
 
 /************************************************************************
  *                            msTileSetup                               *
@@ -267,55 +344,29 @@ int msTileSetup(mapservObj* msObj)
   }
 
   /*
-  ** Set up the output extents for this tilemode and tile coordinates
+  ** Check the tile coordinates. Vector tile requests may list several
+  ** tiles separated by semicolons, returned together by msTileWriteMVT().
   */
-  if( msObj->TileMode == TILE_GMAP ) {
+  if( msObj->TileCoords && strchr(msObj->TileCoords, ';') ) {
+    char **tiles;
+    int i, numtiles, status = MS_SUCCESS;
 
-    int x, y, zoom;
-    double zoomfactor;
-
-    if( msObj->TileCoords ) {
-      if( msTileGetGMapCoords(msObj->TileCoords, &x, &y, &zoom) == MS_FAILURE )
-        return MS_FAILURE;
-    } else {
-      msSetError(MS_WEBERR, "Tile parameter not set.", "msTileSetup()");
+    if( strcmp(MS_IMAGE_MIME_TYPE(msObj->map->outputformat), "application/x-protobuf") != 0 ) {
+      msSetError(MS_WEBERR, "Multiple tiles can only be requested for vector tile output.", "msTileSetup()");
       return MS_FAILURE;
     }
-
-    if( params.metatile_level >= zoom ) {
-      msTileResetMetatileLevel(msObj->map);
-    }
-
-    zoomfactor = pow(2.0, (double)zoom);
-
-    /*
-    ** Check the input request for sanity.
-    */
-    if( x >= zoomfactor || y >= zoomfactor ) {
-      msSetError(MS_CGIERR, "GMap tile coordinates are too large for supplied zoom.", "msTileSetup()");
-      return(MS_FAILURE);
-    }
-    if( x < 0 || y < 0 ) {
-      msSetError(MS_CGIERR, "GMap tile coordinates should not be less than zero.", "msTileSetup()");
-      return(MS_FAILURE);
-    }
-
-  } else if ( msObj->TileMode == TILE_VE ) {
-
-    if( strspn( msObj->TileCoords, "0123" ) < strlen( msObj->TileCoords ) ) {
-      msSetError(MS_CGIERR, "VE tile name should only include characters 0, 1, 2 and 3.", "msTileSetup()");
-      return(MS_FAILURE);
-    }
-
-    if( params.metatile_level >= strlen(msObj->TileCoords) ) {
-      msTileResetMetatileLevel(msObj->map);
+    tiles = msStringSplit(msObj->TileCoords, ';', &numtiles);
+    if( numtiles > MS_TILE_MAX_BATCH ) {
+      msSetError(MS_WEBERR, "Too many tiles requested (%d), the limit is %d.", "msTileSetup()", numtiles, MS_TILE_MAX_BATCH);
+      status = MS_FAILURE;
     }
-
-  } else {
-    return(MS_FAILURE); /* Huh? Should have a mode. */
+    for( i = 0; i < numtiles && status == MS_SUCCESS; i++ )
+      status = msTileCheckCoords(msObj, tiles[i], &params);
+    msFreeCharArray(tiles, numtiles);
+    return status;
   }
 
-  return MS_SUCCESS;
+  return msTileCheckCoords(msObj, msObj->TileCoords, &params);
 #else
   msSetError(MS_CGIERR, "Tile API is not available.", "msTileSetup()");
   return(MS_FAILURE);
@@ -504,6 +555,497 @@ int msTileSetExtent(mapservObj* msObj)
 
 
 
+/************************************************************************
+ *                            msTileWriteMVT                            *
+ *                                                                      *
+ *  Writes the vector tile output of a tile request. When the tile      *
+ *  parameter lists several tiles separated by semicolons (e.g.         *
+ *  tile=0 0 1;1 0 1), all of them are built with a single pass over    *
+ *  the layers and sent as one multipart/mixed response, each part      *
+ *  carrying the tile name (z/x/y, or the quadkey in ve mode) as its    *
+ *  Content-Location. This is meant for seeding caches, where opening   *
+ *  the layers once per tile dominates.                                 *
+ ************************************************************************/
+int msTileWriteMVT(mapservObj *msObj)
+{
+#ifdef USE_TILE_API
+  char *coords = msObj->TileCoords;
+  char **tiles, **names;
+  rectObj *extents;
+  int i, numtiles, status = MS_SUCCESS;
+
+  if( !strchr(coords, ';') ) {
+    if( msTileSetExtent(msObj) != MS_SUCCESS )
+      return MS_FAILURE;
+    return msMVTWriteTile(msObj->map, msObj->sendheaders);
+  }
+
+  tiles = msStringSplit(coords, ';', &numtiles);
+  extents = (rectObj*) msSmallMalloc(numtiles * sizeof(rectObj));
+  names = (char**) msSmallCalloc(numtiles, sizeof(char*));
+
+  for( i = 0; i < numtiles; i++ ) {
+    msObj->TileCoords = tiles[i];
+    if( (status = msTileSetExtent(msObj)) != MS_SUCCESS )
+      break;
+    extents[i] = msObj->map->extent;
+
+    if( msObj->TileMode == TILE_GMAP ) {
+      int x, y, zoom;
+      char name[64];
+      msTileGetGMapCoords(tiles[i], &x, &y, &zoom);
+      snprintf(name, sizeof(name), "%d/%d/%d", zoom, x, y);
+      names[i] = msStrdup(name);
+    } else {
+      names[i] = msStrdup(tiles[i]);
+    }
+  }
+  msObj->TileCoords = coords;
+
+  if( status == MS_SUCCESS )
+    status = msMVTWriteTiles(msObj->map, extents, names, numtiles, msObj->sendheaders);
+
+  msFreeCharArray(names, numtiles);
+  msFreeCharArray(tiles, numtiles);
+  msFree(extents);
+  return status;
+#else
+  msSetError(MS_CGIERR, "Tile API is not available.", "msTileWriteMVT()");
+  return(MS_FAILURE);
+#endif
+}
+
+
+
+/************************************************************************
+ *                            msTileCacheGetParams                      *
+ *                                                                      *
+ *  Tile cache: when the tile_cache metadata names a directory, every   *
+ *  tile drawn is encoded and saved there, along with the sibling       *
+ *  tiles of its metatile, and later requests are answered from the     *
+ *  saved files without drawing the map again. Tiles are stored as      *
+ *  <tile_cache>/<key>/<z>/<x>/<y>.<ext> (<key>/<quadkey>.<ext> in ve   *
+ *  mode), see msTileCacheGetKeyDir() for the key. They expire after    *
+ *  tile_cache_expire seconds (never if unset). Vector tiles            *
+ *  (application/x-protobuf) are written by msTileWriteMVT() and are    *
+ *  neither cached nor given an ETag.                                   *
+ *  Returns the cache directory, or NULL if tiles are not cached.       *
+ ************************************************************************/
+static const char* msTileCacheGetParams(const mapservObj *msObj, tileParams *params)
+{
+  const char *dir = msLookupHashTable(&(msObj->map->web.metadata), "tile_cache");
+
+  msTileGetParams(msObj->map, params);
+  if( !dir || !*dir || !msObj->TileCoords ||
+      !MS_RENDERER_PLUGIN(msObj->map->outputformat) ||
+      !MS_MAP_RENDERER(msObj->map)->supports_pixel_buffer )
+    return NULL;
+  return dir;
+}
+
+/*
+** Mapfile the request was answered from, found the same way as in
+** msCGILoadMap().
+*/
+static const char* msTileCacheGetMapfile(const mapservObj *msObj)
+{
+  int i;
+
+  for( i = 0; msObj->request && i < msObj->request->NumParams; i++ ) {
+    if( strcasecmp(msObj->request->ParamNames[i], "map") == 0 ) {
+      if( getenv(msObj->request->ParamValues[i]) )
+        return getenv(msObj->request->ParamValues[i]);
+      return msObj->request->ParamValues[i];
+    }
+  }
+  return getenv("MS_MAPFILE");
+}
+
+/*
+** Can the request parameter be substituted into the map (see
+** msApplySubstitutions())?
+*/
+static int msTileCacheIsSubstitution(mapObj *map, const char *name)
+{
+  int i, j;
+
+  if( msLookupHashTable(&(map->web.validation), name) )
+    return MS_TRUE;
+  for( i = 0; i < map->numlayers; i++ ) {
+    layerObj *layer = GET_LAYER(map, i);
+    if( msLookupHashTable(&(layer->validation), name) )
+      return MS_TRUE;
+    for( j = 0; j < layer->numclasses; j++ ) {
+      if( msLookupHashTable(&(layer->class[j]->validation), name) )
+        return MS_TRUE;
+    }
+  }
+  return MS_FALSE;
+}
+
+/* name and value, length prefixed so that no two lists of items give the same key */
+static char* msTileCacheAddKeyItem(char *key, const char *name, const char *value)
+{
+  char buffer[32];
+
+  snprintf(buffer, sizeof(buffer), "%d:", (int)strlen(name));
+  key = msStringConcatenate(key, buffer);
+  key = msStringConcatenate(key, name);
+  snprintf(buffer, sizeof(buffer), "%d:", (int)strlen(value));
+  key = msStringConcatenate(key, buffer);
+  key = msStringConcatenate(key, value);
+  return msStringConcatenate(key, "\n");
+}
+
+/************************************************************************
+ *                            msTileGetSubTile                          *
+ *                                                                      *
+ *  Position of the requested tile in its metatile.                     *
+ ************************************************************************/
+static int msTileGetSubTile(const mapservObj *msObj, const tileParams *params, int *subx, int *suby)
+{
+  *subx = *suby = 0;
+  if( msObj->TileMode == TILE_GMAP ) {
+    int x, y, zoom;
+    if( msTileGetGMapCoords(msObj->TileCoords, &x, &y, &zoom) == MS_FAILURE )
+      return MS_FAILURE;
+    *subx = x & ((1 << params->metatile_level) - 1);
+    *suby = y & ((1 << params->metatile_level) - 1);
+  } else {
+    int i, len = strlen(msObj->TileCoords);
+    for( i = MS_MAX(0, len - params->metatile_level); i < len; i++ ) {
+      *subx = (*subx << 1) | ((msObj->TileCoords[i] - '0') & 1);
+      *suby = (*suby << 1) | (((msObj->TileCoords[i] - '0') >> 1) & 1);
+    }
+  }
+  return MS_SUCCESS;
+}
+
+/************************************************************************
+ *                            msTileCacheGetPath                        *
+ *                                                                      *
+ *  Build the file name of the sub-tile at (subx, suby) of the          *
+ *  metatile holding the requested tile, in the key directory.          *
+ ************************************************************************/
+static int msTileCacheGetPath(const mapservObj *msObj, const tileParams *params, const char *keydir,
+                              int subx, int suby, char *path)
+{
+  char name[256], file[MS_MAXPATHLEN];
+  int i;
+
+  if( msObj->TileMode == TILE_GMAP ) {
+    int x, y, zoom;
+    if( msTileGetGMapCoords(msObj->TileCoords, &x, &y, &zoom) == MS_FAILURE )
+      return MS_FAILURE;
+    x = ((x >> params->metatile_level) << params->metatile_level) + subx;
+    y = ((y >> params->metatile_level) << params->metatile_level) + suby;
+    snprintf(name, sizeof(name), "%d/%d/%d", zoom, x, y);
+  } else if( msObj->TileMode == TILE_VE ) {
+    int len = strlen(msObj->TileCoords) - params->metatile_level;
+    if( len < 0 || (size_t)(len + params->metatile_level) >= sizeof(name) )
+      return MS_FAILURE;
+    memcpy(name, msObj->TileCoords, len);
+    /* quadkey digits of the sub-tile, from the largest quadrant down */
+    for( i = params->metatile_level - 1; i >= 0; i-- )
+      name[len++] = '0' + ((subx >> i) & 1) + 2 * ((suby >> i) & 1);
+    name[len] = '\0';
+  } else {
+    return MS_FAILURE;
+  }
+
+  snprintf(file, sizeof(file), "%s.%s", name, MS_IMAGE_EXTENSION(msObj->map->outputformat));
+  if( !msBuildPath(path, keydir, file) )
+    return MS_FAILURE;
+  return MS_SUCCESS;
+}
+
+/************************************************************************
+ *                            msTileCacheWrite                          *
+ *                                                                      *
+ *  Save one encoded tile, creating its directories as needed. The      *
+ *  tile is written aside and renamed so that concurrent requests never *
+ *  read half of it. Failures are only reported as debug messages: the  *
+ *  request itself can still be answered.                               *
+ ************************************************************************/
+static void msTileCacheWrite(const mapservObj *msObj, const char *path, const unsigned char *data, int size)
+{
+  char tmpname[MS_MAXPATHLEN + 64], *uniq, *sep;
+  FILE *stream;
+  int written;
+
+  uniq = msTmpFilename("tmp");
+  snprintf(tmpname, sizeof(tmpname), "%s.%s", path, uniq);
+  msFree(uniq);
+
+  stream = fopen(tmpname, "wb");
+  if( !stream ) {
+    /* create the missing directories, skipping the root and drive */
+    for( sep = tmpname + 1; (sep = strpbrk(sep, "/\\")) != NULL; sep++ ) {
+      char c = *sep;
+      *sep = '\0';
+#ifdef _WIN32
+      _mkdir(tmpname);
+#else
+      mkdir(tmpname, 0777);
+#endif
+      *sep = c;
+    }
+    stream = fopen(tmpname, "wb");
+  }
+  if( !stream ) {
+    if(msObj->map->debug)
+      msDebug("msTileCacheWrite(): unable to write %s\n", tmpname);
+    return;
+  }
+  written = fwrite(data, 1, size, stream);
+  fclose(stream);
+  if( written != size || rename(tmpname, path) != 0 ) {
+    remove(tmpname);
+    if(msObj->map->debug)
+      msDebug("msTileCacheWrite(): unable to store %s\n", path);
+  }
+}
+
+/************************************************************************
+ *                            msTileCacheGetKeyDir                      *
+ *                                                                      *
+ *  Directory of the tiles drawn from the same map as the request. The  *
+ *  key lists what the image depends on: the mapfile and its            *
+ *  modification time (INCLUDEd files are not checked, use              *
+ *  tile_cache_expire for those), the output format, the tile settings, *
+ *  the status and class group of each layer, and the map_*, context    *
+ *  and runtime substitution parameters. Other request parameters are   *
+ *  ignored, so that they can't be used to fill the disk with copies of *
+ *  the same tiles. The directory is named after a 64 bit hash of the   *
+ *  key and holds the full key in a key.txt file, which is compared on  *
+ *  every lookup: when two keys share a hash the second one is simply   *
+ *  not cached. With create set, a missing key.txt is written.          *
+ ************************************************************************/
+static int msTileCacheGetKeyDir(const mapservObj *msObj, const tileParams *params, const char *dir,
+                                int create, char *keydir)
+{
+  char szPath[MS_MAXPATHLEN], keypath[MS_MAXPATHLEN], buffer[256], *key = NULL;
+  const char *mapfile, *name;
+  struct stat stat_buf;
+  ms_uint32 fnv = 2166136261U, oaat = 0;
+  int i, keylen, status = MS_FAILURE;
+  FILE *stream;
+
+  if( (mapfile = msTileCacheGetMapfile(msObj)) == NULL || stat(mapfile, &stat_buf) != 0 )
+    return MS_FAILURE;
+
+  snprintf(buffer, sizeof(buffer), "%ld %ld", (long)stat_buf.st_mtime, (long)stat_buf.st_size);
+  key = msTileCacheAddKeyItem(key, mapfile, buffer);
+  key = msTileCacheAddKeyItem(key, "name", msObj->map->name ? msObj->map->name : "");
+  key = msTileCacheAddKeyItem(key, "mappath", msObj->map->mappath ? msObj->map->mappath : "");
+  key = msTileCacheAddKeyItem(key, "format", msObj->map->outputformat->name);
+  snprintf(buffer, sizeof(buffer), "%d %d %d", msObj->TileMode, params->metatile_level, params->map_edge_buffer);
+  key = msTileCacheAddKeyItem(key, "tile", buffer);
+  for( i = 0; i < msObj->map->numlayers; i++ ) {
+    layerObj *layer = GET_LAYER(msObj->map, i);
+    snprintf(buffer, sizeof(buffer), "%d %s", layer->status, layer->classgroup ? layer->classgroup : "");
+    key = msTileCacheAddKeyItem(key, "layer", buffer);
+  }
+  for( i = 0; msObj->request && i < msObj->request->NumParams; i++ ) {
+    name = msObj->request->ParamNames[i];
+    if( strncasecmp(name, "map_", 4) == 0 || strncasecmp(name, "map.", 4) == 0 ||
+        strcasecmp(name, "context") == 0 || msTileCacheIsSubstitution(msObj->map, name) )
+      key = msTileCacheAddKeyItem(key, name, msObj->request->ParamValues[i]);
+  }
+
+  /* FNV-1a and Jenkins' one-at-a-time hashes side by side */
+  keylen = strlen(key);
+  for( i = 0; i < keylen; i++ ) {
+    fnv = (fnv ^ (unsigned char)key[i]) * 16777619;
+    oaat += (unsigned char)key[i];
+    oaat += oaat << 10;
+    oaat ^= oaat >> 6;
+  }
+  oaat += oaat << 3;
+  oaat ^= oaat >> 11;
+  oaat += oaat << 15;
+
+  snprintf(buffer, sizeof(buffer), "%08x%08x", fnv, oaat);
+  if( !msBuildPath(szPath, msObj->map->mappath, dir) || !msBuildPath(keydir, szPath, buffer) ||
+      !msBuildPath(keypath, keydir, "key.txt") ) {
+    msFree(key);
+    return MS_FAILURE;
+  }
+
+  if( stat(keypath, &stat_buf) == 0 ) {
+    if( stat_buf.st_size == keylen && (stream = fopen(keypath, "rb")) != NULL ) {
+      char *stored = (char*)msSmallMalloc(keylen + 1);
+      if( (int)fread(stored, 1, keylen, stream) == keylen && memcmp(stored, key, keylen) == 0 )
+        status = MS_SUCCESS;
+      msFree(stored);
+      fclose(stream);
+    }
+    if( status != MS_SUCCESS && msObj->map->debug )
+      msDebug("msTileCacheGetKeyDir(): %s belongs to other requests, not caching\n", keydir);
+  } else if( create ) {
+    msTileCacheWrite(msObj, keypath, (unsigned char*)key, keylen);
+    status = MS_SUCCESS;
+  }
+
+  msFree(key);
+  return status;
+}
+
+/************************************************************************
+ *                            msTileEncodeImage                         *
+ *                                                                      *
+ *  Encode an image to memory exactly as msSaveImage() would write it   *
+ *  to the client.                                                      *
+ ************************************************************************/
+unsigned char* msTileEncodeImage(mapObj *map, imageObj *img, int *size)
+{
+  msIOContext *old_context;
+  msIOBuffer *buffer;
+  unsigned char *data = NULL;
+
+  *size = 0;
+  old_context = msIO_pushStdoutToBufferAndGetOldContext();
+  if( msSaveImage(map, img, NULL) == MS_SUCCESS ) {
+    buffer = (msIOBuffer *) msIO_getHandler(stdout)->cbData;
+    data = buffer->data;
+    *size = buffer->data_offset;
+    buffer->data = NULL;
+  }
+  msIO_restoreOldStdoutContext(old_context);
+  return data;
+}
+
+/************************************************************************
+ *                            msTileCacheStore                          *
+ *                                                                      *
+ *  Save the sibling sub-tiles of the metatile image, the requested     *
+ *  one is saved by msTilePutCached() once encoded for the response.    *
+ ************************************************************************/
+static void msTileCacheStore(const mapservObj *msObj, imageObj *img)
+{
+  char path[MS_MAXPATHLEN], keydir[MS_MAXPATHLEN];
+  const char *dir;
+  tileParams params;
+  rasterBufferObj imgBuffer;
+  int subx, suby, reqx, reqy, count;
+
+  if( (dir = msTileCacheGetParams(msObj, &params)) == NULL || params.metatile_level <= 0 ||
+      msTileGetSubTile(msObj, &params, &reqx, &reqy) != MS_SUCCESS ||
+      msTileCacheGetKeyDir(msObj, &params, dir, MS_TRUE, keydir) != MS_SUCCESS ||
+      msObj->map->outputformat->renderer != img->format->renderer ||
+      MS_MAP_RENDERER(msObj->map)->getRasterBufferHandle(img, &imgBuffer) != MS_SUCCESS )
+    return;
+
+  count = 1 << params.metatile_level;
+  for( suby = 0; suby < count; suby++ ) {
+    for( subx = 0; subx < count; subx++ ) {
+      imageObj *tile;
+      unsigned char *data;
+      int size;
+
+      if( subx == reqx && suby == reqy )
+        continue;
+      if( msTileCacheGetPath(msObj, &params, keydir, subx, suby, path) != MS_SUCCESS )
+        return;
+      tile = msTileCropImage(msObj, &imgBuffer, &params,
+                             params.map_edge_buffer + subx * params.tile_size,
+                             params.map_edge_buffer + suby * params.tile_size);
+      if( !tile )
+        return;
+      data = msTileEncodeImage(msObj->map, tile, &size);
+      msFreeImage(tile);
+      if( !data )
+        return;
+      msTileCacheWrite(msObj, path, data, size);
+      msFree(data);
+    }
+  }
+}
+
+/************************************************************************
+ *                            msTileGetCached                           *
+ *                                                                      *
+ *  Return the encoded tile from the tile cache, or NULL if it is not   *
+ *  cached (or expired) and has to be drawn. The caller frees the       *
+ *  returned buffer.                                                    *
+ ************************************************************************/
+unsigned char* msTileGetCached(mapservObj *msObj, int *size)
+{
+  char path[MS_MAXPATHLEN], keydir[MS_MAXPATHLEN];
+  const char *dir, *value;
+  tileParams params;
+  struct stat stat_buf;
+  unsigned char *data;
+  FILE *stream;
+  int subx, suby;
+
+  if( (dir = msTileCacheGetParams(msObj, &params)) == NULL ||
+      msTileGetSubTile(msObj, &params, &subx, &suby) != MS_SUCCESS ||
+      msTileCacheGetKeyDir(msObj, &params, dir, MS_FALSE, keydir) != MS_SUCCESS ||
+      msTileCacheGetPath(msObj, &params, keydir, subx, suby, path) != MS_SUCCESS ||
+      stat(path, &stat_buf) != 0 || stat_buf.st_size <= 0 )
+    return NULL;
+
+  if( (value = msLookupHashTable(&(msObj->map->web.metadata), "tile_cache_expire")) != NULL &&
+      atoi(value) > 0 && time(NULL) - stat_buf.st_mtime > atoi(value) ) {
+    if(msObj->map->debug)
+      msDebug("msTileGetCached(): %s expired\n", path);
+    return NULL;
+  }
+
+  if( (stream = fopen(path, "rb")) == NULL )
+    return NULL;
+  data = (unsigned char*)msSmallMalloc(stat_buf.st_size);
+  *size = fread(data, 1, stat_buf.st_size, stream);
+  fclose(stream);
+  if( *size != stat_buf.st_size ) {
+    msFree(data);
+    return NULL;
+  }
+
+  if(msObj->map->debug)
+    msDebug("msTileGetCached(): serving %s\n", path);
+  return data;
+}
+
+/************************************************************************
+ *                            msTilePutCached                           *
+ *                                                                      *
+ *  Save the encoded requested tile in the tile cache, if enabled.      *
+ ************************************************************************/
+void msTilePutCached(mapservObj *msObj, const unsigned char *data, int size)
+{
+  char path[MS_MAXPATHLEN], keydir[MS_MAXPATHLEN];
+  const char *dir;
+  tileParams params;
+  int subx, suby;
+
+  if( (dir = msTileCacheGetParams(msObj, &params)) != NULL &&
+      msTileGetSubTile(msObj, &params, &subx, &suby) == MS_SUCCESS &&
+      msTileCacheGetKeyDir(msObj, &params, dir, MS_TRUE, keydir) == MS_SUCCESS &&
+      msTileCacheGetPath(msObj, &params, keydir, subx, suby, path) == MS_SUCCESS )
+    msTileCacheWrite(msObj, path, data, size);
+}
+
+/************************************************************************
+ *                            msTileGetETag                             *
+ *                                                                      *
+ *  Quoted entity tag of an encoded tile, computed from its content so  *
+ *  that it is the same whether the tile was drawn or read from the     *
+ *  cache. etag must hold at least 32 characters.                       *
+ ************************************************************************/
+void msTileGetETag(const unsigned char *data, int size, char *etag)
+{
+  ms_uint32 fnv = 2166136261U, djb = 5381;
+  int i;
+
+  for( i = 0; i < size; i++ ) {
+    fnv = (fnv ^ data[i]) * 16777619;
+    djb = (djb * 33) ^ data[i];
+  }
+  snprintf(etag, 32, "\"%08x%08x-%x\"", fnv, djb, size);
+}
+
 /************************************************************************
  *                            msDrawTile                                *
  *                                                                      *
@@ -522,7 +1064,9 @@ imageObj* msTileDraw(mapservObj *msObj)
   if( img == NULL )
     return NULL;
   if( params.metatile_level > 0 || params.map_edge_buffer > 0 ) {
-    imageObj *tmp = msTileExtractSubTile(msObj, img);
+    imageObj *tmp;
+    msTileCacheStore(msObj, img);
+    tmp = msTileExtractSubTile(msObj, img);
     msFreeImage(img);
     if( tmp == NULL )
       return NULL;
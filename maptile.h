@@ -37,6 +37,7 @@
 #define SPHEREMERC_PROJ4 "+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +units=m +k=1.0 +nadgrids=@null"
 #define SPHEREMERC_GROUND_SIZE (20037508.34*2)
 #define SPHEREMERC_IMAGE_SIZE 0x0100
+#define MS_TILE_MAX_BATCH 256 /* most vector tiles in a single request */
 
 enum tileModes { TILE_GMAP, TILE_VE };
 
@@ -44,6 +45,11 @@ MS_DLL_EXPORT int msTileSetup(mapservObj *msObj);
 MS_DLL_EXPORT int msTileSetExtent(mapservObj *msObj);
 MS_DLL_EXPORT int msTileSetProjections(mapObj *map);
 MS_DLL_EXPORT imageObj* msTileDraw(mapservObj *msObj);
+MS_DLL_EXPORT int msTileWriteMVT(mapservObj *msObj);
+MS_DLL_EXPORT unsigned char* msTileGetCached(mapservObj *msObj, int *size);
+MS_DLL_EXPORT void msTilePutCached(mapservObj *msObj, const unsigned char *data, int size);
+MS_DLL_EXPORT unsigned char* msTileEncodeImage(mapObj *map, imageObj *img, int *size);
+MS_DLL_EXPORT void msTileGetETag(const unsigned char *data, int size, char *etag);
 
 typedef struct {
   int metatile_level; /* In zoom levels above tile request: best bet is 0, 1 or 2 */
@@ -30,6 +30,10 @@
 
 #include "mapserver.h"
 #include "maptree.h"
+#include "mapthread.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 
@@ -527,7 +531,7 @@ error:
   return;
 }
 
-ms_bitarray msSearchDiskTree(const char *filename, rectObj aoi, int debug, int numshapes)
+static ms_bitarray msSearchDiskTreeUncached(const char *filename, rectObj aoi, int debug, int numshapes)
 {
   SHPTreeHandle disktree;
   ms_bitarray status=NULL;
@@ -596,14 +600,15 @@ treeNodeObj *readTreeNode( SHPTreeHandle disktree )
     return NULL;
   }
   if ( disktree->needswap ) SwapWord ( 4, &node->numshapes );
-  if( node->numshapes > 0 )
+  if( node->numshapes > 0 ) {
     node->ids = (ms_int32 *)msSmallMalloc(sizeof(ms_int32)*node->numshapes);
-  res = fread( node->ids, node->numshapes*4, 1, disktree->fp );
-  if ( !res )
-  {
-    free(node->ids);
-    free(node);
-    return NULL;
+    res = fread( node->ids, node->numshapes*4, 1, disktree->fp );
+    if ( !res )
+    {
+      free(node->ids);
+      free(node);
+      return NULL;
+    }
   }
   for( i=0; i < node->numshapes; i++ ) {
     if ( disktree->needswap ) SwapWord ( 4, &node->ids[i] );
@@ -621,6 +626,237 @@ treeNodeObj *readTreeNode( SHPTreeHandle disktree )
   return node;
 }
 
+/* ==================================================================== */
+/*      Process wide cache of decoded .qix trees.                       */
+/*                                                                      */
+/*      When the MS_QIX_CACHE_SIZE environment variable is set (in      */
+/*      megabytes), msSearchDiskTree() reads each index once into a     */
+/*      treeObj and searches it in memory with msSearchTree() on        */
+/*      subsequent calls. Entries are keyed by filename, revalidated    */
+/*      against the file size and modification time, and the least      */
+/*      recently used trees are dropped once the budget is exceeded.    */
+/* ==================================================================== */
+typedef struct treeCacheEntry {
+  char *filename;
+  time_t mtime;
+  off_t size;
+  treeObj *tree;
+  size_t memsize;
+  int refcount; /* number of searches currently using the tree */
+  int stale; /* replaced or evicted, free once refcount drops to 0 */
+  struct treeCacheEntry *prev, *next; /* most recently used first */
+} treeCacheEntryObj;
+
+static treeCacheEntryObj *treeCacheHead = NULL, *treeCacheTail = NULL;
+static size_t treeCacheMemSize = 0;
+static unsigned long treeCacheHits = 0, treeCacheMisses = 0;
+
+static size_t treeCacheGetBudget()
+{
+  const char *value = getenv("MS_QIX_CACHE_SIZE");
+
+  if(!value || atoi(value) <= 0) return 0;
+  return (size_t)atoi(value) * 1024 * 1024;
+}
+
+static void treeCacheFreeEntry(treeCacheEntryObj *entry)
+{
+  msDestroyTree(entry->tree);
+  msFree(entry->filename);
+  free(entry);
+}
+
+/* remove an entry from the list, the caller must hold TLOCK_TREECACHE */
+static void treeCacheUnlink(treeCacheEntryObj *entry)
+{
+  if(entry->prev) entry->prev->next = entry->next;
+  else treeCacheHead = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  else treeCacheTail = entry->prev;
+  entry->prev = entry->next = NULL;
+
+  treeCacheMemSize -= entry->memsize;
+  entry->stale = MS_TRUE;
+  if(entry->refcount == 0)
+    treeCacheFreeEntry(entry);
+}
+
+static void treeCacheMoveToHead(treeCacheEntryObj *entry)
+{
+  if(entry == treeCacheHead) return;
+
+  /* unlink... */
+  entry->prev->next = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  else treeCacheTail = entry->prev;
+
+  /* ...and relink at the head */
+  entry->prev = NULL;
+  entry->next = treeCacheHead;
+  treeCacheHead->prev = entry;
+  treeCacheHead = entry;
+}
+
+static treeNodeObj *readTreeNodes(SHPTreeHandle disktree, size_t *memsize)
+{
+  int i;
+  treeNodeObj *node;
+
+  node = readTreeNode(disktree);
+  if(!node) return NULL;
+
+  *memsize += sizeof(treeNodeObj) + node->numshapes*sizeof(ms_int32);
+
+  if(node->numsubnodes < 0 || node->numsubnodes > MAX_SUBNODES) {
+    node->numsubnodes = 0;
+    destroyTreeNode(node);
+    return NULL;
+  }
+
+  for(i=0; i<node->numsubnodes; i++) {
+    node->subnode[i] = readTreeNodes(disktree, memsize);
+    if(!node->subnode[i]) {
+      node->numsubnodes = i;
+      destroyTreeNode(node);
+      return NULL;
+    }
+  }
+
+  return node;
+}
+
+/*
+** Reads a complete .qix file into memory, NULL if it can't be opened or is corrupt.
+*/
+static treeObj *readTreeAll(const char *filename, int debug, size_t *memsize)
+{
+  treeObj *tree;
+  SHPTreeHandle disktree;
+
+  disktree = msSHPDiskTreeOpen(filename, debug);
+  if(!disktree) return NULL;
+
+  tree = (treeObj *) msSmallMalloc(sizeof(treeObj));
+  tree->numshapes = disktree->nShapes;
+  tree->maxdepth = disktree->nDepth;
+
+  *memsize = sizeof(treeObj);
+  tree->root = readTreeNodes(disktree, memsize);
+  msSHPDiskTreeClose(disktree);
+
+  if(!tree->root) {
+    free(tree);
+    return NULL;
+  }
+
+  return tree;
+}
+
+static ms_bitarray treeSearchChecked(const treeObj *tree, const char *filename, rectObj aoi, int numshapes)
+{
+  if(tree->numshapes != numshapes) {
+    msSetError(MS_SHPERR, "The spatial index file %s is corrupt.", "msSearchDiskTree()", filename);
+    return NULL;
+  }
+  return msSearchTree(tree, aoi);
+}
+
+ms_bitarray msSearchDiskTree(const char *filename, rectObj aoi, int debug, int numshapes)
+{
+  struct stat stat_buf;
+  size_t budget, memsize = 0;
+  treeCacheEntryObj *entry, *other;
+  treeObj *tree;
+  ms_bitarray status;
+
+  budget = treeCacheGetBudget();
+  if(budget == 0 || stat(filename, &stat_buf) != 0)
+    return msSearchDiskTreeUncached(filename, aoi, debug, numshapes);
+
+  msAcquireLock(TLOCK_TREECACHE);
+  for(entry=treeCacheHead; entry; entry=entry->next) {
+    if(strcmp(entry->filename, filename) == 0) break;
+  }
+  if(entry && (entry->mtime != stat_buf.st_mtime || entry->size != stat_buf.st_size)) {
+    treeCacheUnlink(entry); /* index was rebuilt */
+    entry = NULL;
+  }
+  if(entry) {
+    treeCacheHits++;
+    treeCacheMoveToHead(entry);
+    entry->refcount++;
+  } else {
+    treeCacheMisses++;
+  }
+  msReleaseLock(TLOCK_TREECACHE);
+
+  if(!entry) {
+    tree = readTreeAll(filename, debug, &memsize);
+    if(!tree) /* let the regular code path report the problem */
+      return msSearchDiskTreeUncached(filename, aoi, debug, numshapes);
+
+    if(memsize > budget) { /* would never fit, don't cache it */
+      if(debug)
+        msDebug("msSearchDiskTree(): %s needs %ld bytes, larger than the MS_QIX_CACHE_SIZE budget.\n", filename, (long)memsize);
+      status = treeSearchChecked(tree, filename, aoi, numshapes);
+      msDestroyTree(tree);
+      return status;
+    }
+
+    entry = (treeCacheEntryObj *) msSmallCalloc(1, sizeof(treeCacheEntryObj));
+    entry->filename = msStrdup(filename);
+    entry->mtime = stat_buf.st_mtime;
+    entry->size = stat_buf.st_size;
+    entry->tree = tree;
+    entry->memsize = memsize;
+    entry->refcount = 1;
+
+    msAcquireLock(TLOCK_TREECACHE);
+    for(other=treeCacheHead; other; other=other->next) { /* loaded concurrently by another thread */
+      if(strcmp(other->filename, filename) == 0) {
+        treeCacheUnlink(other);
+        break;
+      }
+    }
+    entry->next = treeCacheHead;
+    if(treeCacheHead) treeCacheHead->prev = entry;
+    treeCacheHead = entry;
+    if(!treeCacheTail) treeCacheTail = entry;
+    treeCacheMemSize += memsize;
+
+    /* evict least recently used trees until we are within budget again */
+    while(treeCacheMemSize > budget && treeCacheTail != entry)
+      treeCacheUnlink(treeCacheTail);
+    msReleaseLock(TLOCK_TREECACHE);
+  }
+
+  if(debug)
+    msDebug("msSearchDiskTree(): %s %s (hits=%lu, misses=%lu, %ld bytes cached)\n", filename,
+            memsize ? "loaded into cache" : "found in cache", treeCacheHits, treeCacheMisses, (long)treeCacheMemSize);
+
+  status = treeSearchChecked(entry->tree, filename, aoi, numshapes);
+
+  msAcquireLock(TLOCK_TREECACHE);
+  entry->refcount--;
+  if(entry->stale && entry->refcount == 0)
+    treeCacheFreeEntry(entry);
+  msReleaseLock(TLOCK_TREECACHE);
+
+  return status;
+}
+
+/*
+** Releases all cached trees, called from msCleanup().
+*/
+void msTreeCacheCleanup()
+{
+  msAcquireLock(TLOCK_TREECACHE);
+  while(treeCacheHead)
+    treeCacheUnlink(treeCacheHead);
+  treeCacheHits = treeCacheMisses = 0;
+  msReleaseLock(TLOCK_TREECACHE);
+}
+
 treeObj *msReadTree(char *filename, int debug)
 {
   treeObj *tree=NULL;
@@ -75,6 +75,9 @@ extern "C" {
 #define MS_NEW_LSB_ORDER 1
 #define MS_NEW_MSB_ORDER 2
 
+  /* number of entries per page of a packed Hilbert R-tree (.hix) */
+#define MS_HRTREE_NODE_SIZE 16
+
 
   MS_DLL_EXPORT SHPTreeHandle msSHPDiskTreeOpen(const char * pszTree, int debug);
   MS_DLL_EXPORT void msSHPDiskTreeClose(SHPTreeHandle disktree);
@@ -86,10 +89,15 @@ extern "C" {
 
   MS_DLL_EXPORT ms_bitarray msSearchTree(const treeObj *tree, rectObj aoi);
   MS_DLL_EXPORT ms_bitarray msSearchDiskTree(const char *filename, rectObj aoi, int debug, int numshapes);
+  MS_DLL_EXPORT void msTreeCacheCleanup(void);
 
   MS_DLL_EXPORT treeObj *msReadTree(char *filename, int debug);
   MS_DLL_EXPORT int msWriteTree(treeObj *tree, char *filename, int LSB_order);
 
+  MS_DLL_EXPORT ms_uint32 msHilbertIndex(ms_uint32 n, ms_uint32 x, ms_uint32 y);
+  MS_DLL_EXPORT int msWriteHilbertTree(shapefileObj *shapefile, const char *filename);
+  MS_DLL_EXPORT ms_bitarray msSearchHilbertTree(const char *filename, rectObj aoi, int debug, int numshapes);
+
   MS_DLL_EXPORT void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_rect);
 
 #ifdef __cplusplus
@@ -295,6 +295,7 @@ void msUnionLayerFreeItemInfo(layerObj *layer)
 void msUnionLayerFreeExpressionTokens(layerObj *layer)
 {
   int i,j;
+  msFreeClassLookup(layer);
   msFreeExpressionTokens(&(layer->filter));
   msFreeExpressionTokens(&(layer->cluster.group));
   msFreeExpressionTokens(&(layer->cluster.filter));
@@ -38,6 +38,7 @@
 #include "mapthread.h"
 #include "mapcopy.h"
 #include "mapows.h"
+#include "uthash.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
 # include <windows.h>
@@ -576,14 +577,246 @@ int *msAllocateValidClassGroups(layerObj *lp, int *nclasses)
 
 }
 
+/*
+** Class lookup table. When every class of a layer compares a single attribute
+** with string literals (CLASSITEM strings and {lists}, ("[ATTR]" = "value") or
+** ("[ATTR]" IN "a,b") expressions) the candidate classes for a value are found
+** with a single hash lookup instead of evaluating each expression in turn.
+** Candidates are kept as positions in the class list so that the first
+** matching class still wins.
+*/
+typedef struct {
+  char *value;
+  int *positions; /* ascending */
+  int numpositions;
+  UT_hash_handle hh;
+} classLookupValueObj;
+
+typedef struct {
+  int usable; /* MS_FALSE if some expression can't be looked up */
+  int itemindex;
+  int *classgroup; /* class list the table was built for, NULL for all classes */
+  int numclasses;
+  classLookupValueObj *values;
+  int *defaults; /* positions of classes without expression, they match any value */
+  int numdefaults;
+} classLookupObj;
+
+void msFreeClassLookup(layerObj *layer)
+{
+  classLookupObj *lookup = (classLookupObj*) layer->classlookup;
+  classLookupValueObj *cur, *tmp;
+
+  if(!lookup) return;
+  UT_HASH_ITER(hh, lookup->values, cur, tmp) {
+    UT_HASH_DEL(lookup->values, cur);
+    msFree(cur->value);
+    msFree(cur->positions);
+    msFree(cur);
+  }
+  msFree(lookup->classgroup);
+  msFree(lookup->defaults);
+  msFree(lookup);
+  layer->classlookup = NULL;
+}
+
+static void classLookupAddValue(classLookupObj *lookup, const char *value, int len, int position)
+{
+  classLookupValueObj *entry;
+
+  UT_HASH_FIND(hh, lookup->values, value, len, entry);
+  if(!entry) {
+    entry = (classLookupValueObj*) msSmallCalloc(1, sizeof(classLookupValueObj));
+    entry->value = (char*) msSmallMalloc(len + 1);
+    memcpy(entry->value, value, len);
+    entry->value[len] = '\0';
+    UT_HASH_ADD_KEYPTR(hh, lookup->values, entry->value, len, entry);
+  } else if(entry->positions[entry->numpositions-1] == position) {
+    return; /* value repeated within a list */
+  }
+  entry->positions = (int*) msSmallRealloc(entry->positions, (entry->numpositions + 1) * sizeof(int));
+  entry->positions[entry->numpositions++] = position;
+}
+
+/* adds the comma separated values of a list, as compared by MS_LIST and the IN operator */
+static void classLookupAddList(classLookupObj *lookup, const char *list, int position)
+{
+  const char *end;
+
+  while((end = strchr(list, ',')) != NULL) {
+    classLookupAddValue(lookup, list, end - list, position);
+    list = end + 1;
+  }
+  classLookupAddValue(lookup, list, strlen(list), position);
+}
+
+/*
+** Recognizes ("[ATTR]" = "value"), ("value" = "[ATTR]") and ("[ATTR]" IN "a,b"),
+** with any number of enclosing parentheses. Returns the attribute index or -1.
+*/
+static int classLookupAddExpression(classLookupObj *lookup, expressionObj *expression, int position)
+{
+  tokenListNodeObjPtr node = expression->tokens, binding, literal, op;
+  int depth = 0;
+
+  while(node && node->token == '(') {
+    depth++;
+    node = node->next;
+  }
+  if(!node || !node->next || !node->next->next)
+    return -1;
+
+  op = node->next;
+  if(node->token == MS_TOKEN_BINDING_STRING && node->next->next->token == MS_TOKEN_LITERAL_STRING) {
+    binding = node;
+    literal = node->next->next;
+  } else if(node->token == MS_TOKEN_LITERAL_STRING && node->next->next->token == MS_TOKEN_BINDING_STRING &&
+            op->token == MS_TOKEN_COMPARISON_EQ) {
+    binding = node->next->next;
+    literal = node;
+  } else {
+    return -1;
+  }
+  if(op->token != MS_TOKEN_COMPARISON_EQ && op->token != MS_TOKEN_COMPARISON_IN)
+    return -1;
+
+  node = node->next->next->next;
+  while(node && node->token == ')') {
+    depth--;
+    node = node->next;
+  }
+  if(node || depth != 0 || binding->tokenval.bindval.index < 0)
+    return -1;
+
+  if(op->token == MS_TOKEN_COMPARISON_IN)
+    classLookupAddList(lookup, literal->tokenval.strval, position);
+  else
+    classLookupAddValue(lookup, literal->tokenval.strval, strlen(literal->tokenval.strval), position);
+  return binding->tokenval.bindval.index;
+}
+
+static classLookupObj *msGetClassLookup(layerObj *layer, int *classgroup, int numclasses)
+{
+  classLookupObj *lookup = (classLookupObj*) layer->classlookup;
+  int i;
+
+  if(lookup) {
+    if((classgroup == NULL) == (lookup->classgroup == NULL) && numclasses == lookup->numclasses &&
+        (!classgroup || memcmp(classgroup, lookup->classgroup, numclasses * sizeof(int)) == 0))
+      return lookup;
+    msFreeClassLookup(layer); /* built for another class group */
+  }
+
+  lookup = (classLookupObj*) msSmallCalloc(1, sizeof(classLookupObj));
+  layer->classlookup = lookup;
+  lookup->numclasses = numclasses;
+  if(classgroup) {
+    lookup->classgroup = (int*) msSmallMalloc(numclasses * sizeof(int));
+    memcpy(lookup->classgroup, classgroup, numclasses * sizeof(int));
+  }
+  lookup->usable = MS_TRUE;
+  lookup->itemindex = -1;
+
+  for(i=0; i<numclasses && lookup->usable; i++) {
+    int iclass = classgroup ? classgroup[i] : i;
+    int itemindex = -1;
+    expressionObj *expression;
+
+    if(iclass < 0 || iclass >= layer->numclasses || layer->class[iclass]->status == MS_DELETE)
+      continue; /* never matches */
+    expression = &(layer->class[iclass]->expression);
+
+    if(MS_STRING_IS_NULL_OR_EMPTY(expression->string) || expression->native_string != NULL) {
+      lookup->defaults = (int*) msSmallRealloc(lookup->defaults, (lookup->numdefaults + 1) * sizeof(int));
+      lookup->defaults[lookup->numdefaults++] = i;
+      continue;
+    }
+
+    switch(expression->type) {
+      case(MS_STRING):
+        if(!(expression->flags & MS_EXP_INSENSITIVE) && layer->classitemindex >= 0) {
+          classLookupAddValue(lookup, expression->string, strlen(expression->string), i);
+          itemindex = layer->classitemindex;
+        }
+        break;
+      case(MS_LIST):
+        if(layer->classitemindex >= 0) {
+          classLookupAddList(lookup, expression->string, i);
+          itemindex = layer->classitemindex;
+        }
+        break;
+      case(MS_EXPRESSION):
+        itemindex = classLookupAddExpression(lookup, expression, i);
+        break;
+    }
+
+    if(itemindex < 0 || (lookup->itemindex >= 0 && itemindex != lookup->itemindex))
+      lookup->usable = MS_FALSE;
+    lookup->itemindex = itemindex;
+  }
+
+  if(lookup->usable && lookup->itemindex < 0)
+    lookup->usable = MS_FALSE; /* only default classes, nothing to gain */
+
+  if(layer->debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msShapeGetClass(): class lookup table %s for layer %s.\n",
+            lookup->usable ? "enabled" : "disabled", layer->name ? layer->name : "");
+
+  return lookup;
+}
+
+/* scale and size checks applied to a class before its expression is evaluated */
+static int msClassIsCandidate(layerObj *layer, mapObj *map, shapeObj *shape, int iclass)
+{
+  if(map->scaledenom > 0) { /* verify scaledenom here  */
+    if((layer->class[iclass]->maxscaledenom > 0) && (map->scaledenom > layer->class[iclass]->maxscaledenom))
+      return MS_FALSE; /* can skip this one, next class */
+    if((layer->class[iclass]->minscaledenom > 0) && (map->scaledenom <= layer->class[iclass]->minscaledenom))
+      return MS_FALSE; /* can skip this one, next class */
+  }
+
+  /* verify the minfeaturesize */
+  if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (layer->class[iclass]->minfeaturesize > 0)) {
+    double minfeaturesize = Pix2LayerGeoref(map, layer,
+                                            layer->class[iclass]->minfeaturesize);
+    if (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)
+      return MS_FALSE; /* skip this one, next class */
+  }
+
+  return layer->class[iclass]->status != MS_DELETE;
+}
+
 int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses)
 {
   int i, iclass;
+  classLookupObj *lookup;
 
   if (layer->numclasses > 0) {
     if (classgroup == NULL || numclasses <=0)
       numclasses = layer->numclasses;
 
+    lookup = msGetClassLookup(layer, classgroup, numclasses);
+    if(lookup->usable && lookup->itemindex < layer->numitems && lookup->itemindex < shape->numvalues) {
+      classLookupValueObj *entry;
+      int v = 0, d = 0, nv;
+      const char *value = shape->values[lookup->itemindex];
+
+      UT_HASH_FIND_STR(lookup->values, value, entry);
+      nv = entry ? entry->numpositions : 0;
+
+      /* walk the matching and the default classes in class order */
+      while(v < nv || d < lookup->numdefaults) {
+        if(d >= lookup->numdefaults || (v < nv && entry->positions[v] < lookup->defaults[d]))
+          i = entry->positions[v++];
+        else
+          i = lookup->defaults[d++];
+        iclass = classgroup ? classgroup[i] : i;
+        if(msClassIsCandidate(layer, map, shape, iclass))
+          return(iclass);
+      }
+      return(-1);
+    }
+
     for(i=0; i<numclasses; i++) {
       if (classgroup)
         iclass = classgroup[i];
@@ -593,22 +826,7 @@ int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgro
       if (iclass < 0 || iclass >= layer->numclasses)
         continue; /* this should never happen but just in case */
 
-      if(map->scaledenom > 0) { /* verify scaledenom here  */
-        if((layer->class[iclass]->maxscaledenom > 0) && (map->scaledenom > layer->class[iclass]->maxscaledenom))
-          continue; /* can skip this one, next class */
-        if((layer->class[iclass]->minscaledenom > 0) && (map->scaledenom <= layer->class[iclass]->minscaledenom))
-          continue; /* can skip this one, next class */
-      }
-
-      /* verify the minfeaturesize */
-      if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (layer->class[iclass]->minfeaturesize > 0)) {
-        double minfeaturesize = Pix2LayerGeoref(map, layer,
-                                                layer->class[iclass]->minfeaturesize);
-        if (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)
-          continue; /* skip this one, next class */
-      }
-
-      if(layer->class[iclass]->status != MS_DELETE && msEvalExpression(layer, shape, &(layer->class[iclass]->expression), layer->classitemindex) == MS_TRUE)
+      if(msClassIsCandidate(layer, map, shape, iclass) && msEvalExpression(layer, shape, &(layer->class[iclass]->expression), layer->classitemindex) == MS_TRUE)
         return(iclass);
     }
   }
@@ -1943,6 +2161,9 @@ void msCleanup()
 {
   msForceTmpFileBase( NULL );
   msConnPoolFinalCleanup();
+  msMapCacheCleanup();
+  msTreeCacheCleanup();
+  msPaletteCacheCleanup();
   /* Lexer string parsing variable */
   if (msyystring_buffer != NULL) {
     msFree(msyystring_buffer);
@@ -1956,6 +2177,7 @@ void msCleanup()
 #ifdef USE_GDAL
   msGDALCleanup();
 #endif
+  msProjectCleanup();
 #ifdef USE_PROJ
 #  if PJ_VERSION >= 480
   pj_clear_initcache();
@@ -141,6 +141,18 @@ static void flushRecord( DBFHandle psDBF )
 /************************************************************************/
 DBFHandle msDBFOpen( const char * pszFilename, const char * pszAccess )
 
+{
+  return msDBFOpenEx( pszFilename, pszAccess, 0 );
+}
+
+/************************************************************************/
+/*                            msDBFOpenEx()                             */
+/*                                                                      */
+/*      Same as msDBFOpen(), with MS_SHAPEFILE_OPEN_MMAP records of     */
+/*      read-only handles are read from a shared memory mapping.        */
+/************************************************************************/
+DBFHandle msDBFOpenEx( const char * pszFilename, const char * pszAccess, int nFlags )
+
 {
   DBFHandle   psDBF;
   uchar   *pabyBuf;
@@ -259,6 +271,12 @@ DBFHandle msDBFOpen( const char * pszFilename, const char * pszAccess )
         psDBF->panFieldOffset[iField-1] + psDBF->panFieldSize[iField-1];
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Map the file if requested, keep using stdio if that fails.      */
+  /* -------------------------------------------------------------------- */
+  if( (nFlags & MS_SHAPEFILE_OPEN_MMAP) && strchr(pszAccess, '+') == NULL )
+    psDBF->pabyMap = msSHPMapFile( psDBF->fp, &psDBF->nMapSize );
+
   return( psDBF );
 }
 
@@ -302,6 +320,7 @@ void  msDBFClose(DBFHandle psDBF)
   /* -------------------------------------------------------------------- */
   /*      Close, and free resources.                                      */
   /* -------------------------------------------------------------------- */
+  msSHPUnmapFile( psDBF->pabyMap );
   fclose( psDBF->fp );
 
   if( psDBF->panFieldOffset != NULL ) {
@@ -374,6 +393,9 @@ DBFHandle msDBFCreate( const char * pszFilename )
   psDBF->pszStringField = NULL;
   psDBF->nStringFieldLen = 0;
 
+  psDBF->pabyMap = NULL;
+  psDBF->nMapSize = 0;
+
   psDBF->bNoHeader = MS_TRUE;
   psDBF->bUpdated = MS_FALSE;
 
@@ -528,22 +550,32 @@ static const char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
   /* -------------------------------------------------------------------- */
   /*  Have we read the record?              */
   /* -------------------------------------------------------------------- */
-  if( psDBF->nCurrentRecord != hEntity ) {
-    flushRecord( psDBF );
-
+  if( psDBF->pabyMap ) {
     nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
-
-    safe_fseek( psDBF->fp, nRecordOffset, 0 );
-    if( fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp ) != 1 )
-    {
+    if( (size_t) nRecordOffset + psDBF->nRecordLength > psDBF->nMapSize ) {
       msSetError(MS_DBFERR, "Cannot read record %d.", "msDBFReadAttribute()",hEntity );
       return( NULL );
     }
+    pabyRec = psDBF->pabyMap + nRecordOffset;
+  } else {
+    if( psDBF->nCurrentRecord != hEntity ) {
+      flushRecord( psDBF );
 
-    psDBF->nCurrentRecord = hEntity;
+      nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
+
+      safe_fseek( psDBF->fp, nRecordOffset, 0 );
+      if( fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp ) != 1 )
+      {
+        msSetError(MS_DBFERR, "Cannot read record %d.", "msDBFReadAttribute()",hEntity );
+        return( NULL );
+      }
+
+      psDBF->nCurrentRecord = hEntity;
+    }
+
+    pabyRec = (const uchar *) psDBF->pszCurrentRecord;
   }
 
-  pabyRec = (const uchar *) psDBF->pszCurrentRecord;
   /* DEBUG */
   /* printf("CurrentRecord(%c):%s\n", psDBF->pachFieldType[iField], pabyRec); */
 
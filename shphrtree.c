@@ -0,0 +1,188 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to generate .hix (packed Hilbert R-tree)
+ *           shapefile spatial indexes.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+#include "maptree.h"
+#include "maptime.h"
+#include <string.h>
+
+
+
+char* AddFileSuffix ( const char * Filename, const char * Suffix )
+{
+  char  *pszFullname, *pszBasename;
+  int i;
+
+  /* -------------------------------------------------------------------- */
+  /*  Compute the base (layer) name.  If there is any extension     */
+  /*  on the passed in filename we will strip it off.         */
+  /* -------------------------------------------------------------------- */
+  pszBasename = (char *) msSmallMalloc(strlen(Filename)+5);
+  strcpy( pszBasename, Filename );
+  for( i = strlen(pszBasename)-1;
+       i > 0 && pszBasename[i] != '.' && pszBasename[i] != '/'
+       && pszBasename[i] != '\\';
+       i-- ) {}
+
+  if( pszBasename[i] == '.' )
+    pszBasename[i] = '\0';
+
+  pszFullname = (char *) msSmallMalloc(strlen(pszBasename) + 5);
+  sprintf( pszFullname, "%s%s", pszBasename, Suffix);
+
+  free(pszBasename);
+  return (pszFullname);
+}
+
+static double elapsed(struct mstimeval *start)
+{
+  struct mstimeval now;
+
+  msGettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+** Runs the same random queries through the .qix (plus the usual bounds
+** filtering) and the .hix index, checks that both produce the same shape
+** bitmaps and reports the time spent by each.
+*/
+static int benchmark(shapefileObj *shapefile, const char *qixname, const char *hixname, int numqueries)
+{
+  struct mstimeval start;
+  double qixtime = 0, hixtime = 0, w, h, size;
+  int i, j, mismatches = 0, nwords = (shapefile->numshapes + MS_ARRAY_BIT - 1) / MS_ARRAY_BIT;
+  long hits = 0;
+  ms_bitarray qixbits, hixbits;
+  rectObj rect;
+
+  w = shapefile->bounds.maxx - shapefile->bounds.minx;
+  h = shapefile->bounds.maxy - shapefile->bounds.miny;
+
+  srand(1);
+  for(i=0; i<numqueries; i++) {
+    /* query sizes from 0.1% to 25% of the extent, like tiles at varying zooms */
+    size = 0.001 + 0.249 * (rand() / (double) RAND_MAX);
+    rect.minx = shapefile->bounds.minx + (rand() / (double) RAND_MAX) * w * (1 - size);
+    rect.miny = shapefile->bounds.miny + (rand() / (double) RAND_MAX) * h * (1 - size);
+    rect.maxx = rect.minx + w * size;
+    rect.maxy = rect.miny + h * size;
+
+    msGettimeofday(&start, NULL);
+    qixbits = msSearchDiskTree(qixname, rect, MS_FALSE, shapefile->numshapes);
+    if(qixbits) msFilterTreeSearch(shapefile, qixbits, rect);
+    qixtime += elapsed(&start);
+
+    msGettimeofday(&start, NULL);
+    hixbits = msSearchHilbertTree(hixname, rect, MS_FALSE, shapefile->numshapes);
+    hixtime += elapsed(&start);
+
+    if(!qixbits || !hixbits) {
+      fprintf(stdout, "Unable to search %s.\n", qixbits ? hixname : qixname);
+      msFree(qixbits);
+      msFree(hixbits);
+      return MS_FAILURE;
+    }
+
+    if(memcmp(qixbits, hixbits, nwords * sizeof(ms_uint32)) != 0)
+      mismatches++;
+    for(j=0; j<shapefile->numshapes; j++)
+      if(msGetBit(hixbits, j)) hits++;
+
+    msFree(qixbits);
+    msFree(hixbits);
+  }
+
+  fprintf(stdout, "%d queries over %d shapes, %ld shapes selected\n", numqueries, shapefile->numshapes, hits);
+  fprintf(stdout, "  .qix: %.3f ms/query\n", qixtime * 1000 / numqueries);
+  fprintf(stdout, "  .hix: %.3f ms/query\n", hixtime * 1000 / numqueries);
+  fprintf(stdout, "  %d queries with differing results\n", mismatches);
+
+  return mismatches ? MS_FAILURE : MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  shapefileObj shapefile;
+  char *hixname, *qixname;
+  int status, numqueries = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc > 1 && strcmp(argv[1], "-bench") == 0) {
+    numqueries = 1000;
+    if(argc >= 4)
+      numqueries = atoi(argv[3]);
+    argv++;
+    argc--;
+  }
+
+  if(argc<2 || numqueries < 0) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    shphrtree <shpfile>\n" );
+    fprintf(stdout,"    shphrtree -bench <shpfile> [<queries>]\n" );
+    fprintf(stdout,"Where:\n");
+    fprintf(stdout," <shpfile> is the name of the .shp file to index.\n");
+    fprintf(stdout," -bench    compares an existing .hix index with the .qix\n");
+    fprintf(stdout,"           index created by shptree, running <queries>\n");
+    fprintf(stdout,"           random searches (default 1000) through both.\n");
+    exit(0);
+  }
+
+  if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(0);
+  }
+
+  hixname = AddFileSuffix(argv[1], MS_HRTREE_INDEX_EXTENSION);
+
+  if(numqueries > 0) {
+    qixname = AddFileSuffix(argv[1], MS_INDEX_EXTENSION);
+    status = benchmark(&shapefile, qixname, hixname, numqueries);
+    free(qixname);
+  } else {
+    printf("creating packed Hilbert R-tree index of %s\n", argv[1]);
+    status = msWriteHilbertTree(&shapefile, hixname);
+  }
+
+  if(status != MS_SUCCESS)
+    msWriteError(stdout);
+
+  /*
+  ** Clean things up
+  */
+  free(hixname);
+  msShapefileClose(&shapefile);
+
+  return(status == MS_SUCCESS ? 0 : 1);
+}
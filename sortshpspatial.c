@@ -0,0 +1,278 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to reorder a shapefile along a space
+ *           filling curve and index the result.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "mapserver.h"
+#include "maptree.h"
+
+#define CURVE_ORDER 65536
+
+typedef struct {
+  ms_uint32 key;
+  int index;
+} sortStruct;
+
+static int compare_key(const void *a, const void *b)
+{
+  const sortStruct *i = a, *j = b;
+  if(i->key > j->key)
+    return(1);
+  if(i->key < j->key)
+    return(-1);
+  return(i->index - j->index);
+}
+
+/*
+** Interleaves the bits of x and y (Morton code).
+*/
+static ms_uint32 zorder_index(ms_uint32 x, ms_uint32 y)
+{
+  ms_uint32 d = 0;
+  int i;
+
+  for(i=0; i<16; i++)
+    d |= ((x >> i) & 1) << (2*i) | ((y >> i) & 1) << (2*i+1);
+
+  return d;
+}
+
+static ms_uint32 scale(double v, double min, double max)
+{
+  double f;
+
+  if(max <= min) return 0;
+  f = (v - min) / (max - min) * (CURVE_ORDER - 1);
+  if(f <= 0) return 0;
+  if(f >= CURVE_ORDER - 1) return CURVE_ORDER - 1;
+  return (ms_uint32) f;
+}
+
+int main(int argc, char *argv[])
+{
+  SHPHandle    inSHP,outSHP; /* ---- Shapefile file pointers ---- */
+  DBFHandle    inDBF,outDBF; /* ---- DBF file pointers ---- */
+  shapefileObj shapefile;
+  treeObj      *tree;
+  sortStruct   *array;
+  rectObj      *rects, bounds;
+  shapeObj     shape;
+  int          shpType, nShapes;
+  DBFFieldType dbfField;
+  char         fName[20];
+  int          fWidth,fnDecimals;
+  char         buffer[1024];
+  int i,j;
+  int num_fields;
+  int zorder = MS_FALSE;
+  const char *index = "hix";
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Check the arguments, return syntax if not correct                         */
+  /* ------------------------------------------------------------------------------- */
+  if(argc >= 4) {
+    if(strcasecmp(argv[3], "zorder") == 0)
+      zorder = MS_TRUE;
+    else if(strcasecmp(argv[3], "hilbert") != 0)
+      argc = 0;
+  }
+  if(argc == 5)
+    index = argv[4];
+
+  if( argc < 3 || argc > 5 ||
+      (strcasecmp(index, "hix") && strcasecmp(index, "qix") && strcasecmp(index, "none")) ) {
+    fprintf(stderr,"Syntax: sortshpspatial [infile] [outfile] [hilbert|zorder] [hix|qix|none]\n" );
+    fprintf(stderr,"  Reorders the records of [infile] along a space filling curve of their\n");
+    fprintf(stderr,"  bounds (default hilbert) and writes a spatial index for [outfile]\n");
+    fprintf(stderr,"  (default hix, as built by shphrtree).\n");
+    exit(1);
+  }
+
+  msSetErrorFile("stderr", NULL);
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Open the shapefile and dbf file                                           */
+  /* ------------------------------------------------------------------------------- */
+  inSHP = msSHPOpen(argv[1], "rb" );
+  if( !inSHP ) {
+    fprintf(stderr,"Unable to open %s shapefile.\n",argv[1]);
+    exit(1);
+  }
+  msSHPGetInfo(inSHP, &nShapes, &shpType);
+
+  snprintf(buffer, sizeof(buffer), "%s.dbf",argv[1]);
+  inDBF = msDBFOpen(buffer,"rb");
+  if( inDBF == NULL ) {
+    fprintf(stderr,"Unable to open %s XBASE file.\n",buffer);
+    exit(1);
+  }
+
+  num_fields = msDBFGetFieldCount(inDBF);
+
+  if(msDBFGetRecordCount(inDBF) != nShapes) {
+    fprintf(stderr,"%s has %d records but %s has %d shapes.\n", buffer, msDBFGetRecordCount(inDBF), argv[1], nShapes);
+    exit(1);
+  }
+
+  array = (sortStruct *)malloc(sizeof(sortStruct)*(nShapes+1)); /* ---- Allocate the arrays ---- */
+  rects = (rectObj *)malloc(sizeof(rectObj)*(nShapes+1));
+  if(!array || !rects) {
+    fprintf(stderr, "Unable to allocate sort array.\n");
+    exit(1);
+  }
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Compute the curve position of every shape's center, null shapes last      */
+  /* ------------------------------------------------------------------------------- */
+  bounds.minx = bounds.miny = DBL_MAX;
+  bounds.maxx = bounds.maxy = -DBL_MAX;
+  for(i=0; i<nShapes; i++) {
+    array[i].index = i;
+    if(msSHPReadBounds(inSHP, i, &rects[i]) != MS_SUCCESS) {
+      rects[i].minx = rects[i].maxx = -DBL_MAX; /* ---- null shape ---- */
+      continue;
+    }
+    if(rects[i].minx < bounds.minx) bounds.minx = rects[i].minx;
+    if(rects[i].miny < bounds.miny) bounds.miny = rects[i].miny;
+    if(rects[i].maxx > bounds.maxx) bounds.maxx = rects[i].maxx;
+    if(rects[i].maxy > bounds.maxy) bounds.maxy = rects[i].maxy;
+  }
+
+  for(i=0; i<nShapes; i++) {
+    ms_uint32 x, y;
+
+    if(rects[i].maxx == -DBL_MAX) {
+      array[i].key = 0xFFFFFFFF;
+      continue;
+    }
+    x = scale((rects[i].minx + rects[i].maxx) / 2, bounds.minx, bounds.maxx);
+    y = scale((rects[i].miny + rects[i].maxy) / 2, bounds.miny, bounds.maxy);
+    array[i].key = zorder ? zorder_index(x, y) : msHilbertIndex(CURVE_ORDER, x, y);
+  }
+  free(rects);
+
+  qsort(array, nShapes, sizeof(sortStruct), compare_key);
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Setup the output .shp/.shx and .dbf files                                 */
+  /* ------------------------------------------------------------------------------- */
+  outSHP = msSHPCreate(argv[2],shpType);
+  if( outSHP == NULL ) {
+    fprintf( stderr, "Failed to create file '%s'.\n", argv[2] );
+    exit( 1 );
+  }
+
+  sprintf(buffer,"%s.dbf",argv[2]);
+  outDBF = msDBFCreate(buffer);
+  if( outDBF == NULL ) {
+    fprintf( stderr, "Failed to create dbf file '%s'.\n", buffer );
+    exit( 1 );
+  }
+
+  for(i=0; i<num_fields; i++) {
+    dbfField = msDBFGetFieldInfo(inDBF,i,fName,&fWidth,&fnDecimals); /* ---- Get field info from in file ---- */
+    msDBFAddField(outDBF,fName,dbfField,fWidth,fnDecimals);
+  }
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Write the sorted .shp/.shx and .dbf files                                 */
+  /* ------------------------------------------------------------------------------- */
+  for(i=0; i<nShapes; i++) { /* ---- For each shape/record ---- */
+
+    for(j=0; j<num_fields; j++) { /* ---- For each .dbf field ---- */
+
+      dbfField = msDBFGetFieldInfo(inDBF,j,fName,&fWidth,&fnDecimals);
+
+      switch (dbfField) {
+        case FTInteger:
+          msDBFWriteIntegerAttribute(outDBF, i, j, msDBFReadIntegerAttribute( inDBF, array[i].index, j));
+          break;
+        case FTDouble:
+          msDBFWriteDoubleAttribute(outDBF, i, j, msDBFReadDoubleAttribute( inDBF, array[i].index, j));
+          break;
+        case FTString:
+          msDBFWriteStringAttribute(outDBF, i, j, msDBFReadStringAttribute( inDBF, array[i].index, j));
+          break;
+        default:
+          fprintf(stderr,"Unsupported data type for field: %s, exiting.\n",fName);
+          exit(0);
+      }
+    }
+
+    msSHPReadShape( inSHP, array[i].index, &shape );
+    msSHPWriteShape( outSHP, &shape );
+    msFreeShape( &shape );
+  }
+
+  free(array);
+
+  msSHPClose(inSHP);
+  msDBFClose(inDBF);
+  msSHPClose(outSHP);
+  msDBFClose(outDBF);
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Index the sorted shapefile                                                */
+  /* ------------------------------------------------------------------------------- */
+  if(strcasecmp(index, "none") == 0)
+    return(0);
+
+  if(msShapefileOpen(&shapefile, "rb", argv[2], MS_TRUE) == -1) {
+    fprintf(stderr, "Error opening shapefile %s.\n", argv[2]);
+    exit(1);
+  }
+
+  if(strcasecmp(index, "hix") == 0) {
+    snprintf(buffer, sizeof(buffer), "%s%s", argv[2], MS_HRTREE_INDEX_EXTENSION);
+    if(msWriteHilbertTree(&shapefile, buffer) != MS_SUCCESS)
+      exit(1);
+  } else {
+    snprintf(buffer, sizeof(buffer), "%s%s", argv[2], MS_INDEX_EXTENSION);
+    tree = msCreateTree(&shapefile, 0);
+    if(!tree) {
+      fprintf(stderr, "Error generating quadtree.\n");
+      exit(1);
+    }
+    msWriteTree(tree, buffer, MS_NEW_LSB_ORDER);
+    msDestroyTree(tree);
+  }
+
+  msShapefileClose(&shapefile);
+
+  return(0);
+}